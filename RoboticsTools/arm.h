@@ -6,30 +6,304 @@
 #include <fstream>
 #include <string>
 #include <vector>
-#include <regex>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <functional>
 #include <algorithm>
 #include <set>
+#include <iomanip>
+#include <random>
+#include <cmath>
 
 #include "symbolicc++.h"
 
 #include "transform.h"
 #include "expressiontree.h"
+#include "tape.h"
+#include "dynamics.h"
+
+// Export options
+#define EXPORT_DEFAULT 0
+#define EXPORT_BATCH 1
+#define EXPORT_NO_ALLOC 2
+#define EXPORT_NO_VECTOR 4
+#define EXPORT_CSE 8
+#define EXPORT_FUSED 16
+#define EXPORT_GEOMETRIC_JACOBIAN 32
+#define EXPORT_TRIG_IDENTITIES 64
+#define EXPORT_SHARED_LIBRARY 128
+#define EXPORT_TEMPLATE 256
+#define EXPORT_HEADER 512
+#define EXPORT_JACOBIAN_DERIVATIVE 1024
+#define EXPORT_HESSIAN 2048
+#define EXPORT_ALL_FRAMES 4096
+#define EXPORT_PARALLEL 8192
+#define EXPORT_FLOAT32 16384
+#define EXPORT_FIXED_POINT 32768
+#define EXPORT_INVERSE_KINEMATICS 65536
+#define EXPORT_INVERSE_DYNAMICS 131072
+#define EXPORT_DYNAMICS_TERMS 262144
+#define EXPORT_FORWARD_DYNAMICS 524288
+
+// Options emitting dynamics, which need numeric link parameters & depend on m_gravity
+static const int s_dynamics_options = EXPORT_INVERSE_DYNAMICS | EXPORT_DYNAMICS_TERMS | EXPORT_FORWARD_DYNAMICS;
+
+// Version of the generated code, part of every export & compile cache key so that cached files of an
+// older generator are never served. Increment it with any change to the emitted code.
+static const int s_generator_version = 3;
+
+// Compiler flags of Arm::compile(), appended to $CXX (or c++)
+static const char* s_jit_flags = "-std=c++11 -O3 -march=native -fno-math-errno -fopenmp-simd -fPIC -shared";
+
+// Exports served from & stored into the on-disk export cache by this process
+struct ExportCacheStatistics {
+    long hits, misses;
+    double hit_ms, miss_ms;  // Total export wall time of each
+};
+static ExportCacheStatistics s_export_cache_statistics = { 0, 0, 0, 0 };
+
+// Entry points of a kinematics library loaded by Arm::compile(). Each takes the actuated
+// joint values q[joint_count] in chain order; functions that were not exported are nullptr.
+struct CompiledKinematics {
+    typedef void (*Function)(const double* q, double* out);
+
+    Function forward_kinematics;          // out[12]      : pose, row-major 3x4
+    Function geometric_jacobian;          // out[6N]      : row-major 6xN, linear rows first
+    Function forward_kinematics_jacobian; // out[12 + 6N] : pose followed by the Jacobian
+    Function kinematic_hessian;           // out[6N^2]    : dJ(r, i)/dq_j at out[(r*N + i)*N + j]
+    // With EXPORT_JACOBIAN_DERIVATIVE, out[6] = dJ/dt(q, q_dot)*q_dot
+    void (*jacobian_derivative_product)(const double* q, const double* q_dot, double* out);
+    std::vector<Function> differential_kinematics; // out[12] : d pose/d q_j per joint, without
+                                                   // EXPORT_GEOMETRIC_JACOBIAN
+    // With EXPORT_BATCH, count configurations as structure-of-arrays: joint j of configuration i
+    // is q[j*count + i], pose entry e is written to out[e*count + i]
+    void (*forward_kinematics_batch)(const double* q, int count, double* out);
+    // With EXPORT_ALL_FRAMES, the frame of every transform of the chain, out[12*frame_count]
+    // row-major 3x4 per frame, or out[(12*frame + e)*count + i] for count configurations
+    Function all_frames;
+    void (*all_frames_batch)(const double* q, int count, double* out);
+    // With EXPORT_INVERSE_KINEMATICS, the closed-form solutions of a pose (row-major 3x4), q[6] per row of
+    // solutions[48]; returns their count
+    int (*inverse_kinematics)(const double* pose, double* solutions);
+    // With EXPORT_INVERSE_DYNAMICS, the joint torques (forces of prismatic joints) tau[N]
+    void (*inverse_dynamics)(const double* q, const double* q_dot, const double* q_ddot, double* tau);
+    // With EXPORT_DYNAMICS_TERMS, the mass matrix M[N*N] (row-major), c[N] = C(q, q_dot)*q_dot & g[N]
+    void (*dynamics_terms)(const double* q, const double* q_dot, double* M, double* c, double* g);
+    // With EXPORT_FORWARD_DYNAMICS, the joint accelerations q_ddot[N] under the joint torques tau[N]
+    void (*forward_dynamics)(const double* q, const double* q_dot, const double* tau, double* q_ddot);
+    int joint_count;
+    int frame_count;
+    int end_effector_count;  // Poses written by forward_kinematics, more than one for a KinematicTree
+    void* handle;
+    std::string library;
+};
+
+// Maximum absolute difference of an Arm::export_target() export from the double forward kinematics
+struct TargetError {
+    double rotation;  // Over the 9 rotation entries of the pose
+    double position;  // Over the 3 position entries, in the units of the DH parameters
+    int samples;
+};
+
+class FunctionStream;
 
 /////////////////////////////////////////////////
 
 class Arm {
 public:
     Symbolic m_forward_kinematics;
+    Symbolic m_geometric_jacobian;
+    Symbolic m_kinematic_hessian;
+    Symbolic m_jacobian_derivative;
+    std::vector<Symbolic> m_frames;
+    std::vector<Symbolic> m_frame_products;
     std::vector<Symbolic> m_differential_kinematics;
     std::vector<Symbolic> m_actuated_joints;
+    std::vector<Symbolic> m_joint_velocities;
     std::vector<Transform> m_transforms;
 
+    // Derivation caches, reused while the link transforms they were built from are unchanged.
+    // m_frames[i] is the prefix product T_0 ... T_i & m_suffixes[i] the suffix product T_i ... T_n;
+    // the first m_valid_frames prefixes & the last m_valid_suffixes suffixes are current.
+    std::vector<Symbolic> m_chain_links;
+    std::vector<Symbolic> m_suffixes;
+    int m_valid_frames, m_valid_suffixes;
+    bool m_valid_chain, m_valid_derivatives, m_valid_second_order;
+    int m_jacobian_mode;  // EXPORT_GEOMETRIC_JACOBIAN bit m_geometric_jacobian was derived with, or -1
+    std::vector<Symbolic> m_derivatives;
+
+    // Directory of the on-disk export cache, $ROBOTICS_EXPORT_CACHE by default; disabled when empty.
+    // Exports are stored by a hash of the generator version, transforms, options & file names, and an
+    // export matching a stored one copies its files without deriving the kinematics.
+    std::string m_export_cache;
+
+    // Worker processes of EXPORT_PARALLEL, the online CPUs by default
+    int m_export_workers;
+
+    // EXPORT_FIXED_POINT format: fraction bits of the int32_t Q-format values (Q16.16 by default) &
+    // log2 of the entries of the interpolated sine table over one turn (1024 by default)
+    int m_fixed_point_bits;
+    int m_sin_table_bits;
+
+    // Gravitational acceleration in the base frame, for the dynamics ({0, 0, -9.81} by default)
+    std::vector<double> m_gravity;
+
     Arm(const std::vector<Transform>& transforms);
 
     ~Arm();
 
+    // Replace the transform at index. The next derivation only recomputes the products & derivatives
+    // containing it; edits made directly to m_transforms are detected the same way.
+    void set_transform(int index, const Transform& transform);
+
+    static const ExportCacheStatistics& export_cache_statistics();
+
     // Export forward & differential kinematics to file
-    void export_expressions(std::string filename);
+    // EXPORT_BATCH     : Also emit a structure-of-arrays forward kinematics kernel
+    // EXPORT_NO_ALLOC  : Write each transform into a caller-owned double[12]
+    // EXPORT_NO_VECTOR : Omit the std::vector returning wrappers of EXPORT_NO_ALLOC
+    // EXPORT_CSE       : Hoist subexpressions shared by all kinematics expressions into temporaries
+    // EXPORT_FUSED     : Also emit forward_kinematics_jacobian(), writing the pose & geometric Jacobian
+    // EXPORT_GEOMETRIC_JACOBIAN : Build the 6xN geometric Jacobian from the chain's joint axes & origins
+    //                             and emit geometric_jacobian() instead of differential_kinematics_d*()
+    // EXPORT_TRIG_IDENTITIES : Derive compound angles from the joint sines & cosines, one sincos per joint
+    // EXPORT_SHARED_LIBRARY  : Emit extern "C" kinematics_*(const double* q, double* out) entry points
+    //                          instead of a test program; implies EXPORT_NO_ALLOC & EXPORT_NO_VECTOR
+    // EXPORT_TEMPLATE        : Emit each function as template <typename T> with trig through overloadable
+    //                          kinematics_sin/cos/sincos hooks, instantiated for float & double
+    // EXPORT_JACOBIAN_DERIVATIVE : Also emit jacobian_derivative_product(), writing dJ/dt*q_dot of the
+    //                              geometric Jacobian given the joint positions & velocities
+    // EXPORT_HESSIAN         : Also emit kinematic_hessian(), writing dJ(r, i)/dq_j of the geometric Jacobian
+    // EXPORT_ALL_FRAMES      : Also emit all_frames() & all_frames_batch(), writing the frame of every transform,
+    //                          each computed from the previous frame
+    // EXPORT_PARALLEL        : Derive & simplify the differential kinematics entries in m_export_workers worker
+    //                          processes. The output is identical to a serial export. Applies when the symbolic
+    //                          columns are not needed by other options (EXPORT_FUSED, EXPORT_GEOMETRIC_JACOBIAN,
+    //                          second order), & leaves m_differential_kinematics empty.
+    // EXPORT_FLOAT32         : Emit float functions with float literals & sinf/cosf, for targets without a
+    //                          double precision FPU; implies EXPORT_NO_ALLOC & EXPORT_NO_VECTOR, no test program
+    // EXPORT_FIXED_POINT     : Emit int32_t Q-format functions (m_fixed_point_bits fraction bits) with table
+    //                          interpolated sin/cos; implies EXPORT_NO_ALLOC & EXPORT_NO_VECTOR, no test program
+    // EXPORT_INVERSE_KINEMATICS : Also emit inverse_kinematics(), the closed-form solutions of a spherical wrist arm
+    // EXPORT_INVERSE_DYNAMICS   : Also emit inverse_dynamics(), the joint torques of the recursive Newton-Euler
+    //                             algorithm given the joint positions, velocities & accelerations
+    // EXPORT_DYNAMICS_TERMS     : Also emit dynamics_terms(), the mass matrix, Coriolis & gravity torques
+    // EXPORT_FORWARD_DYNAMICS   : Also emit forward_dynamics(), the joint accelerations of the articulated-body
+    //                             algorithm given the joint positions, velocities & torques
+    void export_expressions(std::string filename, int options=EXPORT_DEFAULT);
+
+    // Export the kinematics as an include-guarded header of inline functions in namespace name_space,
+    // with joint_count, joint_names & dh_table metadata, so that several arms can be linked into one
+    // program. Given a source_filename, all functions but forward_kinematics are declared in the header
+    // & defined in that file instead. Sets EXPORT_HEADER; EXPORT_SHARED_LIBRARY is not supported.
+    void export_header(std::string filename, std::string name_space, int options=EXPORT_NO_ALLOC,
+                       std::string source_filename="");
+
+    // Export, compile & dlopen the kinematics as a shared library in cache_directory
+    // (~/.cache/robotics_kinematics by default), which must be private to the user. Libraries are
+    // named by a hash of the generator version, transforms, options, compiler & host CPU, so a
+    // repeated geometry is loaded without recompiling.
+    CompiledKinematics compile(int options=EXPORT_CSE|EXPORT_FUSED|EXPORT_GEOMETRIC_JACOBIAN|EXPORT_TRIG_IDENTITIES,
+                               std::string cache_directory="");
+
+    // Export for EXPORT_FLOAT32 or EXPORT_FIXED_POINT, then compile the export with $CXX & report its maximum
+    // absolute pose error against the double forward kinematics over samples configurations, each joint
+    // uniform in [-pi, pi).
+    TargetError export_target(std::string filename, int options=EXPORT_FLOAT32|EXPORT_CSE,
+                              int samples=100000, std::string cache_directory="");
+
+    // Lower the simplified forward kinematics into an interpreted instruction tape, for
+    // targets without a compiler. Outputs the pose (row-major 3x4), followed by the 6xN
+    // geometric Jacobian (row-major, linear rows first) if EXPORT_FUSED or
+    // EXPORT_GEOMETRIC_JACOBIAN is set. EXPORT_CSE evaluates shared subexpressions once.
+    KinematicsTape tape(int options=EXPORT_CSE|EXPORT_GEOMETRIC_JACOBIAN);
+
+    // Forward kinematics of the chain into m_forward_kinematics. The first derivation folds the prefix
+    // products into m_frames; after an edit to links [first, last], the product is rebuilt as
+    // m_frames[first-1]*(T_first ... T_last*m_suffixes[last+1]), which also extends the suffix cache.
+    void derive_chain();
+
+    // After derive_chain(): complete the prefix products in m_frames
+    void derive_frames();
+
+    // After derive_chain(): m_differential_kinematics unless EXPORT_GEOMETRIC_JACOBIAN is set,
+    // m_geometric_jacobian if EXPORT_FUSED, EXPORT_GEOMETRIC_JACOBIAN or a second order option is set
+    void derive_jacobian(int options);
+
+    // After derive_jacobian(): the 6xN^2 kinematic hessian, dJ(r, i)/dq_j in column i*N + j, & the 6x1
+    // dJ/dt*q_dot = sum_ij dJ(r, i)/dq_j*q_dot_i*q_dot_j in terms of m_joint_velocities.
+    // The linear rows are second derivatives of the position, so only j >= i is differentiated.
+    void derive_second_order();
+
+    // Each frame of the chain as the product of the previous frame, in symbols named by frame_entry_name(),
+    // with its link transform into m_frame_products
+    void derive_frame_products();
+
+    // Build the 6xN geometric Jacobian from the joint axes & origins of the frames in m_frames
+    Symbolic geometric_jacobian();
+
+    // True for 6 revolute joints with numeric parameters, static transforms only before the first or after the
+    // last, whose last three axes intersect (a4 = a5 = d5 = 0, with twists alpha4 & alpha5 other than 0 or pi)
+    bool spherical_wrist();
+
+    // Emit inverse_kinematics() for a spherical wrist arm: the wrist center fixes joints 1-3 (Pieper), through
+    // a*cos(q3) + b*sin(q3) = c when axes 1 & 2 intersect or are parallel, a quadratic when axes 2 & 3 are
+    // parallel & a quartic otherwise, then joints 4-6 follow from the wrist orientation. All (up to 8) branches
+    // are enumerated.
+    void emit_inverse_kinematics(FunctionStream& os, int options);
+
+    // Numeric parameters of each transform for the dynamics; throws for symbolic link parameters
+    std::vector<DynamicsLink> dynamics_links();
+
+    // Joint torques by the recursive Newton-Euler algorithm, walking m_transforms at runtime
+    std::vector<double> inverse_dynamics(const std::vector<double>& q, const std::vector<double>& q_dot,
+                                         const std::vector<double>& q_ddot);
+
+    // The transforms in generated dynamics code: revolute joints through c_q & s_q, velocities q_dot &
+    // accelerations q_ddot (named after m_joint_velocities)
+    std::vector<CodeLink> code_links();
+
+    // Emit inverse_dynamics(q..., q_dot..., q_ddot..., tau[N]), the recursive Newton-Euler algorithm
+    // unrolled over the links with the numeric link parameters folded in
+    void emit_inverse_dynamics(FunctionStream& os, int options);
+
+    // Mass matrix M[N*N], Coriolis & centrifugal torques c[N] = C(q, q_dot)*q_dot & gravity torques g[N]
+    // at runtime, by the recursive Newton-Euler algorithm
+    void dynamics_terms(const std::vector<double>& q, const std::vector<double>& q_dot,
+                        std::vector<double>& M, std::vector<double>& c, std::vector<double>& g);
+
+    // Emit dynamics_terms(q..., q_dot..., M[N*N], C_q_dot[N], g[N]): M & g by the composite rigid body
+    // algorithm & C_q_dot by the recursive Newton-Euler algorithm without accelerations or gravity, after
+    // one evaluation of the joints' sines & cosines
+    void emit_dynamics_terms(FunctionStream& os, int options);
+
+    // Joint accelerations by the articulated-body algorithm, walking m_transforms at runtime
+    std::vector<double> forward_dynamics(const std::vector<double>& q, const std::vector<double>& q_dot,
+                                         const std::vector<double>& tau);
+
+    // Emit forward_dynamics(q..., q_dot..., tau[N], q_ddot[N]), the articulated-body algorithm unrolled
+    // over the links with the numeric link parameters folded in
+    void emit_forward_dynamics(FunctionStream& os, int options);
+
+    // Shared implementation of export_expressions & export_header
+    void export_kinematics(const std::string& filename, int options,
+                           const std::string& name_space, const std::string& source_filename);
+    void write_header(const std::string& filename, const std::string& name_space,
+                      const std::string& source_filename, const std::string& includes,
+                      const std::string& inline_functions, const std::string& source_functions,
+                      const std::string& source_declarations, const std::string& instantiation_declarations,
+                      const std::string& instantiation_definitions);
 
     // Get each frame transform of the arm given a set of joint positions
     std::vector<std::vector<std::vector<double>>>
@@ -39,9 +313,9 @@ public:
 /////////////////////////////////////////////////
 // UTILITY
 
-static void replace(std::string* in, std::string pattern, std::string replacement){
-    *in = std::regex_replace( *in, std::regex(pattern), replacement );
-}
+static const char* s_pose_entries[12] = { "R11", "R12", "R13", "X",
+                                          "R21", "R22", "R23", "Y",
+                                          "R31", "R32", "R33", "Z" };
 
 static std::vector<std::string> split(const std::string& str, const std::string& delim) {
     std::vector<std::string> tokens;
@@ -66,6 +340,162 @@ static std::string get_name(const Symbolic& symb){
     return name;
 }
 
+// 64-bit FNV-1a, stable across runs & platforms unlike std::hash
+static std::string hash_string(const std::string& str) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : str) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    std::ostringstream stream;
+    stream << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return stream.str();
+}
+
+// Transform parameter with numbers at full precision, for content hashing
+static std::string print_parameter(const Symbolic& parameter) {
+    if (parameter.type() == typeid(Numeric)) {
+        return print_number(double(parameter));
+    }
+    std::ostringstream stream;
+    stream << parameter;
+    return stream.str();
+}
+
+// Generator version, then the Denavit-Hartenberg parameters & joints of a chain, one line per transform
+static std::string transforms_key(const std::vector<Transform>& transforms) {
+    std::ostringstream key;
+    key << "generator " << s_generator_version << "\n";
+    for (auto T : transforms) {
+        key << print_parameter(T.m_theta) << " " << print_parameter(T.m_d) << " "
+            << print_parameter(T.m_a) << " " << print_parameter(T.m_alpha) << " "
+            << T.m_joint_type << " " << T.m_joint_id;
+        if (T.has_inertia()) {
+            key << " " << print_number(T.m_mass);
+            for (double value : T.m_center_of_mass) {
+                key << " " << print_number(value);
+            }
+            for (double value : T.m_inertia) {
+                key << " " << print_number(value);
+            }
+        }
+        key << "\n";
+    }
+    return key.str();
+}
+
+// Parameter of a Transform with pi substituted; throws for symbolic parameters
+static double numeric_parameter(const Symbolic& parameter) {
+    return double(parameter.subst(SymbolicConstant::pi, Symbolic(M_PI)));
+}
+
+// Rows of a header's dh_table; throws for transforms whose parameters, other than the actuated one, are symbolic
+static std::string dh_table_rows(std::vector<Transform> transforms) {
+    std::ostringstream rows;
+    int joint = 0;
+    for (int index = 0; index < transforms.size(); index++) {
+        Transform& T = transforms[index];
+        auto value = [&T] (const Symbolic& parameter) {
+            if (T.is_actuated() && parameter == T.get_actuated_joint()) {
+                return std::string("0");
+            }
+            return print_number(numeric_parameter(parameter));
+        };
+        try {
+            rows << "    { " << value(T.m_theta) << ", " << value(T.m_d) << ", " << value(T.m_a) << ", "
+                 << value(T.m_alpha) << ", " << T.m_joint_type << ", " << (T.is_actuated() ? joint++ : -1) << " },\n";
+        } catch (...) {
+            throw std::invalid_argument("Header exports need numeric Denavit-Hartenberg parameters, but transform " +
+                                        std::to_string(index) + " has symbolic ones");
+        }
+    }
+    return rows.str();
+}
+
+// Creates directory with owner-only permissions if missing, and refuses it unless it is a directory
+// (not a symbolic link) owned by the effective user & writable by no one else: the libraries found
+// there are loaded into the process
+static void private_directory(const std::string& directory) {
+    if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create directory " + directory);
+    }
+    struct stat status;
+    if (lstat(directory.c_str(), &status) != 0 || !S_ISDIR(status.st_mode) || status.st_uid != geteuid() ||
+        (status.st_mode & (S_IWGRP | S_IWOTH))) {
+        throw std::runtime_error("Refusing directory " + directory + ": it must be a directory owned by the "
+                                 "current user & not writable by its group or others");
+    }
+}
+
+// Directory of the libraries built by Arm::compile() & Arm::export_target(), created if missing:
+// $XDG_CACHE_HOME/robotics_kinematics, or ~/.cache/robotics_kinematics, by default
+static std::string compile_cache_directory(std::string cache_directory) {
+    if (cache_directory.empty()) {
+        const char* cache = std::getenv("XDG_CACHE_HOME");
+        const char* home = std::getenv("HOME");
+        if (cache && *cache) {
+            cache_directory = cache;
+        } else if (home && *home) {
+            cache_directory = std::string(home) + "/.cache";
+        } else {
+            const char* tmp = std::getenv("TMPDIR");
+            cache_directory = std::string(tmp ? tmp : "/tmp") + "/robotics_kinematics_" + std::to_string(geteuid());
+            private_directory(cache_directory);
+            return cache_directory;
+        }
+        if (mkdir(cache_directory.c_str(), 0700) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Cannot create cache directory " + cache_directory);
+        }
+        cache_directory += "/robotics_kinematics";
+    }
+    private_directory(cache_directory);
+    return cache_directory;
+}
+
+static std::string compiler_command() {
+    const char* cxx = std::getenv("CXX");
+    return std::string(cxx ? cxx : "c++") + " " + s_jit_flags;
+}
+
+// Builds under a per-process name & renames, so concurrent builds never load a partial library
+// The machine, CPU model & features that -march=native compiles for, from the first processor of
+// /proc/cpuinfo where available, for the compile cache keys
+static std::string host_cpu() {
+    struct utsname host;
+    std::string cpu = (uname(&host) == 0) ? host.machine : "";
+    std::ifstream cpuinfo ("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line) && !line.empty()) {
+        if (line.compare(0, 10, "model name") == 0 || line.compare(0, 5, "flags") == 0 ||
+            line.compare(0, 8, "Features") == 0 || line.compare(0, 8, "CPU part") == 0) {
+            cpu += "\n" + line;
+        }
+    }
+    return cpu;
+}
+
+static void build_library(const std::string& compiler, const std::string& source, const std::string& library) {
+    std::string partial = library.substr(0, library.size() - 3) + "." + std::to_string(getpid()) + ".so";
+    std::string command = compiler + " \"" + source + "\" -o \"" + partial + "\"";
+    if (std::system(command.c_str()) != 0 || std::rename(partial.c_str(), library.c_str()) != 0) {
+        std::remove(partial.c_str());
+        throw std::runtime_error("Failed to compile kinematics: " + command);
+    }
+}
+
+static std::string base_name(const std::string& filename) {
+    return filename.substr(filename.find_last_of('/') + 1);
+}
+
+static bool copy_file(const std::string& from, const std::string& to) {
+    std::ifstream source (from, std::ifstream::binary);
+    if (!source) {
+        return false;
+    }
+    std::ofstream destination (to, std::ofstream::binary);
+    destination << source.rdbuf();
+    return bool(destination);
+}
+
 static std::ostream &operator<<(std::ostream &os, std::vector<std::vector<double>> const &matrix) {
     os << "[\n";
     for (auto x : matrix) {
@@ -76,6 +506,7 @@ static std::ostream &operator<<(std::ostream &os, std::vector<std::vector<double
         os << " ]\n";
     }
     os << "]\n";
+    return os;
 }
 
 static std::vector<std::vector<double>>
@@ -98,6 +529,587 @@ multiply_transforms(const std::vector<std::vector<double>>& T_a, const std::vect
     return retval;
 }
 
+// Local variable holding an entry of a frame of the chain, e.g. frame2_R13. Frames count from 1.
+static std::string frame_entry_name(int frame, int entry) {
+    return "frame" + std::to_string(frame) + "_" + s_pose_entries[entry];
+}
+
+// Simplifies the trigonometric expressions of the first entries of a symbolic matrix, row-major
+static std::vector<ExpressionTree>
+simplify_expressions(const Symbolic& matrix, std::set<std::string>* new_variables, int count=12) {
+    std::vector<ExpressionTree> trees;
+
+    for (int expr_idx = 0; expr_idx < count; expr_idx++) {
+        ExpressionTree tree (matrix(expr_idx / matrix.columns(), expr_idx % matrix.columns()));
+        auto variables = tree.simplify();
+        new_variables->insert(variables.begin(), variables.end());
+        trees.push_back(tree);
+    }
+    return trees;
+}
+
+// Length-prefixed fields, so that serialized strings may contain any character
+static void write_field(std::string* out, const std::string& field) {
+    *out += std::to_string(field.size()) + ":" + field;
+}
+
+static std::string read_field(const std::string& in, size_t* pos) {
+    size_t colon = in.find(':', *pos);
+    if (colon == std::string::npos) {
+        throw std::runtime_error("Malformed serialized expression");
+    }
+    size_t length = std::stoul(in.substr(*pos, colon - *pos));
+    std::string field = in.substr(colon + 1, length);
+    *pos = colon + 1 + length;
+    return field;
+}
+
+// A simplified expression & the variables it declares, as returned by export workers
+static std::string serialize_tree(const ExpressionTree& tree, const std::set<std::string>& variables) {
+    std::string out;
+    write_field(&out, std::to_string(variables.size()));
+    for (auto var : variables) {
+        write_field(&out, var);
+    }
+    write_field(&out, std::to_string(tree.m_expr.elements.size()));
+    for (auto term : tree.m_expr.elements) {
+        write_field(&out, term.positive ? "+" : "-");
+        write_field(&out, std::to_string(term.elements.size()));
+        for (auto factor : term.elements) {
+            write_field(&out, factor);
+        }
+    }
+    return out;
+}
+
+static ExpressionTree deserialize_tree(const std::string& in, std::set<std::string>* variables) {
+    size_t pos = 0;
+    int count = std::stoi(read_field(in, &pos));
+    for (int index = 0; index < count; index++) {
+        variables->insert(read_field(in, &pos));
+    }
+    ExpressionTree tree (Symbolic(0));
+    tree.m_expr.elements.clear();
+    int terms = std::stoi(read_field(in, &pos));
+    for (int term = 0; term < terms; term++) {
+        MultiplyExpression mult;
+        mult.positive = (read_field(in, &pos) == "+");
+        int factors = std::stoi(read_field(in, &pos));
+        for (int factor = 0; factor < factors; factor++) {
+            mult.elements.push_back(read_field(in, &pos));
+        }
+        tree.m_expr.elements.push_back(mult);
+    }
+    return tree;
+}
+
+// Evaluates task(index) for index in [0, count) in worker processes forked from this one. Symbolic
+// expressions are not thread safe (reference counts, static state), but each worker owns a copy.
+// Workers take the next index from a shared counter as they finish; results are returned in index order.
+static std::vector<std::string> fork_map(int count, int workers, const std::function<std::string(int)>& task) {
+    workers = std::max(1, std::min(workers, count));
+    void* shared = mmap(nullptr, sizeof(std::atomic<int>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        throw std::runtime_error("Cannot map export worker counter");
+    }
+    std::atomic<int>* next = new (shared) std::atomic<int>(0);
+    std::vector<pid_t> pids;
+    std::vector<int> pipes;
+    std::cout << std::flush;
+    for (int worker = 0; worker < workers; worker++) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            throw std::runtime_error("Cannot create export worker pipe");
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("Cannot fork export worker");
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            int status = 0;
+            try {
+                for (int index = (*next)++; index < count && status == 0; index = (*next)++) {
+                    std::string result = task(index);
+                    std::string record = std::to_string(index) + " " + std::to_string(result.size()) + "\n" + result;
+                    for (size_t written = 0; written < record.size(); ) {
+                        ssize_t n = write(fds[1], record.data() + written, record.size() - written);
+                        if (n < 0 && errno != EINTR) {
+                            status = 1;
+                            break;
+                        }
+                        written += std::max<ssize_t>(n, 0);
+                    }
+                }
+            } catch (...) {
+                status = 1;
+            }
+            close(fds[1]);
+            _exit(status);
+        }
+        close(fds[1]);
+        pids.push_back(pid);
+        pipes.push_back(fds[0]);
+    }
+
+    std::vector<std::string> results (count);
+    std::vector<bool> received (count, false);
+    bool failed = false;
+    for (int worker = 0; worker < workers; worker++) {
+        std::string data;
+        char buffer[65536];
+        for (ssize_t n; (n = read(pipes[worker], buffer, sizeof(buffer))) != 0; ) {
+            if (n > 0) {
+                data.append(buffer, n);
+            } else if (errno != EINTR) {
+                break;
+            }
+        }
+        close(pipes[worker]);
+        // A worker that died mid-write leaves a truncated record, which fails the export like its exit status
+        for (size_t pos = 0; pos < data.size(); ) {
+            size_t newline = data.find('\n', pos);
+            if (newline == std::string::npos) {
+                failed = true;
+                break;
+            }
+            std::istringstream header (data.substr(pos, newline - pos));
+            int index;
+            long long length;
+            if (!(header >> index >> length) || index < 0 || index >= count || length < 0 ||
+                    (unsigned long long)length > data.size() - newline - 1) {
+                failed = true;
+                break;
+            }
+            results[index] = data.substr(newline + 1, length);
+            received[index] = true;
+            pos = newline + 1 + length;
+        }
+        int status;
+        waitpid(pids[worker], &status, 0);
+        failed = failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    munmap(shared, sizeof(std::atomic<int>));
+    if (failed || std::count(received.begin(), received.end(), false) > 0) {
+        throw std::runtime_error("Parallel export worker failed");
+    }
+    return results;
+}
+
+// Scalar type & definition prefix of the emitted functions
+static std::string scalar_type(int options) {
+    if (options & EXPORT_FLOAT32) {
+        return "float";
+    } else if (options & EXPORT_FIXED_POINT) {
+        return "int32_t";
+    }
+    return (options & EXPORT_TEMPLATE) ? "T" : "double";
+}
+
+// Name of the emitted "sin", "cos" or "sincos" function for the scalar type
+static std::string trig_function(const std::string& function, int options) {
+    if (options & EXPORT_FLOAT32) {
+        return (function == "sincos") ? "SINCOSF" : function + "f";
+    } else if (options & EXPORT_FIXED_POINT) {
+        return "kinematics_" + function + "_q";
+    } else if (options & EXPORT_TEMPLATE) {
+        return "kinematics_" + function;
+    }
+    return (function == "sincos") ? "SINCOS" : function;
+}
+
+// Product of two emitted factors; Q-format products are rescaled by kinematics_qmul
+static std::string multiply(const std::string& a, const std::string& b, int options) {
+    return (options & EXPORT_FIXED_POINT) ? "kinematics_qmul(" + a + ", " + b + ")" : a + "*" + b;
+}
+
+static std::string function_prefix(int options) {
+    std::string linkage = (options & EXPORT_HEADER) ? "inline " : "static ";
+    return (options & EXPORT_TEMPLATE) ? "template <typename T>\n" + linkage : linkage;
+}
+
+// Code of the exported functions. Each function is opened with its signature & doc comment, which also
+// record its declaration, so a header export declares the functions defined in its source file without
+// parsing their code. Functions opened out of line, for that source file, are not inline.
+class FunctionStream : public std::ostringstream {
+public:
+    std::string m_declarations;
+    bool m_out_of_line = false;
+
+    // Writes e.g. "static void f(double q1, double pose[12]) {" for the signature "void f(double q1, double pose[12])",
+    // after comment, whole "// " lines
+    void open(int options, const std::string& signature, const std::string& comment = "") {
+        std::string prefix = function_prefix(options);
+        if (m_out_of_line && (options & EXPORT_HEADER)) {
+            prefix.erase(prefix.find("inline "), 7);
+        }
+        *this << comment << prefix << signature << " {\n";
+        m_declarations += comment + ((options & EXPORT_TEMPLATE) ? "template <typename T>\n" : "") + signature + ";\n";
+    }
+};
+
+// With EXPORT_TEMPLATE numbers are converted to T & with EXPORT_FLOAT32 printed as float literals,
+// so float expressions stay in float. EXPORT_FIXED_POINT converts numbers to Q-format constants
+// & folds each term's factors left to right through kinematics_qmul.
+static std::string print_expression(const SumExpression& expr, int options=EXPORT_DEFAULT) {
+    std::ostringstream stream;
+    if (options & (EXPORT_TEMPLATE | EXPORT_FLOAT32 | EXPORT_FIXED_POINT)) {
+        SumExpression converted = expr;
+        for (auto& term : converted.elements) {
+            for (auto& element : term.elements) {
+                if (!std::isdigit(element[0]) && element[0] != '.') {
+                    continue;
+                }
+                if (options & EXPORT_FIXED_POINT) {
+                    element = "KINEMATICS_Q(" + element + ")";
+                } else if (options & EXPORT_FLOAT32) {
+                    element += (element.find_first_of(".e") == std::string::npos) ? ".0f" : "f";
+                } else {
+                    element = "T(" + element + ")";
+                }
+            }
+        }
+        if (options & EXPORT_FIXED_POINT) {
+            for (auto term : converted.elements) {
+                std::string product = term.elements.front();
+                for (auto element = term.elements.begin()+1; element != term.elements.end(); element++) {
+                    product = multiply(product, *element, options);
+                }
+                stream << (term.positive ? "+" : "-") << product;
+            }
+        } else {
+            stream << converted;
+        }
+    } else {
+        stream << expr;
+    }
+    return stream.str();
+}
+
+static std::vector<std::string> print_expressions(const std::vector<ExpressionTree>& trees,
+                                                  int options=EXPORT_DEFAULT) {
+    std::vector<std::string> expressions;
+    for (auto tree : trees) {
+        expressions.push_back(print_expression(tree.m_expr, options));
+    }
+    return expressions;
+}
+
+static void emit_joint_arguments(std::ostream& os, const std::vector<Symbolic>& joints,
+                                 int options=EXPORT_DEFAULT) {
+    for (auto joint = joints.begin(); joint != joints.end(); joint++) {
+        os << scalar_type(options) << " " << get_name(*joint) << ((joint == joints.end()-1) ? "" : ", ");
+    }
+}
+
+// Declares the sines, cosines & common subexpressions used by the compiled expressions.
+// With EXPORT_TRIG_IDENTITIES the compound angles declared by ExpressionTree::simplify are
+// derived from the joint sines & cosines, which are computed by one sincos per joint
+// unless the caller needs vectorizable sin & cos calls.
+// Returns the number of libm trig calls saved by the identities.
+static int emit_trigonometry(std::ostream& os, const std::vector<Symbolic>& joints,
+                             const std::set<std::string>& variables,
+                             const std::vector<Subexpression>& temporaries, const std::string& indent,
+                             int options=EXPORT_DEFAULT, bool vectorized=false) {
+    bool identities = options & EXPORT_TRIG_IDENTITIES;
+    std::string scalar = scalar_type(options);
+    int calls_saved = 0;
+
+    for (auto joint : joints) {
+        std::string name = get_name(joint);
+        if (identities && !vectorized) {
+            os << indent << scalar << " c_" << name << ", s_" << name << ";\n"
+               << indent << trig_function("sincos", options) << "("
+               << name << ", &s_" << name << ", &c_" << name << ");\n";
+            calls_saved++;
+        } else {
+            os << indent << scalar << " c_" << name << " = " << trig_function("cos", options) << "(" << name << ");\n"
+               << indent << scalar << " s_" << name << " = " << trig_function("sin", options) << "(" << name << ");\n";
+        }
+    }
+
+    if (!identities) {
+        // Declared by ExpressionTree::simplify as "double c_q1_q2 = cos(q1+q2);"
+        for (auto var : variables) {
+            if (scalar != "double") {
+                std::string function = var.substr(var.find("= ") + 2);
+                var = scalar + var.substr(6, var.find("= ") - 4) + trig_function(function.substr(0, 3), options)
+                    + function.substr(3);
+            }
+            os << indent << var;
+        }
+    } else {
+        // Compound angles keyed by their joints, e.g. c_q1_q3 -> {q1, q3} : {c}.
+        // Both functions of every shorter prefix are needed by the angle-sum identities.
+        std::map<std::vector<std::string>, std::set<char>> angles;
+        for (auto var : variables) {
+            std::string name = var.substr(7, var.find(" =") - 7);
+            std::vector<std::string> terms = split(name, "_");
+            char function = terms[0][0];
+            terms.erase(terms.begin());
+            angles[terms].insert(function);
+            for (int length = 2; length < terms.size(); length++) {
+                auto& prefix = angles[std::vector<std::string>(terms.begin(), terms.begin()+length)];
+                prefix.insert('c');
+                prefix.insert('s');
+            }
+            calls_saved++;
+        }
+
+        for (auto angle : angles) {
+            std::string a, b = angle.first.back(), sum;
+            for (int index = 0; index < angle.first.size(); index++) {
+                sum += "_" + angle.first[index];
+                if (index == angle.first.size() - 2) {
+                    a = sum.substr(1);
+                }
+            }
+            // cos(a+b) == cos(a)cos(b) - sin(a)sin(b)
+            if (angle.second.count('c')) {
+                os << indent << scalar << " c" << sum << " = " << multiply("c_" + a, "c_" + b, options)
+                   << " - " << multiply("s_" + a, "s_" + b, options) << ";\n";
+            }
+            // sin(a+b) == sin(a)cos(b) + cos(a)sin(b)
+            if (angle.second.count('s')) {
+                os << indent << scalar << " s" << sum << " = " << multiply("s_" + a, "c_" + b, options)
+                   << " + " << multiply("c_" + a, "s_" + b, options) << ";\n";
+            }
+        }
+    }
+
+    for (auto temp : temporaries) {
+        std::string expr = print_expression(temp.expr, options);
+        os << indent << scalar << " " << temp.name << " = " << ((expr[0] == '+') ? expr.substr(1) : expr) << ";\n";
+    }
+    return calls_saved;
+}
+
+// Emits a function writing expressions into a caller-owned array, e.g. the fused pose & Jacobian.
+// velocities are passed after the joints when the expressions depend on them.
+// Returns the number of libm trig calls saved.
+static int emit_array_function(FunctionStream& os, const std::string& function,
+                               const std::vector<Symbolic>& joints, const std::vector<Symbolic>& velocities,
+                               const std::string& array, const std::vector<std::string>& expressions,
+                               const std::set<std::string>& variables,
+                               const std::vector<Subexpression>& temporaries, int options) {
+    std::ostringstream signature;
+    signature << "void " << function << "(";
+    emit_joint_arguments(signature, joints, options);
+    if (!velocities.empty()) {
+        signature << ", ";
+        emit_joint_arguments(signature, velocities, options);
+    }
+    signature << ", " << scalar_type(options) << " " << array << "[" << expressions.size() << "])";
+    os.open(options, signature.str());
+    int calls_saved = emit_trigonometry(os, joints, variables, temporaries, "    ", options);
+    for (int entry = 0; entry < expressions.size(); entry++) {
+        os << "    " << array << "[" << entry << "] = " << expressions[entry] << ";\n";
+    }
+    os << "}\n";
+    return calls_saved;
+}
+
+// Emits a function evaluating the 12 non-constant entries of a homogeneous transform.
+// With EXPORT_NO_ALLOC the entries are written row-major into a caller-owned double[12],
+// and the std::vector returning function becomes a wrapper unless EXPORT_NO_VECTOR is set.
+// Returns the number of libm trig calls saved.
+static int emit_transform_function(FunctionStream& os, const std::string& function,
+                                    const std::vector<Symbolic>& joints,
+                                    const std::vector<std::string>& expressions,
+                                    const std::set<std::string>& variables,
+                                    const std::vector<Subexpression>& temporaries, int options) {
+    bool no_alloc = options & EXPORT_NO_ALLOC;
+    std::string scalar = scalar_type(options);
+    std::string matrix = "std::vector<std::vector<" + scalar + ">>";
+
+    std::ostringstream signature;
+    signature << (no_alloc ? "void " : matrix + " ") << function << "(";
+    emit_joint_arguments(signature, joints, options);
+    signature << (no_alloc ? ", " + scalar + " pose[12])" : ")");
+    os.open(options, signature.str());
+    int calls_saved = emit_trigonometry(os, joints, variables, temporaries, "    ", options);
+    for (int entry = 0; entry < 12; entry++) {
+        if (no_alloc) {
+            os << "    pose[" << entry << "] = " << expressions[entry] << ";\n";
+        } else {
+            os << "    " << scalar << " " << std::left << std::setw(3) << s_pose_entries[entry]
+               << " = " << expressions[entry] << ";\n";
+        }
+    }
+    if (!no_alloc) {
+        os << "    " << matrix << " kinematics\n"
+           << "        { {R11, R12, R13, X},\n"
+           << "          {R21, R22, R23, Y},\n"
+           << "          {R31, R32, R33, Z},\n"
+           << "          {0, 0, 0, 1} };\n"
+           << "    return kinematics;\n";
+    }
+    os << "}\n";
+
+    if (no_alloc && !(options & EXPORT_NO_VECTOR)) {
+        std::ostringstream wrapper;
+        wrapper << matrix << " " << function << "(";
+        emit_joint_arguments(wrapper, joints, options);
+        wrapper << ")";
+        os.open(options, wrapper.str());
+        os << "    " << scalar << " pose[12];\n"
+           << "    " << function << "(";
+        for (auto joint : joints) {
+            os << get_name(joint) << ", ";
+        }
+        os << "pose);\n"
+           << "    " << matrix << " kinematics\n"
+           << "        { {pose[0], pose[1], pose[2], pose[3]},\n"
+           << "          {pose[4], pose[5], pose[6], pose[7]},\n"
+           << "          {pose[8], pose[9], pose[10], pose[11]},\n"
+           << "          {0, 0, 0, 1} };\n"
+           << "    return kinematics;\n"
+           << "}\n";
+    }
+    return calls_saved;
+}
+
+// Closed-form inverse kinematics helpers. Emitted before inverse_kinematics(), with the linkage of options.
+static void emit_inverse_kinematics_helpers(FunctionStream& os, int options) {
+    os.open(options, "void kinematics_ik_multiply(const double* a, const double* b, double* out)",
+            "// Product of two rigid transforms, each the top 3 rows of a homogeneous matrix, row-major\n");
+    os << "    for (int r = 0; r < 3; r++) {\n"
+       << "        for (int c = 0; c < 4; c++) {\n"
+       << "            out[4*r + c] = a[4*r]*b[c] + a[4*r + 1]*b[4 + c] + a[4*r + 2]*b[8 + c] + ((c == 3) ? a[4*r + 3] : 0);\n"
+       << "        }\n"
+       << "    }\n"
+       << "}\n";
+    os.open(options, "void kinematics_ik_rotate(double* R, double angle, double ca, double sa)",
+            "// R = R*Rz(angle)*Rx(alpha), the rotation of a revolute DH transform, for a row-major 3x3 R\n");
+    os << "    double c = cos(angle), s = sin(angle);\n"
+       << "    double link[9] = { c, -s*ca, s*sa, s, c*ca, -c*sa, 0, sa, ca };\n"
+       << "    double product[9];\n"
+       << "    for (int r = 0; r < 3; r++) {\n"
+       << "        for (int col = 0; col < 3; col++) {\n"
+       << "            product[3*r + col] = R[3*r]*link[col] + R[3*r + 1]*link[3 + col] + R[3*r + 2]*link[6 + col];\n"
+       << "        }\n"
+       << "    }\n"
+       << "    for (int entry = 0; entry < 9; entry++) {\n"
+       << "        R[entry] = product[entry];\n"
+       << "    }\n"
+       << "}\n";
+    os.open(options, "double kinematics_ik_wrap(double angle)",
+            "// Angle in (-pi, pi]\n");
+    os << "    angle = fmod(angle, 2*M_PI);\n"
+       << "    return (angle > M_PI) ? angle - 2*M_PI : (angle <= -M_PI) ? angle + 2*M_PI : angle;\n"
+       << "}\n";
+    os.open(options, "int kinematics_ik_solve_cos_sin(double a, double b, double c, double* x)",
+            "// Solutions x of a*cos(x) + b*sin(x) = c\n");
+    os << "    double r = sqrt(a*a + b*b);\n"
+       << "    if (r < 1e-12 || fabs(c) > r*(1 + 1e-9)) {\n"
+       << "        return 0;\n"
+       << "    }\n"
+       << "    double phase = atan2(b, a), offset = acos(fmax(-1.0, fmin(1.0, c/r)));\n"
+       << "    x[0] = phase + offset;\n"
+       << "    x[1] = phase - offset;\n"
+       << "    return (offset < 1e-9) ? 1 : 2;\n"
+       << "}\n";
+    os.open(options, "int kinematics_ik_solve_quadratic(double a, double b, double c, double* x)",
+            "// Real roots of a*x^2 + b*x + c\n");
+    os << "    if (a == 0) {\n"
+       << "        x[0] = -c/b;\n"
+       << "        return (b != 0) ? 1 : 0;\n"
+       << "    }\n"
+       << "    double discriminant = b*b - 4*a*c;\n"
+       << "    if (discriminant < 0) {\n"
+       << "        // Tangent roots perturbed by rounding\n"
+       << "        if (discriminant < -1e-9*(b*b + fabs(4*a*c))) {\n"
+       << "            return 0;\n"
+       << "        }\n"
+       << "        discriminant = 0;\n"
+       << "    }\n"
+       << "    double q = -0.5*(b + copysign(sqrt(discriminant), b));\n"
+       << "    x[0] = q/a;\n"
+       << "    x[1] = (q != 0) ? c/q : x[0];\n"
+       << "    return 2;\n"
+       << "}\n";
+    os.open(options, "double kinematics_ik_cubic_root(double a, double b, double c)",
+            "// Largest real root of x^3 + a*x^2 + b*x + c\n");
+    os << "    double Q = (a*a - 3*b)/9, R = (2*a*a*a - 9*a*b + 27*c)/54;\n"
+       << "    if (R*R < Q*Q*Q) {\n"
+       << "        double theta = acos(R/sqrt(Q*Q*Q));\n"
+       << "        return -2*sqrt(Q)*cos(theta/3) - a/3;\n"
+       << "    }\n"
+       << "    double A = -copysign(cbrt(fabs(R) + sqrt(R*R - Q*Q*Q)), R);\n"
+       << "    return A + ((A != 0) ? Q/A : 0) - a/3;\n"
+       << "}\n";
+    os.open(options, "int kinematics_ik_solve_quartic(const double* c, double* x)",
+            "// Real roots of c[0]*x^4 + c[1]*x^3 + c[2]*x^2 + c[3]*x + c[4] by Ferrari's method.\n"
+            "// A leading coefficient below 1e-10 of the largest is treated as zero.\n");
+    os << "    double scale = fmax(fmax(fmax(fabs(c[0]), fabs(c[1])), fmax(fabs(c[2]), fabs(c[3]))), fabs(c[4]));\n"
+       << "    if (scale == 0) {\n"
+       << "        return 0;\n"
+       << "    }\n"
+       << "    if (fabs(c[0]) < 1e-10*scale) {\n"
+       << "        if (fabs(c[1]) < 1e-10*scale) {\n"
+       << "            return kinematics_ik_solve_quadratic(c[2], c[3], c[4], x);\n"
+       << "        }\n"
+       << "        // Cubic: one real root, then the quadratic it leaves\n"
+       << "        double a = c[2]/c[1], b = c[3]/c[1], d = c[4]/c[1];\n"
+       << "        x[0] = kinematics_ik_cubic_root(a, b, d);\n"
+       << "        return 1 + kinematics_ik_solve_quadratic(1, a + x[0], b + x[0]*(a + x[0]), x + 1);\n"
+       << "    }\n"
+       << "    // Depressed quartic y^4 + p*y^2 + q*y + r, with x = y - b/4\n"
+       << "    double b = c[1]/c[0], cc = c[2]/c[0], d = c[3]/c[0], e = c[4]/c[0];\n"
+       << "    double p = cc - 3*b*b/8, q = d - b*cc/2 + b*b*b/8, r = e - b*d/4 + b*b*cc/16 - 3*b*b*b*b/256;\n"
+       << "    int count = 0;\n"
+       << "    if (fabs(q) < 1e-14*fmax(1.0, fabs(p) + fabs(r))) {\n"
+       << "        double z[2];\n"
+       << "        int roots = kinematics_ik_solve_quadratic(1, p, r, z);\n"
+       << "        for (int index = 0; index < roots; index++) {\n"
+       << "            if (z[index] >= 0) {\n"
+       << "                x[count++] = sqrt(z[index]) - b/4;\n"
+       << "                x[count++] = -sqrt(z[index]) - b/4;\n"
+       << "            }\n"
+       << "        }\n"
+       << "        return count;\n"
+       << "    }\n"
+       << "    // (y^2 + p/2 + m)^2 = (s*y - q/(2*s))^2 with s = sqrt(2*m), m the largest root of the resolvent cubic\n"
+       << "    double m = kinematics_ik_cubic_root(p, p*p/4 - r, -q*q/8);\n"
+       << "    double s = sqrt(fmax(2*m, 0.0));\n"
+       << "    if (s == 0) {\n"
+       << "        return 0;\n"
+       << "    }\n"
+       << "    count = kinematics_ik_solve_quadratic(1, -s, p/2 + m + q/(2*s), x);\n"
+       << "    count += kinematics_ik_solve_quadratic(1, s, p/2 + m - q/(2*s), x + count);\n"
+       << "    for (int index = 0; index < count; index++) {\n"
+       << "        x[index] -= b/4;\n"
+       << "    }\n"
+       << "    return count;\n"
+       << "}\n";
+    os.open(options, "int kinematics_ik_spherical_wrist(const double* M, double ca4, double sa4, double ca5, double sa5, double* q)",
+            "// Joints 4-6 of a spherical wrist from M = R03^T*R, solving M = Rz(q4)*Rx(alpha4)*Rz(q5)*Rx(alpha5)*Rz(q6).\n"
+            "// Writes q4, q5, q6 of both wrist branches, or of one with q4 = 0 when axes 4 & 6 are aligned.\n");
+    os << "    double c5 = (ca4*ca5 - M[8])/(sa4*sa5);\n"
+       << "    if (fabs(c5) > 1 + 1e-9) {\n"
+       << "        return 0;\n"
+       << "    }\n"
+       << "    c5 = fmax(-1.0, fmin(1.0, c5));\n"
+       << "    double s5 = sqrt(1 - c5*c5);\n"
+       << "    // Third column: M*e3 = Rz(q4)*v. Axes 4 & 6 are aligned when v is along z, leaving only q4 + q6\n"
+       << "    // determined, so q4 = 0 there\n"
+       << "    double v2 = -ca4*c5*sa5 - sa4*ca5;\n"
+       << "    bool aligned = s5*s5*sa5*sa5 + v2*v2 < 1e-18;\n"
+       << "    int branches = (aligned || s5 < 1e-12) ? 1 : 2;\n"
+       << "    for (int branch = 0; branch < branches; branch++) {\n"
+       << "        double s = aligned ? 0 : (branch ? -s5 : s5);\n"
+       << "        q[3*branch] = aligned ? 0 : atan2(M[5], M[2]) - atan2(v2, s*sa5);\n"
+       << "        q[3*branch + 1] = atan2(s, c5);\n"
+       << "        // Rz(q6) = (Rz(q4)*Rx(alpha4)*Rz(q5)*Rx(alpha5))^T*M, consistent with q4 near singularities\n"
+       << "        double K[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };\n"
+       << "        kinematics_ik_rotate(K, q[3*branch], ca4, sa4);\n"
+       << "        kinematics_ik_rotate(K, q[3*branch + 1], ca5, sa5);\n"
+       << "        q[3*branch + 2] = atan2(K[1]*M[0] + K[4]*M[3] + K[7]*M[6], K[0]*M[0] + K[3]*M[3] + K[6]*M[6]);\n"
+       << "    }\n"
+       << "    return branches;\n"
+       << "}\n";
+}
+
 /////////////////////////////////////////////////
 // ARM IMPLEMENTATION
 
@@ -106,211 +1118,1737 @@ Arm::Arm(const std::vector<Transform>& transforms){
     for (auto T : m_transforms) {
         if (T.is_actuated()){
             m_actuated_joints.push_back(T.get_actuated_joint());
+            m_joint_velocities.push_back(Symbolic(get_name(T.get_actuated_joint()) + "_dot"));
         }
     }
+    m_valid_frames = 0;
+    m_valid_suffixes = 0;
+    m_valid_chain = false;
+    m_valid_derivatives = false;
+    m_valid_second_order = false;
+    m_jacobian_mode = -1;
+    const char* cache = std::getenv("ROBOTICS_EXPORT_CACHE");
+    m_export_cache = cache ? cache : "";
+    m_export_workers = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    m_gravity = { 0, 0, -9.81 };
+    m_fixed_point_bits = 16;
+    m_sin_table_bits = 10;
 }
 
 Arm::~Arm(){
 }
 
-void Arm::export_expressions(std::string filename){
+const ExportCacheStatistics& Arm::export_cache_statistics() {
+    return s_export_cache_statistics;
+}
 
-    ////////////
-    // Generating kinematic chain
-    // Generates symbolic expressions for kinematics
-    std::cout << "Generating kinematic chain ... " << std::flush;
-    bool first = true;
+void Arm::set_transform(int index, const Transform& transform) {
+    m_transforms.at(index) = transform;
+    m_actuated_joints.clear();
+    m_joint_velocities.clear();
     for (auto T : m_transforms) {
-        if (first) {
-            m_forward_kinematics = T.m_transform;
-            first = false;
-            continue;
+        if (T.is_actuated()){
+            m_actuated_joints.push_back(T.get_actuated_joint());
+            m_joint_velocities.push_back(Symbolic(get_name(T.get_actuated_joint()) + "_dot"));
         }
-        m_forward_kinematics = m_forward_kinematics*T.m_transform;
     }
+}
 
-    for (auto joint : m_actuated_joints) {
-        std::string name = get_name(joint);
-        Symbolic diff_kin("d"+name);
-        diff_kin = df(m_forward_kinematics, joint);
-        m_differential_kinematics.push_back(diff_kin);
+void Arm::derive_chain() {
+    int links = m_transforms.size();
+    if (m_chain_links.size() != links) {
+        m_chain_links.assign(links, Symbolic());
+        m_frames.assign(links, Symbolic());
+        m_suffixes.assign(links, Symbolic());
+        m_valid_frames = 0;
+        m_valid_suffixes = 0;
+        m_valid_chain = false;
     }
-    std::cout << "Done\n" << std::flush;
-
-    ////////////
-    // Compiling kinematics into executable C++ code
-    // Simplifies trigonometric expressions
-    std::cout << "Compiling kinematic expressions ..." << std::flush;
-    std::string kin_str;
-    std::vector<std::string> dif_str;
-    std::ostringstream stream;
-    std::ofstream outfile (filename, std::ofstream::binary);
-    stream << m_forward_kinematics;
-    kin_str = stream.str();
 
-    for (int index = 0; index < m_actuated_joints.size(); index++) {
-        stream.str(std::string());
-        stream << m_differential_kinematics[index];
-        dif_str.push_back(stream.str());
-        replace(&dif_str[index], " * ", " ");
-        replace(&dif_str[index], "\\[*\\]*", "");
+    // Products containing a changed link are stale
+    for (int index = 0; index < links; index++) {
+        if (!(m_chain_links[index] == m_transforms[index].m_transform)) {
+            m_chain_links[index] = m_transforms[index].m_transform;
+            m_valid_frames = std::min(m_valid_frames, index);
+            m_valid_suffixes = std::min(m_valid_suffixes, links - 1 - index);
+            m_valid_chain = false;
+        }
     }
+    if (m_valid_chain) {
+        return;
+    }
+    m_valid_derivatives = false;
+    m_valid_second_order = false;
+    m_jacobian_mode = -1;
 
-    replace(&kin_str, " * ", " ");
-    replace(&kin_str, "\\[*\\]*", "");
-    for (auto joint : m_actuated_joints) {
-        std::string name = get_name(joint);
-
-        replace(&kin_str, "e\\+", "P");
-        replace(&kin_str, "e\\-", "N");
-        replace(&kin_str, "sin\\("+name+"\\)", "s_"+name);
-        replace(&kin_str, "cos\\("+name+"\\)", "c_"+name);
-        for (int index = 0; index < m_actuated_joints.size(); index++) {
-            replace(&dif_str[index], "e\\+", "P");
-            replace(&dif_str[index], "e\\-", "N");
-            replace(&dif_str[index], "sin\\("+name+"\\)", "s_"+name);
-            replace(&dif_str[index], "cos\\("+name+"\\)", "c_"+name);
+    int first = m_valid_frames;
+    if (first == 0 && m_valid_suffixes == 0) {
+        derive_frames();
+        m_forward_kinematics = m_frames[links-1];
+    } else {
+        if (m_valid_suffixes == 0) {
+            m_suffixes[links-1] = m_chain_links[links-1];
+            m_valid_suffixes = 1;
         }
+        for (int index = links - 1 - m_valid_suffixes; index >= first; index--) {
+            m_suffixes[index] = m_chain_links[index]*m_suffixes[index+1];
+        }
+        m_valid_suffixes = links - first;
+        m_forward_kinematics = (first == 0) ? m_suffixes[0] : m_frames[first-1]*m_suffixes[first];
     }
+    m_valid_chain = true;
+}
 
-    outfile << "#include <iostream>\n"
-            << "#include <string>\n"
-            << "#include <vector>\n"
-            << "#include <math.h>\n"
-            << "#include <time.h>\n";
-
-    ////////////
-    // Compile Forward Kinematics:
-    std::vector<std::string> expressions = split (kin_str, " ");
-    std::set<std::string> new_variables;
+void Arm::derive_frames() {
+    for (int index = m_valid_frames; index < m_chain_links.size(); index++) {
+        m_frames[index] = (index == 0) ? m_chain_links[0] : m_frames[index-1]*m_chain_links[index];
+    }
+    m_valid_frames = m_chain_links.size();
+}
 
-    for (int expr_idx = 0; expr_idx < expressions.size(); expr_idx++) {
-        // Simplify the kinematics expressions
-        ExpressionTree tree (expressions[expr_idx]);
-        auto variables = tree.simplify();
-        new_variables.insert(variables.begin(), variables.end());
-        stream.str(std::string());
-        stream << tree;
-        expressions[expr_idx] = stream.str();
-        replace(&expressions[expr_idx], "P", "e+");
-        replace(&expressions[expr_idx], "N", "e-");
+void Arm::derive_jacobian(int options) {
+    m_differential_kinematics.clear();
+    bool geometric = options & EXPORT_GEOMETRIC_JACOBIAN;
+    if (!geometric) {
+        if (!m_valid_derivatives) {
+            m_derivatives.clear();
+            for (auto joint : m_actuated_joints) {
+                std::string name = get_name(joint);
+                Symbolic diff_kin("d"+name);
+                diff_kin = df(m_forward_kinematics, joint);
+                m_derivatives.push_back(diff_kin);
+            }
+            m_valid_derivatives = true;
+        }
+        m_differential_kinematics = m_derivatives;
     }
 
-    outfile << "static std::vector<std::vector<double>> forward_kinematics(";
-    for (auto joint = m_actuated_joints.begin(); joint != m_actuated_joints.end(); joint++) {
-        std::string name = get_name(*joint);
-        outfile << "double " << name << ((joint == m_actuated_joints.end()-1) ? ") {\n" : ", ");
+    bool jacobian = geometric || (options & (EXPORT_FUSED | EXPORT_JACOBIAN_DERIVATIVE | EXPORT_HESSIAN));
+    if (!jacobian || m_jacobian_mode == (options & EXPORT_GEOMETRIC_JACOBIAN)) {
+        return;
     }
-    for (auto joint : m_actuated_joints) {
-        std::string name = get_name(joint);
-        outfile << "    double c_" << name << " = cos(" << name << ");\n"
-                << "    double s_" << name << " = sin(" << name << ");\n";
-    }
-    for (auto var : new_variables) {
-        outfile << "    " << var;
-    }
-    outfile << "    double R11 = " << expressions[0] << ";\n"
-            << "    double R12 = " << expressions[1] << ";\n"
-            << "    double R13 = " << expressions[2] << ";\n"
-            << "    double X   = " << expressions[3] << ";\n"
-            << "    double R21 = " << expressions[4] << ";\n"
-            << "    double R22 = " << expressions[5] << ";\n"
-            << "    double R23 = " << expressions[6] << ";\n"
-            << "    double Y   = " << expressions[7] << ";\n"
-            << "    double R31 = " << expressions[8] << ";\n"
-            << "    double R32 = " << expressions[9] << ";\n"
-            << "    double R33 = " << expressions[10] << ";\n"
-            << "    double Z   = " << expressions[11] << ";\n"
-            << "    std::vector<std::vector<double>> kinematics\n"
-            << "        { {R11, R12, R13, X},\n"
-            << "          {R21, R22, R23, Y},\n"
-            << "          {R31, R32, R33, Z},\n"
-            << "          {0, 0, 0, 1} };\n"
-            << "    return kinematics;\n"
-            << "}\n";
+    m_jacobian_mode = options & EXPORT_GEOMETRIC_JACOBIAN;
+    m_valid_second_order = false;
+    derive_frames();
+    if (geometric) {
+        m_geometric_jacobian = geometric_jacobian();
+    } else {
+        // Geometric Jacobian: linear velocity from the derivative of the end effector position,
+        // angular velocity from the z axis of the frame preceding each revolute joint
+        m_geometric_jacobian = Symbolic("J", 6, m_actuated_joints.size());
+        int column = 0;
+        for (int index = 0; index < m_transforms.size(); index++) {
+            Transform& T = m_transforms[index];
+            if (!T.is_actuated()) {
+                continue;
+            }
+            for (int row = 0; row < 3; row++) {
+                m_geometric_jacobian(row, column) = m_differential_kinematics[column](row, 3);
+                if (T.m_joint_type == PRISMATIC) {
+                    m_geometric_jacobian(row+3, column) = 0;
+                } else if (index == 0) {
+                    m_geometric_jacobian(row+3, column) = (row == 2) ? 1 : 0;
+                } else {
+                    m_geometric_jacobian(row+3, column) = m_frames[index-1](row, 2);
+                }
+            }
+            column++;
+        }
+    }
+}
 
-    ////////////
-    // Compile Differential Kinematics:
-    for (int index = 0; index < m_actuated_joints.size(); index++) {
-        std::string joint_name = get_name(m_actuated_joints[index]);
-        expressions = split (dif_str[index], " ");
-        new_variables.clear();
-        for (int expr_idx = 0; expr_idx < expressions.size(); expr_idx++) {
-            // Simplify the kinematics expressions
-            ExpressionTree tree (expressions[expr_idx]);
-            auto variables = tree.simplify();
-            new_variables.insert(variables.begin(), variables.end());
-            stream.str(std::string());
-            stream << tree;
-            expressions[expr_idx] = stream.str();
-            replace(&expressions[expr_idx], "P", "e+");
-            replace(&expressions[expr_idx], "N", "e-");
-        }
-
-        outfile << "static std::vector<std::vector<double>> differential_kinematics_d" << joint_name << "(";
-        for (auto joint = m_actuated_joints.begin(); joint != m_actuated_joints.end(); joint++) {
-            std::string name = get_name(*joint);
-            outfile << "double " << name << ((joint == m_actuated_joints.end()-1) ? ") {\n" : ", ");
+void Arm::derive_second_order() {
+    if (m_valid_second_order) {
+        return;
+    }
+    m_valid_second_order = true;
+    int joints = m_actuated_joints.size();
+    m_kinematic_hessian = Symbolic("H", 6, joints*joints);
+    m_jacobian_derivative = Symbolic("dJ", 6, 1);
+    for (int row = 0; row < 6; row++) {
+        Symbolic acceleration = 0;
+        for (int i = 0; i < joints; i++) {
+            for (int j = 0; j < joints; j++) {
+                if (row < 3 && j < i) {
+                    m_kinematic_hessian(row, i*joints + j) = m_kinematic_hessian(row, j*joints + i);
+                } else {
+                    m_kinematic_hessian(row, i*joints + j) = df(m_geometric_jacobian(row, i), m_actuated_joints[j]);
+                }
+                acceleration += m_kinematic_hessian(row, i*joints + j)*m_joint_velocities[i]*m_joint_velocities[j];
+            }
         }
-        for (auto joint : m_actuated_joints) {
-            std::string name = get_name(joint);
-            outfile << "    double c_" << name << " = cos(" << name << ");\n"
-                    << "    double s_" << name << " = sin(" << name << ");\n";
-        }
-        for (auto var : new_variables) {
-            outfile << "    " << var;
-        }
-
-        outfile << "    double R11 = " << expressions[0] << ";\n"
-                << "    double R12 = " << expressions[1] << ";\n"
-                << "    double R13 = " << expressions[2] << ";\n"
-                << "    double X   = " << expressions[3] << ";\n"
-                << "    double R21 = " << expressions[4] << ";\n"
-                << "    double R22 = " << expressions[5] << ";\n"
-                << "    double R23 = " << expressions[6] << ";\n"
-                << "    double Y   = " << expressions[7] << ";\n"
-                << "    double R31 = " << expressions[8] << ";\n"
-                << "    double R32 = " << expressions[9] << ";\n"
-                << "    double R33 = " << expressions[10] << ";\n"
-                << "    double Z   = " << expressions[11] << ";\n"
-                << "    std::vector<std::vector<double>> kinematics\n"
-                << "        { {R11, R12, R13, X},\n"
-                << "          {R21, R22, R23, Y},\n"
-                << "          {R31, R32, R33, Z},\n"
-                << "          {0, 0, 0, 1} };\n"
-                << "    return kinematics;\n"
-                << "}\n";
+        m_jacobian_derivative(row, 0) = acceleration;
     }
+}
 
+void Arm::derive_frame_products() {
+    m_frame_products.clear();
+    for (int index = 0; index < m_transforms.size(); index++) {
+        if (index == 0) {
+            m_frame_products.push_back(m_transforms[index].m_transform);
+            continue;
+        }
+        Symbolic previous ("F", 4, 4);
+        for (int entry = 0; entry < 12; entry++) {
+            previous(entry/4, entry % 4) = Symbolic(frame_entry_name(index, entry));
+        }
+        previous(3, 0) = 0;
+        previous(3, 1) = 0;
+        previous(3, 2) = 0;
+        previous(3, 3) = 1;
+        m_frame_products.push_back(previous*m_transforms[index].m_transform);
+    }
+}
 
-    ////////////
-    // Test output:
-    outfile << "static std::ostream &operator<<(std::ostream &os, std::vector<std::vector<double>> const &matrix) {\n"
-            << "    os << \"[\\n\";\n"
-            << "    for (auto x : matrix) {\n"
-            << "        os << \"\t[\";\n"
-            << "        for (auto y : x) {\n"
-            << "            os << \" \" << y;\n"
-            << "        }\n"
-            << "        os << \" ]\\n\";\n"
-            << "    }\n"
-            << "    os << \"]\\n\";\n"
-            << "}\n";
-
-
-    outfile << "int main (int argc, char* argv[]) {\n"
-            << "    clock_t timer = clock();\n"
-            << "    auto result = forward_kinematics(";
-    for (auto joint = m_actuated_joints.begin(); joint != m_actuated_joints.end(); joint++) {
-        outfile << "1.0" << ((joint == m_actuated_joints.end()-1) ? ");\n" : ", ");
-    }
-    outfile << "    timer = clock() - timer;\n"
-            << "    std::cout << result;\n"
-            << "    std::cout << \"Forward Kinematics Computation Time : \" << ((float)timer)/CLOCKS_PER_SEC << \" seconds\\n\";\n"
-            << "}\n";
+void Arm::export_expressions(std::string filename, int options){
+    export_kinematics(filename, options & ~EXPORT_HEADER, "", "");
+}
 
+void Arm::export_header(std::string filename, std::string name_space, int options, std::string source_filename){
+    if (options & EXPORT_SHARED_LIBRARY) {
+        throw std::invalid_argument("EXPORT_SHARED_LIBRARY cannot be combined with a header export");
+    }
+    export_kinematics(filename, options | EXPORT_HEADER, name_space, source_filename);
+}
 
-    std::cout << "Done\n" << std::flush;
+void Arm::export_kinematics(const std::string& filename, int options,
+                            const std::string& name_space, const std::string& source_filename){
+    if (options & EXPORT_SHARED_LIBRARY) {
+        options |= EXPORT_NO_ALLOC | EXPORT_NO_VECTOR;
+    }
+    // Embedded targets emit plain arrays of their scalar type
+    bool target = options & (EXPORT_FLOAT32 | EXPORT_FIXED_POINT);
+    bool fixed_point = options & EXPORT_FIXED_POINT;
+    if (target) {
+        if ((options & EXPORT_FLOAT32) && fixed_point) {
+            throw std::invalid_argument("EXPORT_FLOAT32 cannot be combined with EXPORT_FIXED_POINT");
+        }
+        if (options & (EXPORT_SHARED_LIBRARY | EXPORT_TEMPLATE)) {
+            throw std::invalid_argument("EXPORT_SHARED_LIBRARY & EXPORT_TEMPLATE cannot be combined with a target scalar type");
+        }
+        if (fixed_point && (m_fixed_point_bits < 1 || m_fixed_point_bits > 30 ||
+                            m_sin_table_bits < 1 || m_sin_table_bits > 16)) {
+            throw std::invalid_argument("Fixed point exports need 1 to 30 fraction bits & 1 to 16 sine table bits");
+        }
+        if (options & (EXPORT_INVERSE_KINEMATICS | s_dynamics_options)) {
+            throw std::invalid_argument("EXPORT_INVERSE_KINEMATICS & the dynamics cannot be combined with a target "
+                                        "scalar type");
+        }
+        options |= EXPORT_NO_ALLOC | EXPORT_NO_VECTOR;
+    }
+    if ((options & EXPORT_INVERSE_KINEMATICS) && !spherical_wrist()) {
+        throw std::invalid_argument("EXPORT_INVERSE_KINEMATICS needs a spherical wrist arm, see Arm::spherical_wrist()");
+    }
+    if (options & s_dynamics_options) {
+        dynamics_links();
+    }
+    bool header = options & EXPORT_HEADER;
+    if (header) {
+        dh_table_rows(m_transforms);
+    }
+    auto export_start = std::chrono::steady_clock::now();
+
+    ////////////
+    // Export cache:
+    // Generated files only depend on the transforms & the options, and for headers on the file
+    // & namespace names
+    std::string cache_entry;
+    if (!m_export_cache.empty()) {
+        if (mkdir(m_export_cache.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Cannot create export cache directory " + m_export_cache);
+        }
+        std::ostringstream key;
+        key << (options & ~EXPORT_PARALLEL) << "\n";
+        if (fixed_point) {
+            key << m_fixed_point_bits << " " << m_sin_table_bits << "\n";
+        }
+        if (options & s_dynamics_options) {
+            key << "gravity " << print_number(m_gravity[0]) << " " << print_number(m_gravity[1]) << " "
+                << print_number(m_gravity[2]) << "\n";
+        }
+        if (header) {
+            key << name_space << "\n" << base_name(filename) << "\n" << base_name(source_filename) << "\n";
+        }
+        key << transforms_key(m_transforms);
+        cache_entry = m_export_cache + "/export_" + hash_string(key.str());
+        if (copy_file(cache_entry + ".out", filename) &&
+            (source_filename.empty() || copy_file(cache_entry + ".src", source_filename))) {
+            s_export_cache_statistics.hits++;
+            s_export_cache_statistics.hit_ms += std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - export_start).count();
+            std::cout << "Exported " << filename << " from cache " << cache_entry << " ("
+                      << s_export_cache_statistics.hits << " hits, " << s_export_cache_statistics.misses
+                      << " misses)\n" << std::flush;
+            return;
+        }
+    }
+
+    ////////////
+    // Generating kinematic chain
+    // Generates symbolic expressions for kinematics
+    std::cout << "Generating kinematic chain ... " << std::flush;
+    // Wall time of each export phase, reported once the file is written
+    std::vector<std::pair<std::string, double>> timings;
+    auto phase_start = std::chrono::steady_clock::now();
+    auto end_phase = [&timings, &phase_start] (const std::string& phase) {
+        auto now = std::chrono::steady_clock::now();
+        timings.push_back({phase, std::chrono::duration<double, std::milli>(now - phase_start).count()});
+        phase_start = now;
+    };
+    derive_chain();
+    end_phase("chain");
+
+    bool geometric = options & EXPORT_GEOMETRIC_JACOBIAN;
+    bool second_order = options & (EXPORT_JACOBIAN_DERIVATIVE | EXPORT_HESSIAN);
+    // Each entry d pose(r, c)/d q_j is derived & simplified by a worker, unless the columns are cached
+    // or needed symbolically for the Jacobian
+    bool parallel = (options & EXPORT_PARALLEL) && !m_valid_derivatives &&
+                    !(options & (EXPORT_FUSED | EXPORT_GEOMETRIC_JACOBIAN)) && !second_order;
+    std::vector<std::string> parallel_entries;
+    if (parallel) {
+        m_differential_kinematics.clear();
+        parallel_entries = fork_map(12*m_actuated_joints.size(), m_export_workers, [this] (int index) {
+            int entry = index % 12;
+            ExpressionTree tree (df(m_forward_kinematics(entry/4, entry % 4), m_actuated_joints[index/12]));
+            std::set<std::string> variables = tree.simplify();
+            return serialize_tree(tree, variables);
+        });
+    } else {
+        derive_jacobian(options);
+    }
+    if (second_order) {
+        derive_second_order();
+    }
+    if (options & EXPORT_ALL_FRAMES) {
+        derive_frame_products();
+    }
+    end_phase("derivatives");
+    std::cout << "Done\n" << std::flush;
+
+    ////////////
+    // Compiling kinematics into executable C++ code
+    // Simplifies trigonometric expressions
+    std::cout << "Compiling kinematic expressions ..." << std::flush;
+    // Code is buffered so that a header export can place each function in the header or the source file
+    FunctionStream outfile;
+
+    if (target) {
+        outfile << "#include <math.h>\n"
+                << (fixed_point ? "#include <stdint.h>\n" : "");
+    } else if (header) {
+        // The test program's iostream & time.h are not part of a header
+        outfile << "#include <math.h>\n"
+                << ((!(options & EXPORT_NO_ALLOC) || !(options & EXPORT_NO_VECTOR)) ? "#include <vector>\n" : "");
+    } else {
+        outfile << "#include <iostream>\n"
+                << "#include <string>\n"
+                << "#include <vector>\n"
+                << "#include <math.h>\n"
+                << "#include <time.h>\n";
+    }
+    bool templated = options & EXPORT_TEMPLATE;
+    if (templated) {
+        outfile << "#include <cmath>\n";
+    }
+    if ((options & EXPORT_TRIG_IDENTITIES) && (options & EXPORT_FLOAT32)) {
+        outfile << (header ? "#ifndef SINCOSF\n" : "")
+                << "#if defined(__GNUC__)\n"
+                << "#define SINCOSF(x, s, c) __builtin_sincosf(x, s, c)\n"
+                << "#else\n"
+                << "#define SINCOSF(x, s, c) (*(s) = sinf(x), *(c) = cosf(x))\n"
+                << "#endif\n"
+                << (header ? "#endif\n" : "");
+    } else if ((options & EXPORT_TRIG_IDENTITIES) && !fixed_point) {
+        outfile << (header ? "#ifndef SINCOS\n" : "")
+                << "#if defined(__GNUC__)\n"
+                << "#define SINCOS(x, s, c) __builtin_sincos(x, s, c)\n"
+                << "#else\n"
+                << "#define SINCOS(x, s, c) (*(s) = sin(x), *(c) = cos(x))\n"
+                << "#endif\n"
+                << (header ? "#endif\n" : "");
+    }
+    std::string includes = outfile.str();
+    outfile.str("");
+
+    // Trig of the templated functions goes through these hooks. Overloads for other scalar
+    // types (SIMD lanes, dual numbers) are found by argument dependent lookup.
+    if (templated) {
+        outfile << "template <typename T> inline T kinematics_sin(const T& x) { using std::sin; return sin(x); }\n"
+                << "template <typename T> inline T kinematics_cos(const T& x) { using std::cos; return cos(x); }\n"
+                // std::sin(float) calls __builtin_sinf, which -fno-builtin-sinf cannot keep from fusing into sincosf
+                << "inline float kinematics_sin(const float& x) { return sinf(x); }\n"
+                << "inline float kinematics_cos(const float& x) { return cosf(x); }\n"
+                << "template <typename T> inline void kinematics_sincos(const T& x, T* s, T* c) {\n"
+                << "    *s = kinematics_sin(x);\n"
+                << "    *c = kinematics_cos(x);\n"
+                << "}\n";
+        if (options & EXPORT_TRIG_IDENTITIES) {
+            outfile << "inline void kinematics_sincos(const double& x, double* s, double* c) { SINCOS(x, s, c); }\n";
+        }
+    }
+
+    // Q-format arithmetic & trig. Constants are converted by KINEMATICS_Q at compile time, and sin/cos
+    // interpolate a table over one turn, so the generated code needs no floating point at runtime.
+    // Redefining the macros with another format in the same program is diagnosed by the compiler.
+    if (fixed_point) {
+        int entries = 1 << m_sin_table_bits;
+        outfile << "// A value x is stored as round(x*2^KINEMATICS_Q_BITS) in an int32_t\n"
+                << "#define KINEMATICS_Q_BITS " << m_fixed_point_bits << "\n"
+                << "#define KINEMATICS_SIN_TABLE_BITS " << m_sin_table_bits << "\n"
+                << "#define KINEMATICS_Q(x) ((int32_t)((x) < 0 ? (x)*(1LL << KINEMATICS_Q_BITS) - 0.5 : (x)*(1LL << KINEMATICS_Q_BITS) + 0.5))\n"
+                << "// Turns per Q-format radian, scaled by 2^(32 + 16)\n"
+                << "#define KINEMATICS_Q_TURN_SCALE ((int64_t)(281474976710656.0/6.283185307179586/(1LL << KINEMATICS_Q_BITS) + 0.5))\n"
+                << "static const int32_t kinematics_sin_table[" << entries + 1 << "] = {";
+        for (int index = 0; index <= entries; index++) {
+            outfile << ((index % 4) ? " " : "\n    ")
+                    << "KINEMATICS_Q(" << print_number(std::sin(2*M_PI*index/entries)) << ")"
+                    << ((index == entries) ? "\n" : ",");
+        }
+        outfile << "};\n"
+                << "// Product of two Q-format values, rounded to nearest\n"
+                << "inline int32_t kinematics_qmul(int32_t a, int32_t b) {\n"
+                << "    return (int32_t)(((int64_t)a*b + (1LL << (KINEMATICS_Q_BITS - 1))) >> KINEMATICS_Q_BITS);\n"
+                << "}\n"
+                << "// Angle as a 32 bit fraction of a turn, which wraps modulo 2*pi\n"
+                << "inline uint32_t kinematics_turn_q(int32_t x) {\n"
+                << "    return (uint32_t)(((int64_t)x*KINEMATICS_Q_TURN_SCALE) >> 16);\n"
+                << "}\n"
+                << "// Sine of a turn, interpolated linearly between the table entries around it\n"
+                << "inline int32_t kinematics_sin_turn(uint32_t turn) {\n"
+                << "    const int shift = 32 - KINEMATICS_SIN_TABLE_BITS;\n"
+                << "    uint32_t index = turn >> shift;\n"
+                << "    int64_t fraction = turn & ((1u << shift) - 1);\n"
+                << "    int32_t low = kinematics_sin_table[index];\n"
+                << "    return low + (int32_t)(((int64_t)(kinematics_sin_table[index + 1] - low)*fraction) >> shift);\n"
+                << "}\n"
+                << "inline int32_t kinematics_sin_q(int32_t x) { return kinematics_sin_turn(kinematics_turn_q(x)); }\n"
+                << "inline int32_t kinematics_cos_q(int32_t x) { return kinematics_sin_turn(kinematics_turn_q(x) + (1u << 30)); }\n"
+                << "inline void kinematics_sincos_q(int32_t x, int32_t* s, int32_t* c) {\n"
+                << "    uint32_t turn = kinematics_turn_q(x);\n"
+                << "    *s = kinematics_sin_turn(turn);\n"
+                << "    *c = kinematics_sin_turn(turn + (1u << 30));\n"
+                << "}\n";
+    }
+
+    ////////////
+    // Simplify Kinematics Expressions:
+    std::set<std::string> new_variables;
+    std::vector<ExpressionTree> kin_trees = simplify_expressions(m_forward_kinematics, &new_variables);
+
+    std::vector<std::set<std::string>> dif_variables;
+    std::vector<std::vector<ExpressionTree>> dif_trees;
+    if (parallel) {
+        dif_variables.resize(m_actuated_joints.size());
+        dif_trees.resize(m_actuated_joints.size());
+        for (int index = 0; index < parallel_entries.size(); index++) {
+            dif_trees[index/12].push_back(deserialize_tree(parallel_entries[index], &dif_variables[index/12]));
+        }
+    } else {
+        dif_variables.resize(m_differential_kinematics.size());
+        for (int index = 0; index < m_differential_kinematics.size(); index++) {
+            dif_trees.push_back(simplify_expressions(m_differential_kinematics[index], &dif_variables[index]));
+        }
+    }
+
+    std::set<std::string> jac_variables;
+    std::vector<ExpressionTree> jac_trees;
+    if ((options & EXPORT_FUSED) || geometric) {
+        jac_trees = simplify_expressions(m_geometric_jacobian, &jac_variables, 6*m_actuated_joints.size());
+    }
+
+    // Hessian entries mirrored across the diagonal of the linear rows are copied, not recomputed
+    int joint_count = m_actuated_joints.size();
+    auto hessian_mirror = [joint_count] (int entry) {
+        int row = entry/(joint_count*joint_count), i = (entry/joint_count) % joint_count, j = entry % joint_count;
+        return (row < 3 && j < i) ? (row*joint_count + j)*joint_count + i : -1;
+    };
+    std::set<std::string> jdot_variables, hes_variables;
+    std::vector<ExpressionTree> jdot_trees, hes_trees;
+    if (options & EXPORT_JACOBIAN_DERIVATIVE) {
+        jdot_trees = simplify_expressions(m_jacobian_derivative, &jdot_variables, 6);
+    }
+    if (options & EXPORT_HESSIAN) {
+        std::vector<Symbolic> entries;
+        for (int entry = 0; entry < 6*joint_count*joint_count; entry++) {
+            if (hessian_mirror(entry) < 0) {
+                entries.push_back(m_kinematic_hessian(entry/(joint_count*joint_count), entry % (joint_count*joint_count)));
+            }
+        }
+        Symbolic unique_entries ("H", 1, entries.size());
+        for (int entry = 0; entry < entries.size(); entry++) {
+            unique_entries(0, entry) = entries[entry];
+        }
+        hes_trees = simplify_expressions(unique_entries, &hes_variables, entries.size());
+    }
+
+    // Link transforms only depend on their own joint, so frame products never need compound angles
+    std::set<std::string> frame_variables;
+    std::vector<std::vector<std::string>> frame_expressions;
+    if (options & EXPORT_ALL_FRAMES) {
+        for (auto product : m_frame_products) {
+            frame_expressions.push_back(print_expressions(simplify_expressions(product, &frame_variables), options));
+        }
+    }
+    end_phase("simplify");
+
+    // Common subexpression elimination over all emitted kinematics expressions
+    std::vector<Subexpression> temporaries;
+    auto function_flops = [&temporaries] (const std::vector<ExpressionTree>& trees) {
+        int flops = 0;
+        for (auto tree : trees) {
+            flops += count_flops(tree.m_expr);
+        }
+        for (auto temp : used_subexpressions(temporaries, trees)) {
+            flops += count_flops(temp.expr);
+        }
+        return flops;
+    };
+    auto total_flops = [&] () {
+        int flops = function_flops(kin_trees);
+        for (auto column : dif_trees) {
+            flops += function_flops(column);
+        }
+        if (options & EXPORT_FUSED) {
+            std::vector<ExpressionTree> fused_trees = kin_trees;
+            fused_trees.insert(fused_trees.end(), jac_trees.begin(), jac_trees.end());
+            flops += function_flops(fused_trees);
+        }
+        if (geometric) {
+            flops += function_flops(jac_trees);
+        }
+        return flops + function_flops(jdot_trees) + function_flops(hes_trees);
+    };
+
+    if (options & EXPORT_CSE) {
+        std::vector<ExpressionTree*> trees;
+        for (auto& tree : kin_trees) {
+            trees.push_back(&tree);
+        }
+        for (auto& column : dif_trees) {
+            for (auto& tree : column) {
+                trees.push_back(&tree);
+            }
+        }
+        for (auto& tree : jac_trees) {
+            trees.push_back(&tree);
+        }
+        for (auto& tree : jdot_trees) {
+            trees.push_back(&tree);
+        }
+        for (auto& tree : hes_trees) {
+            trees.push_back(&tree);
+        }
+
+        int flops_before = total_flops();
+        temporaries = eliminate_common_subexpressions(trees);
+        int flops_after = total_flops();
+        std::cout << " CSE saved " << flops_before - flops_after << " of " << flops_before << " flops ..." << std::flush;
+    }
+    end_phase("cse");
+
+    std::vector<Subexpression> kin_temporaries = used_subexpressions(temporaries, kin_trees);
+    std::vector<std::vector<Subexpression>> dif_temporaries;
+    for (auto column : dif_trees) {
+        dif_temporaries.push_back(used_subexpressions(temporaries, column));
+    }
+
+    // Signatures of the templated functions, instantiated for float & double
+    bool no_alloc = options & EXPORT_NO_ALLOC;
+    std::string scalar = scalar_type(options);
+    std::string joint_types;
+    for (auto joint : m_actuated_joints) {
+        joint_types += (joint_types.empty() ? "T" : ", T");
+    }
+    std::vector<std::string> instantiations;
+    auto instantiate_transform_function = [&] (const std::string& function) {
+        std::string matrix = "std::vector<std::vector<T>> ";
+        if (no_alloc) {
+            instantiations.push_back("void " + function + "<T>(" + joint_types + ", T*)");
+        }
+        if (!no_alloc || !(options & EXPORT_NO_VECTOR)) {
+            instantiations.push_back(matrix + function + "<T>(" + joint_types + ")");
+        }
+    };
+
+    ////////////
+    // Compile Forward Kinematics:
+    std::vector<std::string> expressions = print_expressions(kin_trees, options);
+    int trig_calls_saved = emit_transform_function(outfile, "forward_kinematics", m_actuated_joints,
+                                                   expressions, new_variables, kin_temporaries, options);
+    instantiate_transform_function("forward_kinematics");
+    // Functions after forward kinematics go to the source file of a header export
+    std::string inline_functions = outfile.str();
+    outfile.str("");
+    outfile.m_declarations.clear();
+    outfile.m_out_of_line = header && !source_filename.empty();
+
+    ////////////
+    // Compile Fused Forward Kinematics & Geometric Jacobian:
+    // out[0..11] holds the pose (row-major 3x4), out[12..] the 6xN Jacobian (row-major),
+    // linear velocity rows first. Trig & shared products are evaluated once for both.
+    if (options & EXPORT_FUSED) {
+        std::vector<ExpressionTree> fused_trees = kin_trees;
+        fused_trees.insert(fused_trees.end(), jac_trees.begin(), jac_trees.end());
+        std::set<std::string> fused_variables = jac_variables;
+        fused_variables.insert(new_variables.begin(), new_variables.end());
+        trig_calls_saved += emit_array_function(outfile, "forward_kinematics_jacobian", m_actuated_joints, {}, "out",
+                                                print_expressions(fused_trees, options), fused_variables,
+                                                used_subexpressions(temporaries, fused_trees), options);
+        instantiations.push_back("void forward_kinematics_jacobian<T>(" + joint_types + ", T*)");
+    }
+
+    ////////////
+    // Compile Batched Forward Kinematics:
+    // Joint inputs and pose outputs are structure-of-arrays, one contiguous array per joint and pose
+    // entry e at pose[e*count + i] as all_frames_batch, so that the loop body can be vectorized across
+    // configurations.
+    if (options & EXPORT_BATCH) {
+        std::ostringstream comment, signature;
+        comment << "// Vectorizes with: -O3 -ffast-math -fopenmp-simd -fno-builtin-sin -fno-builtin-cos"
+                << ((templated || (options & EXPORT_FLOAT32)) ? " -fno-builtin-sinf -fno-builtin-cosf\n" : "\n")
+                << "// (sin/cos pairs are otherwise fused into a scalar sincos call)\n";
+        signature << "void forward_kinematics_batch(";
+        std::string batch_types;
+        for (auto joint : m_actuated_joints) {
+            signature << "const " << scalar << "* __restrict in_" << get_name(joint) << ", ";
+            batch_types += "const T*, ";
+        }
+        signature << "int count, " << scalar << "* __restrict pose)";
+        outfile.open(options, signature.str(), comment.str());
+        outfile << "    #pragma omp simd\n"
+                << "    for (int i = 0; i < count; i++) {\n";
+        for (auto joint : m_actuated_joints) {
+            std::string name = get_name(joint);
+            outfile << "        " << scalar << " " << name << " = in_" << name << "[i];\n";
+        }
+        trig_calls_saved += emit_trigonometry(outfile, m_actuated_joints, new_variables, kin_temporaries,
+                                              "        ", options, true);
+        for (int entry = 0; entry < 12; entry++) {
+            outfile << "        pose[" << entry << "*count + i] = " << expressions[entry] << ";\n";
+        }
+        outfile << "    }\n"
+                << "}\n";
+        instantiations.push_back("void forward_kinematics_batch<T>(" + batch_types + "int, T*)");
+    }
+
+    ////////////
+    // Compile All Frames:
+    // Each frame is the previous frame times its link transform, so the prefix products of the chain
+    // are computed once. Frame k is row-major 3x4 at frames[12*k], or frames[(12*k + e)*count + i] batched.
+    if (options & EXPORT_ALL_FRAMES) {
+        int frame_count = frame_expressions.size();
+        auto emit_frames = [&] (const std::string& indent, const std::string& stride) {
+            for (int frame = 0; frame < frame_count; frame++) {
+                for (int entry = 0; entry < 12; entry++) {
+                    outfile << indent << scalar << " " << frame_entry_name(frame + 1, entry)
+                            << " = " << frame_expressions[frame][entry] << ";\n";
+                }
+            }
+            for (int frame = 0; frame < frame_count; frame++) {
+                for (int entry = 0; entry < 12; entry++) {
+                    outfile << indent << "frames[" << 12*frame + entry << stride << "] = "
+                            << frame_entry_name(frame + 1, entry) << ";\n";
+                }
+            }
+        };
+
+        std::ostringstream signature;
+        signature << "void all_frames(";
+        emit_joint_arguments(signature, m_actuated_joints, options);
+        signature << ", " << scalar << " frames[" << 12*frame_count << "])";
+        outfile.open(options, signature.str());
+        trig_calls_saved += emit_trigonometry(outfile, m_actuated_joints, frame_variables, {}, "    ", options);
+        emit_frames("    ", "");
+        outfile << "}\n";
+        instantiations.push_back("void all_frames<T>(" + joint_types + ", T*)");
+
+        std::ostringstream batch_signature;
+        batch_signature << "void all_frames_batch(";
+        std::string batch_types;
+        for (auto joint : m_actuated_joints) {
+            batch_signature << "const " << scalar << "* __restrict in_" << get_name(joint) << ", ";
+            batch_types += "const T*, ";
+        }
+        batch_signature << "int count, " << scalar << "* __restrict frames)";
+        outfile.open(options, batch_signature.str());
+        outfile << "    #pragma omp simd\n"
+                << "    for (int i = 0; i < count; i++) {\n";
+        for (auto joint : m_actuated_joints) {
+            std::string name = get_name(joint);
+            outfile << "        " << scalar << " " << name << " = in_" << name << "[i];\n";
+        }
+        trig_calls_saved += emit_trigonometry(outfile, m_actuated_joints, frame_variables, {}, "        ", options, true);
+        emit_frames("        ", "*count + i");
+        outfile << "    }\n"
+                << "}\n";
+        instantiations.push_back("void all_frames_batch<T>(" + batch_types + "int, T*)");
+    }
+
+    ////////////
+    // Compile Geometric Jacobian:
+    // Replaces the differential kinematics functions with a row-major 6xN Jacobian,
+    // linear velocity rows first
+    if (geometric) {
+        trig_calls_saved += emit_array_function(outfile, "geometric_jacobian", m_actuated_joints, {}, "jacobian",
+                                                print_expressions(jac_trees, options), jac_variables,
+                                                used_subexpressions(temporaries, jac_trees), options);
+        instantiations.push_back("void geometric_jacobian<T>(" + joint_types + ", T*)");
+    }
+
+    ////////////
+    // Compile Second Order Kinematics:
+    // dJ/dt*q_dot, the acceleration of the end effector at zero joint acceleration (linear rows first),
+    // & the kinematic hessian dJ(r, i)/dq_j at hessian[(r*N + i)*N + j]
+    if (options & EXPORT_JACOBIAN_DERIVATIVE) {
+        trig_calls_saved += emit_array_function(outfile, "jacobian_derivative_product", m_actuated_joints,
+                                                m_joint_velocities, "out", print_expressions(jdot_trees, options),
+                                                jdot_variables, used_subexpressions(temporaries, jdot_trees), options);
+        instantiations.push_back("void jacobian_derivative_product<T>(" + joint_types + ", " + joint_types + ", T*)");
+    }
+    if (options & EXPORT_HESSIAN) {
+        std::vector<std::string> unique_expressions = print_expressions(hes_trees, options);
+        std::vector<std::string> hes_expressions;
+        for (int entry = 0, unique = 0; entry < 6*joint_count*joint_count; entry++) {
+            int mirror = hessian_mirror(entry);
+            hes_expressions.push_back((mirror < 0) ? unique_expressions[unique++]
+                                                   : "hessian[" + std::to_string(mirror) + "]");
+        }
+        trig_calls_saved += emit_array_function(outfile, "kinematic_hessian", m_actuated_joints, {}, "hessian",
+                                                hes_expressions, hes_variables,
+                                                used_subexpressions(temporaries, hes_trees), options);
+        instantiations.push_back("void kinematic_hessian<T>(" + joint_types + ", T*)");
+    }
+
+    ////////////
+    // Compile Differential Kinematics:
+    for (int index = 0; index < dif_trees.size(); index++) {
+        std::string joint_name = get_name(m_actuated_joints[index]);
+        trig_calls_saved += emit_transform_function(outfile, "differential_kinematics_d" + joint_name, m_actuated_joints,
+                                                    print_expressions(dif_trees[index], options), dif_variables[index],
+                                                    dif_temporaries[index], options);
+        instantiate_transform_function("differential_kinematics_d" + joint_name);
+    }
+
+    ////////////
+    // Compile Closed-Form Inverse Kinematics:
+    // Always in double, from the numeric link parameters
+    if (options & EXPORT_INVERSE_KINEMATICS) {
+        emit_inverse_kinematics(outfile, options);
+    }
+
+    ////////////
+    // Compile Dynamics:
+    // Always in double, unrolled over the links with their numeric parameters
+    if (options & EXPORT_INVERSE_DYNAMICS) {
+        emit_inverse_dynamics(outfile, options);
+    }
+    if (options & EXPORT_DYNAMICS_TERMS) {
+        emit_dynamics_terms(outfile, options);
+    }
+    if (options & EXPORT_FORWARD_DYNAMICS) {
+        emit_forward_dynamics(outfile, options);
+    }
+    if (options & EXPORT_TRIG_IDENTITIES) {
+        std::cout << " trig identities saved " << trig_calls_saved << " libm calls ..." << std::flush;
+    }
+
+    std::string source_functions = outfile.str();
+    std::string source_declarations = outfile.m_declarations;
+    outfile.str("");
+
+    ////////////
+    // Explicit instantiations:
+    // A header export declares them extern & defines them in its source file
+    std::ostringstream instantiation_definitions, instantiation_declarations;
+    if (templated) {
+        for (std::string type : {"float", "double"}) {
+            for (auto signature : instantiations) {
+                for (size_t pos = signature.find('T'); pos != std::string::npos; pos = signature.find('T', pos)) {
+                    signature.replace(pos, 1, type);
+                }
+                instantiation_definitions << "template " << signature << ";\n";
+                instantiation_declarations << "extern template " << signature << ";\n";
+            }
+        }
+    }
+    if (!header) {
+        outfile << includes << inline_functions << source_functions << instantiation_definitions.str();
+    }
+
+    ////////////
+    // Shared library entry points:
+    // C linkage & a joint array argument give every arm the same function signatures
+    bool library = options & EXPORT_SHARED_LIBRARY;
+    if (library) {
+        std::ostringstream joint_values;
+        for (int index = 0; index < m_actuated_joints.size(); index++) {
+            joint_values << "q[" << index << "], ";
+        }
+        auto emit_entry_point = [&] (const std::string& function) {
+            outfile << "extern \"C\" void kinematics_" << function << "(const double* q, double* out) {\n"
+                    << "    " << function << "(" << joint_values.str() << "out);\n"
+                    << "}\n";
+        };
+        outfile << "extern \"C\" int kinematics_joint_count() {\n"
+                << "    return " << m_actuated_joints.size() << ";\n"
+                << "}\n";
+        emit_entry_point("forward_kinematics");
+        if (options & EXPORT_FUSED) {
+            emit_entry_point("forward_kinematics_jacobian");
+        }
+        if (geometric) {
+            emit_entry_point("geometric_jacobian");
+        }
+        for (int index = 0; index < dif_trees.size(); index++) {
+            emit_entry_point("differential_kinematics_d" + get_name(m_actuated_joints[index]));
+        }
+        if (options & EXPORT_HESSIAN) {
+            emit_entry_point("kinematic_hessian");
+        }
+        if (options & EXPORT_JACOBIAN_DERIVATIVE) {
+            outfile << "extern \"C\" void kinematics_jacobian_derivative_product(const double* q, const double* q_dot, double* out) {\n"
+                    << "    jacobian_derivative_product(" << joint_values.str();
+            for (int index = 0; index < m_actuated_joints.size(); index++) {
+                outfile << "q_dot[" << index << "], ";
+            }
+            outfile << "out);\n"
+                    << "}\n";
+        }
+        if (options & EXPORT_INVERSE_KINEMATICS) {
+            outfile << "extern \"C\" int kinematics_inverse_kinematics(const double* pose, double* solutions) {\n"
+                    << "    return inverse_kinematics(pose, solutions);\n"
+                    << "}\n";
+        }
+        if (options & EXPORT_INVERSE_DYNAMICS) {
+            outfile << "extern \"C\" void kinematics_inverse_dynamics(const double* q, const double* q_dot, "
+                    << "const double* q_ddot, double* tau) {\n"
+                    << "    inverse_dynamics(" << joint_values.str();
+            for (int index = 0; index < m_actuated_joints.size(); index++) {
+                outfile << "q_dot[" << index << "], ";
+            }
+            for (int index = 0; index < m_actuated_joints.size(); index++) {
+                outfile << "q_ddot[" << index << "], ";
+            }
+            outfile << "tau);\n"
+                    << "}\n";
+        }
+        if (options & EXPORT_DYNAMICS_TERMS) {
+            outfile << "extern \"C\" void kinematics_dynamics_terms(const double* q, const double* q_dot, "
+                    << "double* M, double* c, double* g) {\n"
+                    << "    dynamics_terms(" << joint_values.str();
+            for (int index = 0; index < m_actuated_joints.size(); index++) {
+                outfile << "q_dot[" << index << "], ";
+            }
+            outfile << "M, c, g);\n"
+                    << "}\n";
+        }
+        if (options & EXPORT_FORWARD_DYNAMICS) {
+            outfile << "extern \"C\" void kinematics_forward_dynamics(const double* q, const double* q_dot, "
+                    << "const double* tau, double* q_ddot) {\n"
+                    << "    forward_dynamics(" << joint_values.str();
+            for (int index = 0; index < m_actuated_joints.size(); index++) {
+                outfile << "q_dot[" << index << "], ";
+            }
+            outfile << "tau, q_ddot);\n"
+                    << "}\n";
+        }
+        if (options & EXPORT_ALL_FRAMES) {
+            emit_entry_point("all_frames");
+            outfile << "extern \"C\" void kinematics_all_frames_batch(const double* q, int count, double* out) {\n"
+                    << "    all_frames_batch(";
+            for (int index = 0; index < m_actuated_joints.size(); index++) {
+                outfile << "q + " << index << "*count, ";
+            }
+            outfile << "count, out);\n"
+                    << "}\n";
+        }
+        // Structure-of-arrays: joint j of configuration i is q[j*count + i], pose entry e is out[e*count + i]
+        if (options & EXPORT_BATCH) {
+            outfile << "extern \"C\" void kinematics_forward_kinematics_batch(const double* q, int count, double* out) {\n"
+                    << "    forward_kinematics_batch(";
+            for (int index = 0; index < m_actuated_joints.size(); index++) {
+                outfile << "q + " << index << "*count, ";
+            }
+            outfile << "count, out);\n"
+                    << "}\n";
+        }
+    }
+
+    ////////////
+    // Test output:
+    if (!library && !header && !target) {
+        bool vector_api = !(no_alloc && (options & EXPORT_NO_VECTOR));
+        if (vector_api) {
+            outfile << "static std::ostream &operator<<(std::ostream &os, std::vector<std::vector<double>> const &matrix) {\n"
+                    << "    os << \"[\\n\";\n"
+                    << "    for (auto x : matrix) {\n"
+                    << "        os << \"\t[\";\n"
+                    << "        for (auto y : x) {\n"
+                    << "            os << \" \" << y;\n"
+                    << "        }\n"
+                    << "        os << \" ]\\n\";\n"
+                    << "    }\n"
+                    << "    os << \"]\\n\";\n"
+                    << "    return os;\n"
+                    << "}\n";
+        }
+
+
+        outfile << "int main (int argc, char* argv[]) {\n"
+                << "    clock_t timer = clock();\n";
+        if (vector_api) {
+            outfile << "    auto result = forward_kinematics(";
+            for (auto joint = m_actuated_joints.begin(); joint != m_actuated_joints.end(); joint++) {
+                outfile << "1.0" << ((joint == m_actuated_joints.end()-1) ? ");\n" : ", ");
+            }
+            outfile << "    timer = clock() - timer;\n"
+                    << "    std::cout << result;\n";
+        } else {
+            outfile << "    double result[12];\n"
+                    << "    forward_kinematics(";
+            for (auto joint : m_actuated_joints) {
+                outfile << "1.0, ";
+            }
+            outfile << "result);\n"
+                    << "    timer = clock() - timer;\n"
+                    << "    for (int r = 0; r < 3; r++) {\n"
+                    << "        std::cout << \"\t[\" << result[4*r] << \" \" << result[4*r+1] << \" \" << result[4*r+2] << \" \" << result[4*r+3] << \" ]\\n\";\n"
+                    << "    }\n";
+        }
+        outfile << "    std::cout << \"Forward Kinematics Computation Time : \" << ((float)timer)/CLOCKS_PER_SEC << \" seconds\\n\";\n";
+
+        // Throughput of the scalar and batched kernels over the same configurations
+        if (options & EXPORT_BATCH) {
+            outfile << "    const int count = 1000000;\n"
+                    << "    double checksum = 0;\n";
+            int offset = 0;
+            for (auto joint : m_actuated_joints) {
+                outfile << "    std::vector<double> in_" << get_name(joint) << "(count);\n";
+            }
+            outfile << "    std::vector<double> batch_pose(12*count);\n";
+            outfile << "    for (int i = 0; i < count; i++) {\n";
+            for (auto joint : m_actuated_joints) {
+                outfile << "        in_" << get_name(joint) << "[i] = 0.001*((i + " << offset++ << "*997) % 6283) - 3.1415;\n";
+            }
+            outfile << "    }\n"
+                    << (no_alloc ? "    double pose[12];\n" : "")
+                    << "    timer = clock();\n"
+                    << "    for (int i = 0; i < count; i++) {\n";
+            if (no_alloc) {
+                outfile << "        forward_kinematics(";
+                for (auto joint : m_actuated_joints) {
+                    outfile << "in_" << get_name(joint) << "[i], ";
+                }
+                outfile << "pose);\n"
+                        << "        checksum += pose[3];\n";
+            } else {
+                outfile << "        checksum += forward_kinematics(";
+                for (auto joint = m_actuated_joints.begin(); joint != m_actuated_joints.end(); joint++) {
+                    outfile << "in_" << get_name(*joint) << "[i]" << ((joint == m_actuated_joints.end()-1) ? ")[0][3];\n" : ", ");
+                }
+            }
+            outfile << "    }\n"
+                    << "    double scalar_time = ((double)(clock() - timer))/CLOCKS_PER_SEC;\n"
+                    << "    timer = clock();\n"
+                    << "    forward_kinematics_batch(";
+            for (auto joint : m_actuated_joints) {
+                outfile << "in_" << get_name(joint) << ".data(), ";
+            }
+            outfile << "count, batch_pose.data());\n"
+                    << "    double batch_time = ((double)(clock() - timer))/CLOCKS_PER_SEC;\n"
+                    << "    for (int i = 0; i < count; i++) {\n"
+                    << "        checksum -= batch_pose[3*count + i];\n"
+                    << "    }\n"
+                    << "    std::cout << \"Scalar Forward Kinematics Throughput : \" << count/scalar_time << \" poses/second\\n\";\n"
+                    << "    std::cout << \"Batch Forward Kinematics Throughput  : \" << count/batch_time << \" poses/second\\n\";\n"
+                    << "    std::cout << \"Scalar/Batch Checksum Difference     : \" << checksum << \"\\n\";\n";
+
+            // Same batch in single precision, through the float instantiation
+            if (templated) {
+                for (auto joint : m_actuated_joints) {
+                    std::string name = get_name(joint);
+                    outfile << "    std::vector<float> fin_" << name << "(in_" << name << ".begin(), in_" << name << ".end());\n";
+                }
+                outfile << "    std::vector<float> float_pose(12*count);\n";
+                outfile << "    timer = clock();\n"
+                        << "    forward_kinematics_batch(";
+                for (auto joint : m_actuated_joints) {
+                    outfile << "fin_" << get_name(joint) << ".data(), ";
+                }
+                outfile << "count, float_pose.data());\n"
+                        << "    double float_time = ((double)(clock() - timer))/CLOCKS_PER_SEC;\n"
+                        << "    double float_error = 0;\n"
+                        << "    for (int entry = 3; entry < 12; entry += 4) {\n"
+                        << "        for (int i = 0; i < count; i++) {\n"
+                        << "            float_error = fmax(float_error, fabs(batch_pose[entry*count + i] - float_pose[entry*count + i]));\n"
+                        << "        }\n"
+                        << "    }\n"
+                        << "    std::cout << \"Float Batch Forward Kinematics Throughput : \" << count/float_time << \" poses/second\\n\";\n"
+                        << "    std::cout << \"Float/Double Max Position Difference      : \" << float_error << \"\\n\";\n";
+            }
+        }
+        outfile << "}\n";
+    }
+
+    if (header) {
+        write_header(filename, name_space, source_filename, includes, inline_functions, source_functions,
+                     source_declarations, instantiation_declarations.str(), instantiation_definitions.str());
+    } else {
+        std::ofstream file (filename, std::ofstream::binary);
+        file << outfile.str();
+    }
+    end_phase("emit");
+
+    std::cout << "Done\n" << std::flush;
+    std::ostringstream phases;
+    phases << std::fixed << std::setprecision(1);
+    for (auto phase : timings) {
+        phases << " " << phase.first << " " << phase.second << "ms";
+    }
+    std::cout << "Export phases:" << phases.str() << "\n" << std::flush;
+
+    // Entries are written under a per-process name & renamed, so concurrent exports never read a partial file
+    if (!cache_entry.empty()) {
+        std::string partial = "." + std::to_string(getpid());
+        bool stored = copy_file(filename, cache_entry + ".out" + partial) &&
+                      std::rename((cache_entry + ".out" + partial).c_str(), (cache_entry + ".out").c_str()) == 0;
+        if (stored && !source_filename.empty()) {
+            stored = copy_file(source_filename, cache_entry + ".src" + partial) &&
+                     std::rename((cache_entry + ".src" + partial).c_str(), (cache_entry + ".src").c_str()) == 0;
+        }
+        if (!stored) {
+            std::remove((cache_entry + ".out" + partial).c_str());
+            std::remove((cache_entry + ".src" + partial).c_str());
+            std::cout << "Could not store export in cache " << cache_entry << "\n" << std::flush;
+        }
+        s_export_cache_statistics.misses++;
+        s_export_cache_statistics.miss_ms += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - export_start).count();
+    }
+}
+
+void Arm::write_header(const std::string& filename, const std::string& name_space,
+                       const std::string& source_filename, const std::string& includes,
+                       const std::string& inline_functions, const std::string& source_functions,
+                       const std::string& source_declarations, const std::string& instantiation_declarations,
+                       const std::string& instantiation_definitions) {
+    // Include guard from the file name, e.g. robots/arm_a.h -> ARM_A_H
+    std::string guard = base_name(filename);
+    for (auto& c : guard) {
+        c = std::isalnum(c) ? std::toupper(c) : '_';
+    }
+    std::ofstream file (filename, std::ofstream::binary);
+    file << "#ifndef " << guard << "\n"
+         << "#define " << guard << "\n"
+         << includes
+         << "namespace " << name_space << " {\n";
+
+    // Metadata
+    file << "const int joint_count = " << m_actuated_joints.size() << ";\n"
+         << "const char* const joint_names[" << m_actuated_joints.size() << "] = { ";
+    for (int index = 0; index < m_actuated_joints.size(); index++) {
+        file << (index ? ", \"" : "\"") << get_name(m_actuated_joints[index]) << "\"";
+    }
+    file << " };\n"
+         << "// Denavit-Hartenberg table, one row per transform. The actuated parameter (theta of revolute,\n"
+         << "// d of prismatic joints) is 0; joint indexes joint_names, -1 for static transforms.\n"
+         << "// joint_type: 1 prismatic, 2 revolute, 3 static\n"
+         << "struct DHParameters {\n"
+         << "    double theta, d, a, alpha;\n"
+         << "    int joint_type, joint;\n"
+         << "};\n"
+         << "const DHParameters dh_table[" << m_transforms.size() << "] = {\n";
+    file << dh_table_rows(m_transforms)
+         << "};\n"
+         << inline_functions;
+
+    if (source_filename.empty()) {
+        file << source_functions;
+    } else {
+        file << source_declarations
+             << instantiation_declarations;
+    }
+    file << "} // namespace " << name_space << "\n"
+         << "#endif\n";
+
+    if (!source_filename.empty()) {
+        std::ofstream source (source_filename, std::ofstream::binary);
+        source << "#include \"" << base_name(filename) << "\"\n"
+               << "namespace " << name_space << " {\n"
+               << source_functions
+               << instantiation_definitions
+               << "} // namespace " << name_space << "\n";
+    }
+}
+
+CompiledKinematics Arm::compile(int options, std::string cache_directory) {
+    options |= EXPORT_SHARED_LIBRARY;
+    cache_directory = compile_cache_directory(cache_directory);
+    std::string compiler = compiler_command();
+
+    std::ostringstream key;
+    key << compiler << "\n" << host_cpu() << "\n" << (options & ~EXPORT_PARALLEL) << "\n" << transforms_key(m_transforms);
+    if (options & s_dynamics_options) {
+        key << "gravity " << print_number(m_gravity[0]) << " " << print_number(m_gravity[1]) << " "
+            << print_number(m_gravity[2]) << "\n";
+    }
+    std::string name = cache_directory + "/kinematics_" + hash_string(key.str());
+    std::string library = name + ".so";
+
+    if (access(library.c_str(), F_OK) == 0) {
+        std::cout << "Loading cached kinematics " << library << "\n" << std::flush;
+    } else {
+        // A per-process source, so a concurrent compile of the same geometry never rewrites it mid-build
+        std::string source = name + "." + std::to_string(getpid()) + ".cpp";
+        try {
+            export_expressions(source, options);
+            std::cout << "Compiling kinematics " << library << " ... " << std::flush;
+            build_library(compiler, source, library);
+        } catch (...) {
+            std::remove(source.c_str());
+            throw;
+        }
+        std::remove(source.c_str());
+        std::cout << "Done\n" << std::flush;
+    }
+
+    CompiledKinematics kinematics;
+    kinematics.library = library;
+    kinematics.handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!kinematics.handle) {
+        throw std::runtime_error("Failed to load kinematics: " + std::string(dlerror()));
+    }
+    auto symbol = [&kinematics] (const char* function) {
+        return reinterpret_cast<CompiledKinematics::Function>(dlsym(kinematics.handle, function));
+    };
+    kinematics.forward_kinematics = symbol("kinematics_forward_kinematics");
+    kinematics.geometric_jacobian = symbol("kinematics_geometric_jacobian");
+    kinematics.forward_kinematics_jacobian = symbol("kinematics_forward_kinematics_jacobian");
+    kinematics.kinematic_hessian = symbol("kinematics_kinematic_hessian");
+    kinematics.jacobian_derivative_product = reinterpret_cast<void (*)(const double*, const double*, double*)>(
+        dlsym(kinematics.handle, "kinematics_jacobian_derivative_product"));
+    kinematics.forward_kinematics_batch = reinterpret_cast<void (*)(const double*, int, double*)>(
+        dlsym(kinematics.handle, "kinematics_forward_kinematics_batch"));
+    kinematics.all_frames = symbol("kinematics_all_frames");
+    kinematics.all_frames_batch = reinterpret_cast<void (*)(const double*, int, double*)>(
+        dlsym(kinematics.handle, "kinematics_all_frames_batch"));
+    kinematics.inverse_kinematics = reinterpret_cast<int (*)(const double*, double*)>(
+        dlsym(kinematics.handle, "kinematics_inverse_kinematics"));
+    kinematics.inverse_dynamics = reinterpret_cast<void (*)(const double*, const double*, const double*, double*)>(
+        dlsym(kinematics.handle, "kinematics_inverse_dynamics"));
+    kinematics.dynamics_terms = reinterpret_cast<void (*)(const double*, const double*, double*, double*, double*)>(
+        dlsym(kinematics.handle, "kinematics_dynamics_terms"));
+    kinematics.forward_dynamics = reinterpret_cast<void (*)(const double*, const double*, const double*, double*)>(
+        dlsym(kinematics.handle, "kinematics_forward_dynamics"));
+    for (auto joint : m_actuated_joints) {
+        CompiledKinematics::Function column = symbol(("kinematics_differential_kinematics_d" + get_name(joint)).c_str());
+        if (column) {
+            kinematics.differential_kinematics.push_back(column);
+        }
+    }
+    auto joint_count = reinterpret_cast<int (*)()>(dlsym(kinematics.handle, "kinematics_joint_count"));
+    if (!kinematics.forward_kinematics || !joint_count) {
+        throw std::runtime_error("Invalid kinematics library " + library);
+    }
+    kinematics.joint_count = joint_count();
+    kinematics.frame_count = m_transforms.size();
+    kinematics.end_effector_count = 1;
+    return kinematics;
+}
+
+TargetError Arm::export_target(std::string filename, int options, int samples, std::string cache_directory) {
+    bool fixed_point = options & EXPORT_FIXED_POINT;
+    if (!(options & (EXPORT_FLOAT32 | EXPORT_FIXED_POINT))) {
+        throw std::invalid_argument("export_target needs EXPORT_FLOAT32 or EXPORT_FIXED_POINT");
+    }
+    export_expressions(filename, options);
+
+    ////////////
+    // Error harness:
+    // The export is compiled as written, with an entry point converting the joints from & the pose to double
+    std::ifstream exported (filename, std::ifstream::binary);
+    std::ostringstream source;
+    source << exported.rdbuf();
+    std::string scalar = scalar_type(options);
+    source << "extern \"C\" void kinematics_target_forward_kinematics(const double* q, double* out) {\n"
+           << "    " << scalar << " pose[12];\n"
+           << "    forward_kinematics(";
+    for (int index = 0; index < m_actuated_joints.size(); index++) {
+        if (fixed_point) {
+            source << "(int32_t)llround(ldexp(q[" << index << "], KINEMATICS_Q_BITS)), ";
+        } else {
+            source << "(float)q[" << index << "], ";
+        }
+    }
+    source << "pose);\n"
+           << "    for (int entry = 0; entry < 12; entry++) {\n"
+           << "        out[entry] = " << (fixed_point ? "ldexp(pose[entry], -KINEMATICS_Q_BITS)" : "pose[entry]") << ";\n"
+           << "    }\n"
+           << "}\n";
+
+    // Named by the harness source, so an unchanged export is not recompiled
+    cache_directory = compile_cache_directory(cache_directory);
+    std::string compiler = compiler_command();
+    std::string name = cache_directory + "/target_" + hash_string(compiler + "\n" + host_cpu() + "\n" + source.str());
+    std::string library = name + ".so";
+    if (access(library.c_str(), F_OK) != 0) {
+        std::string harness = name + "." + std::to_string(getpid()) + ".cpp";
+        std::ofstream (harness, std::ofstream::binary) << source.str();
+        std::cout << "Compiling target " << library << " ... " << std::flush;
+        try {
+            build_library(compiler, harness, library);
+        } catch (...) {
+            std::remove(harness.c_str());
+            throw;
+        }
+        std::remove(harness.c_str());
+        std::cout << "Done\n" << std::flush;
+    }
+    void* handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        throw std::runtime_error("Failed to load target: " + std::string(dlerror()));
+    }
+    auto target = reinterpret_cast<CompiledKinematics::Function>(dlsym(handle, "kinematics_target_forward_kinematics"));
+    if (!target) {
+        dlclose(handle);
+        throw std::runtime_error("Invalid target library " + library);
+    }
+    CompiledKinematics reference = compile(EXPORT_NO_ALLOC|EXPORT_CSE, cache_directory);
+
+    ////////////
+    // Sampled workspace:
+    std::mt19937_64 generator (1);
+    std::uniform_real_distribution<double> angle (-M_PI, M_PI);
+    std::vector<double> q (m_actuated_joints.size());
+    double expected[12], actual[12];
+    TargetError error = { 0, 0, samples };
+    for (int sample = 0; sample < samples; sample++) {
+        for (auto& value : q) {
+            value = angle(generator);
+        }
+        reference.forward_kinematics(q.data(), expected);
+        target(q.data(), actual);
+        for (int entry = 0; entry < 12; entry++) {
+            double& bound = (entry % 4 == 3) ? error.position : error.rotation;
+            bound = std::max(bound, std::fabs(actual[entry] - expected[entry]));
+        }
+    }
+    dlclose(handle);
+
+    std::string format = fixed_point ? "Q" + std::to_string(31 - m_fixed_point_bits) + "." + std::to_string(m_fixed_point_bits)
+                                     : "float32";
+    std::cout << "Target " << format << " max abs pose error over " << samples << " samples: rotation "
+              << error.rotation << ", position " << error.position << "\n" << std::flush;
+    return error;
+}
+
+KinematicsTape Arm::tape(int options) {
+    derive_chain();
+    derive_jacobian(options);
+
+    // Compound angles are derived by the tape from the joint sines & cosines
+    std::set<std::string> variables;
+    std::vector<ExpressionTree> trees = simplify_expressions(m_forward_kinematics, &variables);
+    if (options & (EXPORT_FUSED | EXPORT_GEOMETRIC_JACOBIAN)) {
+        std::vector<ExpressionTree> jac_trees = simplify_expressions(m_geometric_jacobian, &variables,
+                                                                     6*m_actuated_joints.size());
+        trees.insert(trees.end(), jac_trees.begin(), jac_trees.end());
+    }
+
+    std::vector<Subexpression> temporaries;
+    if (options & EXPORT_CSE) {
+        std::vector<ExpressionTree*> tree_pointers;
+        for (auto& tree : trees) {
+            tree_pointers.push_back(&tree);
+        }
+        temporaries = eliminate_common_subexpressions(tree_pointers);
+    }
+
+    std::vector<std::string> joints;
+    for (auto joint : m_actuated_joints) {
+        joints.push_back(get_name(joint));
+    }
+    return KinematicsTape(joints, trees, temporaries);
+}
+
+Symbolic Arm::geometric_jacobian() {
+    derive_frames();
+    Symbolic jacobian("J", 6, m_actuated_joints.size());
+    int column = 0;
+    for (int index = 0; index < m_transforms.size(); index++) {
+        Transform& T = m_transforms[index];
+        if (!T.is_actuated()) {
+            continue;
+        }
+
+        // Joint axis z & origin p, expressed in the base frame
+        std::vector<Symbolic> z { Symbolic(0), Symbolic(0), Symbolic(1) };
+        std::vector<Symbolic> r (3);
+        for (int row = 0; row < 3; row++) {
+            if (index > 0) {
+                z[row] = m_frames[index-1](row, 2);
+                r[row] = m_forward_kinematics(row, 3) - m_frames[index-1](row, 3);
+            } else {
+                r[row] = m_forward_kinematics(row, 3);
+            }
+        }
+
+        if (T.m_joint_type == PRISMATIC) {
+            for (int row = 0; row < 3; row++) {
+                jacobian(row, column) = z[row];
+                jacobian(row+3, column) = 0;
+            }
+        } else {
+            // Linear velocity z x r, with sin(q)^2 rewritten as 1 - cos(q)^2 so that
+            // the Pythagorean terms introduced by the cross product cancel
+            std::vector<Symbolic> linear { z[1]*r[2] - z[2]*r[1],
+                                           z[2]*r[0] - z[0]*r[2],
+                                           z[0]*r[1] - z[1]*r[0] };
+            for (int row = 0; row < 3; row++) {
+                for (int joint = 0; joint < m_transforms.size(); joint++) {
+                    if (m_transforms[joint].m_joint_type == REVOLUTE) {
+                        Symbolic q = m_transforms[joint].get_actuated_joint();
+                        linear[row] = linear[row].subst(sin(q)^2, 1-(cos(q)^2));
+                    }
+                }
+                jacobian(row, column) = linear[row];
+                jacobian(row+3, column) = z[row];
+            }
+        }
+        column++;
+    }
+    return jacobian;
+}
+
+bool Arm::spherical_wrist() {
+    std::vector<int> joints;
+    for (int index = 0; index < m_transforms.size(); index++) {
+        if (m_transforms[index].is_actuated()) {
+            if (m_transforms[index].m_joint_type != REVOLUTE) {
+                return false;
+            }
+            joints.push_back(index);
+        }
+    }
+    // Static transforms are only folded into the base & the tool
+    if (joints.size() != 6 || joints[5] - joints[0] != 5) {
+        return false;
+    }
+    try {
+        Transform& T4 = m_transforms[joints[3]];
+        Transform& T5 = m_transforms[joints[4]];
+        return std::fabs(numeric_parameter(T4.m_a)) < 1e-12 && std::fabs(numeric_parameter(T5.m_a)) < 1e-12 &&
+               std::fabs(numeric_parameter(T5.m_d)) < 1e-12 &&
+               std::fabs(std::sin(numeric_parameter(T4.m_alpha))) > 1e-12 &&
+               std::fabs(std::sin(numeric_parameter(T5.m_alpha))) > 1e-12;
+    } catch (...) {
+        // Symbolic link parameters
+        return false;
+    }
+}
+
+void Arm::emit_inverse_kinematics(FunctionStream& os, int options) {
+    if (!spherical_wrist()) {
+        throw std::invalid_argument("Closed-form inverse kinematics needs 6 revolute joints with numeric parameters, "
+                                    "static transforms only before the first or after the last joint & a spherical wrist");
+    }
+    std::vector<int> joints;
+    for (int index = 0; index < m_transforms.size(); index++) {
+        if (m_transforms[index].is_actuated()) {
+            joints.push_back(index);
+        }
+    }
+    double a[4], d[4], ca[6], sa[6];
+    for (int joint = 0; joint < 6; joint++) {
+        Transform& T = m_transforms[joints[joint]];
+        double alpha = numeric_parameter(T.m_alpha);
+        ca[joint] = std::cos(alpha);
+        sa[joint] = std::sin(alpha);
+        if (joint < 4) {
+            a[joint] = numeric_parameter(T.m_a);
+            d[joint] = numeric_parameter(T.m_d);
+        }
+    }
+
+    // Target = base*T1(q1)*...*T5(q5)*Rz(q6)*tool: the static transforms ahead of joint 1 form the base,
+    // and joint 6's link with the static transforms after it the tool
+    std::vector<std::vector<double>> base { {1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1} };
+    for (int index = 0; index < joints[0]; index++) {
+        base = multiply_transforms(base, m_transforms[index].evaluate());
+    }
+    std::vector<std::vector<double>> tool = m_transforms[joints[5]].evaluate(0);
+    for (int index = joints[5] + 1; index < m_transforms.size(); index++) {
+        tool = multiply_transforms(tool, m_transforms[index].evaluate());
+    }
+    auto print_inverse = [] (const std::vector<std::vector<double>>& T) {
+        std::ostringstream entries;
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 4; c++) {
+                double value = (c < 3) ? T[c][r] : -(T[0][r]*T[0][3] + T[1][r]*T[1][3] + T[2][r]*T[2][3]);
+                entries << ((r || c) ? ", " : "") << print_number(value);
+            }
+        }
+        return entries.str();
+    };
+
+    // Wrist center W = T1*T2*T3*(0, 0, d4). With g its position in frame 1 before rotating by q2,
+    // |g|^2 = K0 + K1*c3 + K2*s3 & g3 = G0 + G1*c3 + G2*s3
+    double f3 = ca[2]*d[3] + d[2];
+    double K0 = a[2]*a[2] + sa[2]*sa[2]*d[3]*d[3] + f3*f3 + a[1]*a[1] + d[1]*d[1] + 2*d[1]*ca[1]*f3;
+    double K1 = 2*a[1]*a[2] - 2*d[1]*sa[1]*sa[2]*d[3];
+    double K2 = 2*a[1]*sa[2]*d[3] + 2*d[1]*sa[1]*a[2];
+    double G0 = ca[1]*f3 + d[1], G1 = -sa[1]*sa[2]*d[3], G2 = sa[1]*a[2];
+    bool intersecting = std::fabs(a[0]) < 1e-12;   // Axes 1 & 2 intersect: |g| is known from W
+    bool parallel = std::fabs(sa[0]) < 1e-12;      // Axes 1 & 2 are parallel: g3 is known from W
+    if ((intersecting && (parallel || std::hypot(K1, K2) < 1e-12)) || (parallel && std::hypot(G1, G2) < 1e-12)) {
+        throw std::invalid_argument("Closed-form inverse kinematics does not support arms whose joint 3 "
+                                    "leaves the wrist center unchanged");
+    }
+
+    emit_inverse_kinematics_helpers(os, options & ~EXPORT_TEMPLATE);
+    os.open(options & ~EXPORT_TEMPLATE, "int inverse_kinematics(const double pose[12], double solutions[48])",
+            "// Closed-form inverse kinematics by Pieper's decomposition: joints 4-6 form a spherical wrist, so\n"
+            "// joints 1-3 place the wrist center & joints 4-6 orient the end effector. pose is row-major 3x4 as\n"
+            "// written by forward_kinematics(). Writes up to 8 solutions, q1..q6 per row, & returns their count.\n");
+    os << "    const double a1 = " << print_number(a[0]) << ", d1 = " << print_number(d[0])
+       << ", ca1 = " << print_number(ca[0]) << ", sa1 = " << print_number(sa[0]) << ";\n"
+       << "    const double a2 = " << print_number(a[1]) << ", d2 = " << print_number(d[1])
+       << ", ca2 = " << print_number(ca[1]) << ", sa2 = " << print_number(sa[1]) << ";\n"
+       << "    const double a3 = " << print_number(a[2]) << ", d3 = " << print_number(d[2])
+       << ", ca3 = " << print_number(ca[2]) << ", sa3 = " << print_number(sa[2]) << ", d4 = " << print_number(d[3]) << ";\n"
+       << "    const double ca4 = " << print_number(ca[3]) << ", sa4 = " << print_number(sa[3])
+       << ", ca5 = " << print_number(ca[4]) << ", sa5 = " << print_number(sa[4]) << ";\n"
+       << "    // Target without the base & tool transforms\n"
+       << "    static const double base_inverse[12] = { " << print_inverse(base) << " };\n"
+       << "    static const double tool_inverse[12] = { " << print_inverse(tool) << " };\n"
+       << "    double target[12], product[12];\n"
+       << "    kinematics_ik_multiply(base_inverse, pose, product);\n"
+       << "    kinematics_ik_multiply(product, tool_inverse, target);\n"
+       << "    double wx = target[3], wy = target[7], wz = target[11];\n"
+       << "    double q3[5];\n"
+       << "    int q3_count = 0;\n";
+
+    if (intersecting) {
+        os << "    // |g|^2 = |W - d1*z0|^2\n"
+           << "    double rho = wx*wx + wy*wy + (wz - d1)*(wz - d1);\n"
+           << "    q3_count = kinematics_ik_solve_cos_sin(" << print_number(K1) << ", " << print_number(K2)
+           << ", rho - " << print_number(K0) << ", q3);\n";
+    } else if (parallel) {
+        os << "    // g3 = (wz - d1)/ca1\n"
+           << "    q3_count = kinematics_ik_solve_cos_sin(" << print_number(G1) << ", " << print_number(G2)
+           << ", (wz - d1)/ca1 - " << print_number(G0) << ", q3);\n";
+    } else if (std::hypot(G1, G2) < 1e-12) {
+        // Axes 2 & 3 parallel (most industrial arms): g3 = G0 & h2 are constant, leaving a quadratic in L
+        os << "    // g3 & h2 are constant, so with L = K1*c3 + K2*s3, h1 = (P - K0 - L)/(2*a1) & h1^2 + h2^2 + g3^2 = K0 + L\n"
+           << "    // give x^2/(4*a1^2) + x + h2^2 + g3^2 - P = 0 in x = P - K0 - L\n"
+           << "    const double K0 = " << print_number(K0) << ", G0 = " << print_number(G0) << ";\n"
+           << "    double P = wx*wx + wy*wy + wz*wz - a1*a1 + d1*d1 - 2*d1*wz;\n"
+           << "    double h2_constant = (wz - d1 - ca1*G0)/sa1;\n"
+           << "    double x[2];\n"
+           << "    int roots = kinematics_ik_solve_quadratic(1/(4*a1*a1), 1, h2_constant*h2_constant + G0*G0 - P, x);\n"
+           << "    for (int root = 0; root < roots; root++) {\n"
+           << "        q3_count += kinematics_ik_solve_cos_sin(" << print_number(K1) << ", " << print_number(K2)
+           << ", P - K0 - x[root], q3 + q3_count);\n"
+           << "    }\n";
+    } else {
+        // h1 = x0 + xc*c3 + xs*s3 & h2 = y0 + yc*c3 + ys*s3, g rotated by q2, are fixed by |W| & wz
+        double xc = -K1/(2*a[0]), xs = -K2/(2*a[0]), yc = -ca[0]*G1/sa[0], ys = -ca[0]*G2/sa[0];
+        os << "    // Eliminating q2 from |W|^2 & wz: h1 = x0 + xc*c3 + xs*s3 & h2 = y0 + yc*c3 + ys*s3 with\n"
+           << "    // h1^2 + h2^2 + g3^2 = |g|^2, i.e. F(q3) = Acc*c3^2 + Ass*s3^2 + Acs*c3*s3 + Ac*c3 + As*s3 + A0 = 0\n"
+           << "    const double K0 = " << print_number(K0) << ", K1 = " << print_number(K1) << ", K2 = " << print_number(K2) << ";\n"
+           << "    const double G0 = " << print_number(G0) << ", G1 = " << print_number(G1) << ", G2 = " << print_number(G2) << ";\n"
+           << "    const double xc = " << print_number(xc) << ", xs = " << print_number(xs)
+           << ", yc = " << print_number(yc) << ", ys = " << print_number(ys) << ";\n"
+           << "    double P = wx*wx + wy*wy + wz*wz - a1*a1 + d1*d1 - 2*d1*wz;\n"
+           << "    double x0 = (P - K0)/(2*a1), y0 = (wz - d1 - ca1*G0)/sa1;\n"
+           << "    double Acc = xc*xc + yc*yc + G1*G1, Ass = xs*xs + ys*ys + G2*G2, Acs = 2*(xc*xs + yc*ys + G1*G2);\n"
+           << "    double Ac = 2*(x0*xc + y0*yc + G0*G1) - K1, As = 2*(x0*xs + y0*ys + G0*G2) - K2;\n"
+           << "    double A0 = x0*x0 + y0*y0 + G0*G0 - K0;\n"
+           << "    // A quartic in u = tan(q3/2), or in tan((q3 - pi)/2) when F(pi) is the smaller end coefficient,\n"
+           << "    // so that roots near pi do not make the polynomial ill-conditioned\n"
+           << "    double flip = (fabs(Acc - Ac + A0) < fabs(Acc + Ac + A0)) ? -1 : 1;\n"
+           << "    double polynomial[5] = { Acc - flip*Ac + A0, 2*flip*(As - Acs*flip), 4*Ass - 2*Acc + 2*A0,\n"
+           << "                             2*flip*(As + Acs*flip), Acc + flip*Ac + A0 };\n"
+           << "    double u[4];\n"
+           << "    int roots = kinematics_ik_solve_quartic(polynomial, u);\n"
+           << "    double offset = (flip < 0) ? M_PI : 0;\n"
+           << "    for (int root = 0; root < roots; root++) {\n"
+           << "        q3[q3_count++] = 2*atan(u[root]) + offset;\n"
+           << "    }\n"
+           << "    double scale = fmax(fmax(fabs(polynomial[1]), fabs(polynomial[2])), fmax(fabs(polynomial[3]), fabs(polynomial[4])));\n"
+           << "    if (fabs(polynomial[0]) < 1e-10*scale) {\n"
+           << "        q3[q3_count++] = M_PI + offset;\n"
+           << "    }\n"
+           << "    // Two bounded Newton steps on F refine the closed-form roots; roots of a complex pair that rounding\n"
+           << "    // made real are dropped\n"
+           << "    double tolerance = 1e-9*(fabs(Acc) + fabs(Ass) + fabs(Acs) + fabs(Ac) + fabs(As) + fabs(A0));\n"
+           << "    int real_count = 0;\n"
+           << "    for (int root = 0; root < q3_count; root++) {\n"
+           << "        double angle = q3[root], F = 0;\n"
+           << "        for (int step = 0; step < 3; step++) {\n"
+           << "            double c = cos(angle), s = sin(angle);\n"
+           << "            F = Acc*c*c + Ass*s*s + Acs*c*s + Ac*c + As*s + A0;\n"
+           << "            double dF = 2*(Ass - Acc)*c*s + Acs*(c*c - s*s) - Ac*s + As*c;\n"
+           << "            if (step < 2 && fabs(F) < 0.1*fabs(dF)) {\n"
+           << "                angle -= F/dF;\n"
+           << "            }\n"
+           << "        }\n"
+           << "        if (fabs(F) < tolerance) {\n"
+           << "            q3[real_count++] = angle;\n"
+           << "        }\n"
+           << "    }\n"
+           << "    q3_count = real_count;\n";
+    }
+
+    os << "    int count = 0;\n"
+       << "    for (int index = 0; index < q3_count; index++) {\n"
+       << "        // Repeated roots give the same branches\n"
+       << "        bool repeated = false;\n"
+       << "        for (int previous = 0; previous < index; previous++) {\n"
+       << "            repeated = repeated || fabs(kinematics_ik_wrap(q3[index] - q3[previous])) < 1e-9;\n"
+       << "        }\n"
+       << "        if (repeated) {\n"
+       << "            continue;\n"
+       << "        }\n"
+       << "        double c3 = cos(q3[index]), s3 = sin(q3[index]);\n"
+       << "        double f2 = a3*s3 - sa3*d4*c3, f3 = ca3*d4 + d3;\n"
+       << "        double g1 = a2 + a3*c3 + sa3*d4*s3, g2 = ca2*f2 - sa2*f3, g3 = sa2*f2 + ca2*f3 + d2;\n"
+       << "        // h = Rz(q2)*g, from which W = Rz(q1)*(Rx(alpha1)*h + (a1, 0, d1))\n"
+       << "        double h1[2], h2[2];\n"
+       << "        int branches = 1;\n";
+    if (intersecting || parallel) {
+        os << (intersecting ? "        h2[0] = h2[1] = (wz - d1 - ca1*g3)/sa1;\n"
+                            : "        h1[0] = h1[1] = (wx*wx + wy*wy + wz*wz - a1*a1 + d1*d1 - 2*d1*wz - g1*g1 - g2*g2 - g3*g3)/(2*a1);\n")
+           << "        double square = g1*g1 + g2*g2 - " << (intersecting ? "h2[0]*h2[0]" : "h1[0]*h1[0]") << ";\n"
+           << "        if (square < -1e-9) {\n"
+           << "            continue;\n"
+           << "        }\n"
+           << "        double root = sqrt(fmax(square, 0.0));\n"
+           << "        " << (intersecting ? "h1" : "h2") << "[0] = root;\n"
+           << "        " << (intersecting ? "h1" : "h2") << "[1] = -root;\n"
+           << "        branches = (root > 1e-12) ? 2 : 1;\n";
+    } else {
+        // Both remaining cases determine q2 uniquely from h1 & h2
+        os << "        h1[0] = (P - g1*g1 - g2*g2 - g3*g3)/(2*a1);\n"
+           << "        h2[0] = (wz - d1 - ca1*g3)/sa1;\n";
+    }
+    os << "        for (int branch = 0; branch < branches; branch++) {\n"
+       << "            double q2 = atan2(h2[branch], h1[branch]) - atan2(g2, g1);\n"
+       << "            double q1 = atan2(wy, wx) - atan2(ca1*h2[branch] - sa1*g3, h1[branch] + a1);\n"
+       << "            // Wrist orientation M = R03^T*R\n"
+       << "            double R[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, M[9], wrist[6];\n"
+       << "            kinematics_ik_rotate(R, q1, ca1, sa1);\n"
+       << "            kinematics_ik_rotate(R, q2, ca2, sa2);\n"
+       << "            kinematics_ik_rotate(R, q3[index], ca3, sa3);\n"
+       << "            for (int r = 0; r < 3; r++) {\n"
+       << "                for (int c = 0; c < 3; c++) {\n"
+       << "                    M[3*r + c] = R[r]*target[c] + R[3 + r]*target[4 + c] + R[6 + r]*target[8 + c];\n"
+       << "                }\n"
+       << "            }\n"
+       << "            int wrist_count = kinematics_ik_spherical_wrist(M, ca4, sa4, ca5, sa5, wrist);\n"
+       << "            for (int solution = 0; solution < wrist_count; solution++) {\n"
+       << "                double* q = solutions + 6*count++;\n"
+       << "                q[0] = kinematics_ik_wrap(q1);\n"
+       << "                q[1] = kinematics_ik_wrap(q2);\n"
+       << "                q[2] = kinematics_ik_wrap(q3[index]);\n"
+       << "                for (int joint = 3; joint < 6; joint++) {\n"
+       << "                    q[joint] = kinematics_ik_wrap(wrist[3*solution + joint - 3]);\n"
+       << "                }\n"
+       << "            }\n"
+       << "        }\n"
+       << "    }\n"
+       << "    return count;\n"
+       << "}\n";
+}
+
+std::vector<DynamicsLink> Arm::dynamics_links() {
+    std::vector<DynamicsLink> links;
+    try {
+        for (auto& T : m_transforms) {
+            DynamicsLink link;
+            link.joint_type = T.m_joint_type;
+            link.theta = (T.m_joint_type == REVOLUTE) ? 0 : numeric_parameter(T.m_theta);
+            link.d = (T.m_joint_type == PRISMATIC) ? 0 : numeric_parameter(T.m_d);
+            link.a = numeric_parameter(T.m_a);
+            link.alpha = numeric_parameter(T.m_alpha);
+            link.mass = T.m_mass;
+            std::copy(T.m_center_of_mass.begin(), T.m_center_of_mass.end(), link.center_of_mass);
+            std::copy(T.m_inertia.begin(), T.m_inertia.end(), link.inertia);
+            links.push_back(link);
+        }
+    } catch (...) {
+        // Symbolic link parameters
+        throw std::invalid_argument("Dynamics need numeric link parameters");
+    }
+    return links;
+}
+
+std::vector<double> Arm::inverse_dynamics(const std::vector<double>& q, const std::vector<double>& q_dot,
+                                          const std::vector<double>& q_ddot) {
+    int joints = m_actuated_joints.size();
+    if (q.size() != joints || q_dot.size() != joints || q_ddot.size() != joints || m_gravity.size() != 3) {
+        throw std::invalid_argument("Inverse dynamics need one position, velocity & acceleration per joint");
+    }
+    std::vector<double> tau (joints);
+    recursive_newton_euler(dynamics_links(), m_gravity.data(), q.data(), q_dot.data(), q_ddot.data(), tau.data());
+    return tau;
+}
+
+std::vector<CodeLink> Arm::code_links() {
+    std::vector<DynamicsLink> numeric = dynamics_links();
+    std::vector<CodeLink> links;
+    int joint = 0;
+    for (int index = 0; index < m_transforms.size(); index++) {
+        Transform& T = m_transforms[index];
+        CodeLink link;
+        link.joint_type = T.m_joint_type;
+        // Constant angles are folded exactly, so that twists of multiples of pi/2 drop their zero terms
+        link.ca = DynamicsCode::number(numeric_parameter(exact_cos(T.m_alpha)));
+        link.sa = DynamicsCode::number(numeric_parameter(exact_sin(T.m_alpha)));
+        link.a = DynamicsCode::number(numeric[index].a);
+        link.q_dot = link.q_ddot = DynamicsCode::number(0);
+        if (T.m_joint_type == REVOLUTE) {
+            std::string name = get_name(m_actuated_joints[joint]);
+            link.c = DynamicsCode::symbol("c_" + name);
+            link.s = DynamicsCode::symbol("s_" + name);
+        } else {
+            link.c = DynamicsCode::number(numeric_parameter(exact_cos(T.m_theta)));
+            link.s = DynamicsCode::number(numeric_parameter(exact_sin(T.m_theta)));
+        }
+        link.d = (T.m_joint_type == PRISMATIC) ? DynamicsCode::symbol(get_name(m_actuated_joints[joint]))
+                                               : DynamicsCode::number(numeric[index].d);
+        if (T.is_actuated()) {
+            std::string velocity = get_name(m_joint_velocities[joint]);
+            link.q_dot = DynamicsCode::symbol(velocity);
+            link.q_ddot = DynamicsCode::symbol(velocity.substr(0, velocity.size() - 4) + "_ddot");
+            joint++;
+        }
+        link.mass = numeric[index].mass;
+        std::copy(numeric[index].center_of_mass, numeric[index].center_of_mass + 3, link.center_of_mass);
+        std::copy(numeric[index].inertia, numeric[index].inertia + 6, link.inertia);
+        links.push_back(link);
+    }
+    return links;
+}
+
+std::vector<double> Arm::forward_dynamics(const std::vector<double>& q, const std::vector<double>& q_dot,
+                                          const std::vector<double>& tau) {
+    int joints = m_actuated_joints.size();
+    if (q.size() != joints || q_dot.size() != joints || tau.size() != joints || m_gravity.size() != 3) {
+        throw std::invalid_argument("Forward dynamics need one position, velocity & torque per joint");
+    }
+    std::vector<double> q_ddot (joints);
+    articulated_body(dynamics_links(), m_gravity.data(), q.data(), q_dot.data(), tau.data(), q_ddot.data());
+    return q_ddot;
+}
+
+// The sines & cosines of the revolute joints of links, shared by the terms of the dynamics
+static void emit_joint_trig(std::ostream& os, const std::vector<CodeLink>& links) {
+    for (auto& link : links) {
+        if (link.joint_type == REVOLUTE) {
+            std::string name = link.c.expr.substr(2);
+            os << "    double " << link.c.expr << " = cos(" << name << "), " << link.s.expr << " = sin(" << name << ");\n";
+        }
+    }
+}
+
+void Arm::emit_inverse_dynamics(FunctionStream& os, int options) {
+    if (m_gravity.size() != 3) {
+        throw std::invalid_argument("Gravity needs 3 entries");
+    }
+    std::vector<CodeLink> links = code_links();
+    std::vector<Symbolic> accelerations;
+    for (auto link : links) {
+        if (link.joint_type != STATIC) {
+            accelerations.push_back(Symbolic(link.q_ddot.expr));
+        }
+    }
+
+    std::ostringstream comment;
+    comment << "// Joint torques (forces of prismatic joints) by the recursive Newton-Euler algorithm, with gravity\n"
+            << "// (" << print_number(m_gravity[0]) << ", " << print_number(m_gravity[1]) << ", "
+            << print_number(m_gravity[2]) << ") in the base frame\n";
+    std::ostringstream signature;
+    signature << "void inverse_dynamics(";
+    emit_joint_arguments(signature, m_actuated_joints);
+    signature << ", ";
+    emit_joint_arguments(signature, m_joint_velocities);
+    signature << ", ";
+    emit_joint_arguments(signature, accelerations);
+    signature << ", double tau[" << m_actuated_joints.size() << "])";
+    os.open(options & ~EXPORT_TEMPLATE, signature.str(), comment.str());
+    emit_joint_trig(os, links);
+    DynamicsCode code (os);
+    emit_recursive_newton_euler(code, links, DynamicsCode::vector(m_gravity[0], m_gravity[1], m_gravity[2]), "tau");
+    os << "}\n";
+}
+
+void Arm::dynamics_terms(const std::vector<double>& q, const std::vector<double>& q_dot,
+                         std::vector<double>& M, std::vector<double>& c, std::vector<double>& g) {
+    int joints = m_actuated_joints.size();
+    if (q.size() != joints || q_dot.size() != joints || m_gravity.size() != 3) {
+        throw std::invalid_argument("Dynamics terms need one position & velocity per joint");
+    }
+    M.resize(joints*joints);
+    c.resize(joints);
+    g.resize(joints);
+    joint_space_dynamics(dynamics_links(), m_gravity.data(), q.data(), q_dot.data(), M.data(), c.data(), g.data());
+}
+
+void Arm::emit_dynamics_terms(FunctionStream& os, int options) {
+    if (m_gravity.size() != 3) {
+        throw std::invalid_argument("Gravity needs 3 entries");
+    }
+    std::vector<CodeLink> links = code_links();
+    int joints = m_actuated_joints.size();
+
+    std::ostringstream comment;
+    comment << "// Joint space dynamics M(q)*q_ddot + C(q, q_dot)*q_dot + g(q) = tau: the mass matrix M (row-major,\n"
+            << "// symmetric), C_q_dot = C(q, q_dot)*q_dot & the gravity torques g, with gravity (" << print_number(m_gravity[0])
+            << ", " << print_number(m_gravity[1]) << ", " << print_number(m_gravity[2]) << ") in the base frame\n";
+    std::ostringstream signature;
+    signature << "void dynamics_terms(";
+    emit_joint_arguments(signature, m_actuated_joints);
+    signature << ", ";
+    emit_joint_arguments(signature, m_joint_velocities);
+    signature << ", double M[" << joints*joints << "], double C_q_dot[" << joints << "], double g[" << joints << "])";
+    os.open(options & ~EXPORT_TEMPLATE, signature.str(), comment.str());
+    emit_joint_trig(os, links);
+    DynamicsCode code (os);
+    code.comment("Mass matrix & gravity torques");
+    emit_composite_rigid_body(code, links, DynamicsCode::vector(m_gravity[0], m_gravity[1], m_gravity[2]), "M", "g");
+
+    // Coriolis & centrifugal torques: inverse dynamics without joint accelerations or gravity
+    for (auto& link : links) {
+        link.q_ddot = DynamicsCode::number(0);
+    }
+    code.comment("Coriolis & centrifugal torques");
+    emit_recursive_newton_euler(code, links, DynamicsCode::vector(0, 0, 0), "C_q_dot");
+    os << "}\n";
+}
+
+void Arm::emit_forward_dynamics(FunctionStream& os, int options) {
+    if (m_gravity.size() != 3) {
+        throw std::invalid_argument("Gravity needs 3 entries");
+    }
+    std::vector<CodeLink> links = code_links();
+    int joints = m_actuated_joints.size();
+
+    std::ostringstream comment;
+    comment << "// Joint accelerations under the joint torques (forces of prismatic joints) tau by the articulated-body\n"
+            << "// algorithm, with gravity (" << print_number(m_gravity[0]) << ", " << print_number(m_gravity[1]) << ", "
+            << print_number(m_gravity[2]) << ") in the base frame\n";
+    std::ostringstream signature;
+    signature << "void forward_dynamics(";
+    emit_joint_arguments(signature, m_actuated_joints);
+    signature << ", ";
+    emit_joint_arguments(signature, m_joint_velocities);
+    signature << ", const double tau[" << joints << "], double q_ddot[" << joints << "])";
+    os.open(options & ~EXPORT_TEMPLATE, signature.str(), comment.str());
+    emit_joint_trig(os, links);
+    DynamicsCode code (os);
+    emit_articulated_body(code, links, DynamicsCode::vector(m_gravity[0], m_gravity[1], m_gravity[2]), "tau", "q_ddot");
+    os << "}\n";
 }
 
 std::vector<std::vector<std::vector<double>>>
@@ -0,0 +1,184 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include "arm.h"
+
+// Target duration of a latency sample: calls of at least this mean duration are timed one by one &
+// shorter ones in the fewest consecutive calls reaching it, since a single sub-microsecond call is
+// too short to time
+#define BENCHMARK_SAMPLE_NS 1000
+
+/////////////////////////////////////////////////
+
+struct BenchmarkResult {
+    std::string name;
+    long calls;
+    double ns_per_call;      // Mean
+    double p50_ns, p99_ns;   // Latency percentiles over samples of calls_per_sample calls
+    double calls_per_second;
+    long calls_per_sample;   // Calibrated from the mean, see BENCHMARK_SAMPLE_NS
+    long samples;
+};
+
+// Times call(i) for i in [0, calls) after warmup untimed calls; calls must be positive. A calibration
+// pass estimates the mean call & clock read durations, which size the latency samples & are
+// subtracted from them. When each call evaluates several configurations, results are reported per
+// configuration.
+template <typename Function>
+BenchmarkResult run_benchmark(const std::string& name, Function call, long calls, long warmup,
+                              int configurations_per_call=1);
+
+// count random configurations of joints values uniform in [-pi, pi), row-major
+std::vector<double> random_configurations(int joints, long count, unsigned seed=1);
+
+// Benchmarks the compiled forward kinematics, each compiled differential kinematics column
+// (d pose/d q_j) & Arm::get_positions over random configurations. get_positions evaluates
+// symbolically & is given slow_calls calls.
+std::vector<BenchmarkResult> benchmark_arm(Arm& arm, long calls, long slow_calls);
+
+void print_benchmarks(const std::vector<BenchmarkResult>& results);
+void write_benchmarks_json(const std::string& filename, const std::vector<BenchmarkResult>& results);
+
+/////////////////////////////////////////////////
+
+template <typename Function>
+BenchmarkResult run_benchmark(const std::string& name, Function call, long calls, long warmup,
+                              int configurations_per_call) {
+    if (calls <= 0) {
+        throw std::invalid_argument("Benchmark " + name + " needs a positive number of calls");
+    }
+    for (long i = 0; i < warmup; i++) {
+        call(i % calls);
+    }
+
+    ////////////
+    // Calibration:
+    // The median of back-to-back clock reads, and the mean call over at most 1000 calls or 10ms
+    typedef std::chrono::steady_clock Clock;
+    std::vector<double> reads (101);
+    for (auto& read : reads) {
+        auto before = Clock::now();
+        read = std::chrono::duration<double, std::nano>(Clock::now() - before).count();
+    }
+    std::nth_element(reads.begin(), reads.begin() + reads.size()/2, reads.end());
+    double clock_ns = reads[reads.size()/2];
+    long calibration_calls = 0;
+    double calibration_ns = 0;
+    auto calibration_start = Clock::now();
+    while (calibration_calls < 1000 && calibration_ns < 1e7) {
+        call(calibration_calls % calls);
+        calibration_calls++;
+        calibration_ns = std::chrono::duration<double, std::nano>(Clock::now() - calibration_start).count();
+    }
+    double mean_ns = calibration_ns/calibration_calls;
+    long sample_calls = std::max(1L, std::min(calls, (long)std::ceil(BENCHMARK_SAMPLE_NS/std::max(mean_ns, 1.0))));
+
+    std::vector<double> samples;
+    samples.reserve(calls/sample_calls + 1);
+    auto start = Clock::now();
+    auto sample_start = start;
+    for (long i = 0; i < calls; ) {
+        long end = std::min(calls, i + sample_calls);
+        long calls_in_sample = end - i;
+        for (; i < end; i++) {
+            call(i);
+        }
+        auto now = Clock::now();
+        double elapsed = std::chrono::duration<double, std::nano>(now - sample_start).count() - clock_ns;
+        samples.push_back(std::max(0.0, elapsed)/calls_in_sample);
+        sample_start = now;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::sort(samples.begin(), samples.end());
+
+    BenchmarkResult result;
+    result.name = name;
+    result.calls = calls*configurations_per_call;
+    result.ns_per_call = 1e9*seconds/result.calls;
+    result.p50_ns = samples[samples.size()/2]/configurations_per_call;
+    result.p99_ns = samples[std::min(samples.size() - 1, samples.size()*99/100)]/configurations_per_call;
+    result.calls_per_second = result.calls/seconds;
+    result.calls_per_sample = sample_calls;
+    result.samples = samples.size();
+    return result;
+}
+
+std::vector<double> random_configurations(int joints, long count, unsigned seed) {
+    std::mt19937_64 generator (seed);
+    std::uniform_real_distribution<double> angle (-M_PI, M_PI);
+    std::vector<double> q (joints*count);
+    for (auto& value : q) {
+        value = angle(generator);
+    }
+    return q;
+}
+
+std::vector<BenchmarkResult> benchmark_arm(Arm& arm, long calls, long slow_calls) {
+    const int joints = arm.m_actuated_joints.size();
+    CompiledKinematics compiled = arm.compile(EXPORT_NO_ALLOC|EXPORT_CSE|EXPORT_TRIG_IDENTITIES);
+
+    // Configurations are cycled through, which keeps the input buffer bounded
+    const long configurations = std::min(calls, 1L << 20);
+    std::vector<double> q = random_configurations(joints, configurations);
+    double out[12];
+    long warmup = std::min(calls/10, 100000L);
+    std::vector<BenchmarkResult> results;
+
+    results.push_back(run_benchmark("forward_kinematics", [&] (long i) {
+        compiled.forward_kinematics(&q[(i % configurations)*joints], out);
+    }, calls, warmup));
+    for (int column = 0; column < compiled.differential_kinematics.size(); column++) {
+        auto function = compiled.differential_kinematics[column];
+        results.push_back(run_benchmark("differential_kinematics_d" + get_name(arm.m_actuated_joints[column]),
+                                        [&] (long i) {
+            function(&q[(i % configurations)*joints], out);
+        }, calls, warmup));
+    }
+    results.push_back(run_benchmark("get_positions", [&] (long i) {
+        const double* q_i = &q[(i % configurations)*joints];
+        arm.get_positions(std::vector<double>(q_i, q_i + joints));
+    }, slow_calls, std::min(slow_calls/10, 100L)));
+    return results;
+}
+
+void print_benchmarks(const std::vector<BenchmarkResult>& results) {
+    std::cout << std::left << std::setw(40) << "Benchmark" << std::right
+              << std::setw(12) << "ns/call" << std::setw(12) << "p50 ns" << std::setw(12) << "p99 ns"
+              << std::setw(16) << "calls/second" << "\n";
+    for (auto result : results) {
+        std::cout << std::left << std::setw(40) << result.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << result.ns_per_call << std::setw(12) << result.p50_ns
+                  << std::setw(12) << result.p99_ns << std::setw(16) << std::setprecision(0)
+                  << result.calls_per_second << "\n";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
+
+void write_benchmarks_json(const std::string& filename, const std::vector<BenchmarkResult>& results) {
+    std::ofstream file (filename, std::ofstream::binary);
+    file << "{\n"
+         << "  \"benchmarks\": [\n";
+    for (int index = 0; index < results.size(); index++) {
+        const BenchmarkResult& result = results[index];
+        file << "    {\"name\": \"" << result.name << "\", \"calls\": " << result.calls
+             << ", \"ns_per_call\": " << result.ns_per_call << ", \"p50_ns\": " << result.p50_ns
+             << ", \"p99_ns\": " << result.p99_ns << ", \"calls_per_second\": " << result.calls_per_second
+             << ", \"calls_per_sample\": " << result.calls_per_sample << ", \"samples\": " << result.samples
+             << "}" << ((index == results.size() - 1) ? "\n" : ",\n");
+    }
+    file << "  ]\n"
+         << "}\n";
+}
+
+#endif
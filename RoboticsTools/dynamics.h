@@ -0,0 +1,1062 @@
+#ifndef DYNAMICS_H
+#define DYNAMICS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include <stdexcept>
+#include "transform.h"
+#include "expressiontree.h"
+
+/////////////////////////////////////////////////
+
+// Numeric parameters of one transform of the chain, for the dynamics
+struct DynamicsLink {
+    int joint_type;
+    double theta, d, a, alpha;  // The actuated parameter is replaced by the joint value
+    double mass;
+    double center_of_mass[3];   // In the link's frame
+    double inertia[6];          // Ixx, Iyy, Izz, Ixy, Ixz, Iyz about the center of mass, in the link's frame
+};
+
+// A scalar of generated dynamics code: a number folded at generation time, or an expression of the
+// emitted function's arguments & variables
+struct CodeValue {
+    bool constant;
+    double value;
+    std::string expr;
+    bool sum;  // expr has a top level + or -, so is parenthesized as a factor
+};
+typedef std::array<CodeValue, 3> CodeVector;
+// Symmetric 3x3 matrix (xx, yy, zz, xy, xz, yz)
+typedef std::array<CodeValue, 6> CodeSymmetric;
+// 3x3 matrix by rows
+typedef std::array<CodeVector, 3> CodeMatrix;
+
+// A transform of the chain in generated code: the sine & cosine of theta & alpha, a, d and the joint
+// variables (zero for static transforms), with its numeric inertial parameters
+struct CodeLink {
+    int joint_type;
+    CodeValue c, s, ca, sa, a, d;
+    CodeValue q_dot, q_ddot;
+    double mass;
+    double center_of_mass[3];
+    double inertia[6];
+};
+
+// Writes straight-line code for the dynamics recursions. Operations on known numbers are folded, so
+// the zero & unit entries of the Denavit-Hartenberg rotations, zero base velocities & massless links
+// emit no code, and every named quantity is assigned once.
+class DynamicsCode {
+public:
+    DynamicsCode(std::ostream& os, const std::string& indent="    ") : m_os(os), m_indent(indent) {}
+
+    static CodeValue number(double value);
+    static CodeValue symbol(const std::string& name);
+    static CodeVector vector(double x, double y, double z);
+
+    CodeValue add(const CodeValue& a, const CodeValue& b);
+    CodeValue subtract(const CodeValue& a, const CodeValue& b);
+    CodeValue multiply(const CodeValue& a, const CodeValue& b);
+    CodeValue negate(const CodeValue& a);
+    CodeValue divide(const CodeValue& a, const CodeValue& b);
+
+    CodeVector add(const CodeVector& a, const CodeVector& b);
+    CodeVector subtract(const CodeVector& a, const CodeVector& b);
+    CodeVector scale(const CodeValue& factor, const CodeVector& v);
+    CodeVector cross(const CodeVector& a, const CodeVector& b);
+    CodeValue dot(const CodeVector& a, const CodeVector& b);
+
+    // R*v & R^T*v for the rotation R = Rz(theta)*Rx(alpha) of link, from its frame to the previous one
+    CodeVector rotate(const CodeLink& link, const CodeVector& v);
+    CodeVector rotate_transpose(const CodeLink& link, const CodeVector& v);
+    // The origin of link's frame from the previous one & the previous z axis, both in link's frame
+    CodeVector origin(const CodeLink& link);
+    CodeVector axis(const CodeLink& link);
+    // Symmetric 3x3 inertia (Ixx, Iyy, Izz, Ixy, Ixz, Iyz) times v
+    CodeVector inertia(const double* inertia, const CodeVector& v);
+    CodeVector multiply(const CodeSymmetric& S, const CodeVector& v);
+
+    // 3x3 matrices: conversions from & to symmetric storage, arithmetic, the cross product matrix of r
+    // & the outer product a*b^T
+    CodeMatrix matrix(const CodeSymmetric& S);
+    CodeSymmetric symmetric(const CodeMatrix& M);
+    CodeMatrix transpose(const CodeMatrix& M);
+    CodeMatrix add(const CodeMatrix& a, const CodeMatrix& b);
+    CodeMatrix subtract(const CodeMatrix& a, const CodeMatrix& b);
+    CodeMatrix multiply(const CodeMatrix& a, const CodeMatrix& b);
+    CodeVector multiply(const CodeMatrix& M, const CodeVector& v);
+    CodeMatrix scale(const CodeValue& factor, const CodeMatrix& M);
+    CodeMatrix skew(const CodeVector& r);
+    CodeMatrix outer(const CodeVector& a, const CodeVector& b);
+    // R*M*R^T into the previous frame of link, declaring R*M as name_0, name_1 & name_2 (by columns)
+    CodeMatrix rotate(const CodeLink& link, const CodeMatrix& M, const std::string& name);
+
+    // Declares name = value, or returns value itself when it is a number or a single name
+    CodeValue define(const std::string& name, const CodeValue& value);
+    // Declares name_x, name_y & name_z
+    CodeVector define(const std::string& name, const CodeVector& value);
+    // Declares name_xx, name_yy, name_zz, name_xy, name_xz & name_yz
+    CodeSymmetric define(const std::string& name, const CodeSymmetric& value);
+    // Declares name_xx, name_xy, ... name_zz
+    CodeMatrix define(const std::string& name, const CodeMatrix& value);
+    void assign(const std::string& target, const CodeValue& value);
+    void comment(const std::string& text);
+
+private:
+    static std::string factor(const CodeValue& value);
+
+    std::ostream& m_os;
+    std::string m_indent;
+};
+
+// Runtime recursive Newton-Euler inverse dynamics over links: tau[N] from q, q_dot & q_ddot[N] of the
+// N actuated joints, with gravity[3] in the base frame. Walks the links on every call, without code
+// generation; the reference for the generated inverse_dynamics().
+void recursive_newton_euler(const std::vector<DynamicsLink>& links, const double* gravity,
+                            const double* q, const double* q_dot, const double* q_ddot, double* tau);
+
+// Emits the recursive Newton-Euler algorithm, assigning the joint torques to tau[index] with the base
+// accelerating at -gravity. Link quantities are expressed in the link's frame: angular velocity w,
+// angular acceleration dw & origin acceleration a forwards, then the force f & moment n exerted on each
+// link by its predecessor backwards.
+void emit_recursive_newton_euler(DynamicsCode& code, const std::vector<CodeLink>& links,
+                                 const CodeVector& gravity, const std::string& tau);
+
+// Runtime joint space dynamics M(q)*q_ddot + C(q, q_dot)*q_dot + g(q) = tau: the row-major mass matrix
+// M[N*N], the Coriolis & centrifugal torques c[N] = C(q, q_dot)*q_dot and the gravity torques g[N], by
+// N + 2 recursive Newton-Euler passes; the reference for the generated dynamics_terms().
+void joint_space_dynamics(const std::vector<DynamicsLink>& links, const double* gravity,
+                          const double* q, const double* q_dot, double* M, double* c, double* g);
+
+// Emits the mass matrix & gravity torques by the composite rigid body algorithm, assigning M[N*N] &
+// g[N]. The inertia of each link & its successors is accumulated backwards about the link's origin in
+// its frame, as mass, first moment h & rotational inertia I: column j of M is the force of the joint's
+// unit acceleration on the composite of link j, carried back to the base, and gravity torques are the
+// moments of the composites' weights. Only the lower triangle of M is derived, and mirrored.
+void emit_composite_rigid_body(DynamicsCode& code, const std::vector<CodeLink>& links,
+                               const CodeVector& gravity, const std::string& M, const std::string& g);
+
+// Runtime forward dynamics by the articulated-body algorithm: q_ddot[N] from q, q_dot & tau[N], with
+// gravity[3] in the base frame. The reference for the generated forward_dynamics().
+void articulated_body(const std::vector<DynamicsLink>& links, const double* gravity,
+                      const double* q, const double* q_dot, const double* tau, double* q_ddot);
+
+// Emits the articulated-body algorithm, reading the joint torques from tau[index] & assigning the joint
+// accelerations to q_ddot[index]. Spatial quantities are taken at the link's origin in its frame,
+// angular part first: velocities & velocity product accelerations c forwards, articulated inertias
+// (blocks Iw, Iwv & Iv) & bias forces p backwards, then the accelerations forwards from the base
+// accelerating at -gravity.
+void emit_articulated_body(DynamicsCode& code, const std::vector<CodeLink>& links,
+                           const CodeVector& gravity, const std::string& tau, const std::string& q_ddot);
+
+/////////////////////////////////////////////////
+
+CodeValue DynamicsCode::number(double value) {
+    if (!std::isfinite(value)) {
+        throw std::invalid_argument("Cannot emit the non-finite number " + print_number(value));
+    }
+    return { true, value, print_number(value), false };
+}
+
+CodeValue DynamicsCode::symbol(const std::string& name) {
+    return { false, 0, name, false };
+}
+
+CodeVector DynamicsCode::vector(double x, double y, double z) {
+    return {{ number(x), number(y), number(z) }};
+}
+
+std::string DynamicsCode::factor(const CodeValue& value) {
+    return value.sum ? "(" + value.expr + ")" : value.expr;
+}
+
+CodeValue DynamicsCode::add(const CodeValue& a, const CodeValue& b) {
+    if (a.constant && b.constant) {
+        return number(a.value + b.value);
+    } else if (a.constant && a.value == 0) {
+        return b;
+    } else if (b.constant && b.value == 0) {
+        return a;
+    }
+    // A leading minus of b, of a number, a product or the first term of a sum, becomes the operator
+    if (b.expr[0] == '-') {
+        return { false, 0, a.expr + " - " + b.expr.substr(1), true };
+    }
+    return { false, 0, a.expr + " + " + b.expr, true };
+}
+
+CodeValue DynamicsCode::negate(const CodeValue& a) {
+    if (a.constant) {
+        return number(-a.value);
+    } else if (a.sum) {
+        return { false, 0, "-(" + a.expr + ")", false };
+    } else if (a.expr[0] == '-') {
+        return { false, 0, a.expr.substr(1), false };
+    }
+    return { false, 0, "-" + a.expr, false };
+}
+
+CodeValue DynamicsCode::divide(const CodeValue& a, const CodeValue& b) {
+    if (b.constant) {
+        if (b.value == 0) {
+            throw std::invalid_argument("Cannot emit a division by zero");
+        }
+        return multiply(number(1/b.value), a);
+    } else if (a.constant && a.value == 0) {
+        return a;
+    }
+    return { false, 0, factor(a) + "/" + ((b.sum || b.expr.find_first_of("*/") != std::string::npos) ?
+                                          "(" + b.expr + ")" : b.expr), false };
+}
+
+CodeValue DynamicsCode::subtract(const CodeValue& a, const CodeValue& b) {
+    return add(a, negate(b));
+}
+
+CodeValue DynamicsCode::multiply(const CodeValue& a, const CodeValue& b) {
+    if (b.constant && !a.constant) {
+        return multiply(b, a);
+    }
+    if (a.constant) {
+        if (b.constant) {
+            return number(a.value*b.value);
+        } else if (a.value == 0) {
+            return number(0);
+        } else if (a.value == 1) {
+            return b;
+        } else if (a.value == -1) {
+            return negate(b);
+        }
+    }
+    if (b.expr[0] == '-' && !b.sum) {
+        return negate(multiply(a, negate(b)));
+    }
+    return { false, 0, factor(a) + "*" + factor(b), false };
+}
+
+CodeVector DynamicsCode::add(const CodeVector& a, const CodeVector& b) {
+    return {{ add(a[0], b[0]), add(a[1], b[1]), add(a[2], b[2]) }};
+}
+
+CodeVector DynamicsCode::subtract(const CodeVector& a, const CodeVector& b) {
+    return {{ subtract(a[0], b[0]), subtract(a[1], b[1]), subtract(a[2], b[2]) }};
+}
+
+CodeVector DynamicsCode::scale(const CodeValue& factor, const CodeVector& v) {
+    return {{ multiply(factor, v[0]), multiply(factor, v[1]), multiply(factor, v[2]) }};
+}
+
+CodeVector DynamicsCode::cross(const CodeVector& a, const CodeVector& b) {
+    return {{ subtract(multiply(a[1], b[2]), multiply(a[2], b[1])),
+              subtract(multiply(a[2], b[0]), multiply(a[0], b[2])),
+              subtract(multiply(a[0], b[1]), multiply(a[1], b[0])) }};
+}
+
+CodeValue DynamicsCode::dot(const CodeVector& a, const CodeVector& b) {
+    return add(add(multiply(a[0], b[0]), multiply(a[1], b[1])), multiply(a[2], b[2]));
+}
+
+CodeVector DynamicsCode::rotate(const CodeLink& link, const CodeVector& v) {
+    // Rx(alpha)*v, then Rz(theta)
+    CodeValue u1 = subtract(multiply(link.ca, v[1]), multiply(link.sa, v[2]));
+    CodeValue u2 = add(multiply(link.sa, v[1]), multiply(link.ca, v[2]));
+    return {{ subtract(multiply(link.c, v[0]), multiply(link.s, u1)),
+              add(multiply(link.s, v[0]), multiply(link.c, u1)),
+              u2 }};
+}
+
+CodeVector DynamicsCode::rotate_transpose(const CodeLink& link, const CodeVector& v) {
+    // Rz(theta)^T*v, then Rx(alpha)^T
+    CodeValue u0 = add(multiply(link.c, v[0]), multiply(link.s, v[1]));
+    CodeValue u1 = subtract(multiply(link.c, v[1]), multiply(link.s, v[0]));
+    return {{ u0,
+              add(multiply(link.ca, u1), multiply(link.sa, v[2])),
+              subtract(multiply(link.ca, v[2]), multiply(link.sa, u1)) }};
+}
+
+CodeVector DynamicsCode::origin(const CodeLink& link) {
+    return {{ link.a, multiply(link.d, link.sa), multiply(link.d, link.ca) }};
+}
+
+CodeVector DynamicsCode::axis(const CodeLink& link) {
+    return {{ number(0), link.sa, link.ca }};
+}
+
+CodeVector DynamicsCode::inertia(const double* I, const CodeVector& v) {
+    auto row = [this, &v] (double x, double y, double z) {
+        return add(add(multiply(number(x), v[0]), multiply(number(y), v[1])), multiply(number(z), v[2]));
+    };
+    return {{ row(I[0], I[3], I[4]), row(I[3], I[1], I[5]), row(I[4], I[5], I[2]) }};
+}
+
+CodeVector DynamicsCode::multiply(const CodeSymmetric& S, const CodeVector& v) {
+    auto row = [this, &v] (const CodeValue& x, const CodeValue& y, const CodeValue& z) {
+        return add(add(multiply(x, v[0]), multiply(y, v[1])), multiply(z, v[2]));
+    };
+    return {{ row(S[0], S[3], S[4]), row(S[3], S[1], S[5]), row(S[4], S[5], S[2]) }};
+}
+
+CodeMatrix DynamicsCode::matrix(const CodeSymmetric& S) {
+    return {{ {{ S[0], S[3], S[4] }}, {{ S[3], S[1], S[5] }}, {{ S[4], S[5], S[2] }} }};
+}
+
+CodeSymmetric DynamicsCode::symmetric(const CodeMatrix& M) {
+    return {{ M[0][0], M[1][1], M[2][2], M[0][1], M[0][2], M[1][2] }};
+}
+
+CodeMatrix DynamicsCode::transpose(const CodeMatrix& M) {
+    return {{ {{ M[0][0], M[1][0], M[2][0] }}, {{ M[0][1], M[1][1], M[2][1] }}, {{ M[0][2], M[1][2], M[2][2] }} }};
+}
+
+CodeMatrix DynamicsCode::add(const CodeMatrix& a, const CodeMatrix& b) {
+    return {{ add(a[0], b[0]), add(a[1], b[1]), add(a[2], b[2]) }};
+}
+
+CodeMatrix DynamicsCode::subtract(const CodeMatrix& a, const CodeMatrix& b) {
+    return {{ subtract(a[0], b[0]), subtract(a[1], b[1]), subtract(a[2], b[2]) }};
+}
+
+CodeMatrix DynamicsCode::multiply(const CodeMatrix& a, const CodeMatrix& b) {
+    CodeMatrix columns = transpose(b);
+    CodeMatrix product;
+    for (int row = 0; row < 3; row++) {
+        product[row] = {{ dot(a[row], columns[0]), dot(a[row], columns[1]), dot(a[row], columns[2]) }};
+    }
+    return product;
+}
+
+CodeVector DynamicsCode::multiply(const CodeMatrix& M, const CodeVector& v) {
+    return {{ dot(M[0], v), dot(M[1], v), dot(M[2], v) }};
+}
+
+CodeMatrix DynamicsCode::scale(const CodeValue& factor, const CodeMatrix& M) {
+    return {{ scale(factor, M[0]), scale(factor, M[1]), scale(factor, M[2]) }};
+}
+
+CodeMatrix DynamicsCode::skew(const CodeVector& r) {
+    CodeValue zero = number(0);
+    return {{ {{ zero, negate(r[2]), r[1] }}, {{ r[2], zero, negate(r[0]) }}, {{ negate(r[1]), r[0], zero }} }};
+}
+
+CodeMatrix DynamicsCode::outer(const CodeVector& a, const CodeVector& b) {
+    return {{ scale(a[0], b), scale(a[1], b), scale(a[2], b) }};
+}
+
+CodeMatrix DynamicsCode::rotate(const CodeLink& link, const CodeMatrix& M, const std::string& name) {
+    // R*M by columns, then the columns of R*(R*M)^T, the rows of R*M*R^T
+    CodeMatrix columns = transpose(M), RM;
+    for (int column = 0; column < 3; column++) {
+        RM[column] = define(name + "_" + std::to_string(column), rotate(link, columns[column]));
+    }
+    CodeMatrix product;
+    for (int row = 0; row < 3; row++) {
+        product[row] = rotate(link, {{ RM[0][row], RM[1][row], RM[2][row] }});
+    }
+    return product;
+}
+
+CodeValue DynamicsCode::define(const std::string& name, const CodeValue& value) {
+    bool identifier = !value.sum && (std::isalpha(value.expr[0]) || value.expr[0] == '_');
+    for (char c : value.expr) {
+        identifier = identifier && (std::isalnum(c) || c == '_');
+    }
+    if (value.constant || identifier) {
+        return value;
+    }
+    m_os << m_indent << "double " << name << " = " << value.expr << ";\n";
+    return symbol(name);
+}
+
+CodeVector DynamicsCode::define(const std::string& name, const CodeVector& value) {
+    return {{ define(name + "_x", value[0]), define(name + "_y", value[1]), define(name + "_z", value[2]) }};
+}
+
+CodeSymmetric DynamicsCode::define(const std::string& name, const CodeSymmetric& value) {
+    return {{ define(name + "_xx", value[0]), define(name + "_yy", value[1]), define(name + "_zz", value[2]),
+              define(name + "_xy", value[3]), define(name + "_xz", value[4]), define(name + "_yz", value[5]) }};
+}
+
+CodeMatrix DynamicsCode::define(const std::string& name, const CodeMatrix& value) {
+    const char* axes = "xyz";
+    CodeMatrix defined;
+    for (int row = 0; row < 3; row++) {
+        for (int column = 0; column < 3; column++) {
+            defined[row][column] = define(name + "_" + axes[row] + axes[column], value[row][column]);
+        }
+    }
+    return defined;
+}
+
+void DynamicsCode::assign(const std::string& target, const CodeValue& value) {
+    m_os << m_indent << target << " = " << value.expr << ";\n";
+}
+
+void DynamicsCode::comment(const std::string& text) {
+    m_os << m_indent << "// " << text << "\n";
+}
+
+void emit_recursive_newton_euler(DynamicsCode& code, const std::vector<CodeLink>& links,
+                                 const CodeVector& gravity, const std::string& tau) {
+    CodeVector zero = DynamicsCode::vector(0, 0, 0);
+    CodeVector w = zero, dw = zero, a = code.scale(DynamicsCode::number(-1), gravity);
+    std::vector<CodeVector> forces (links.size()), moments (links.size());
+
+    for (int index = 0; index < links.size(); index++) {
+        const CodeLink& link = links[index];
+        std::string id = std::to_string(index + 1);
+        code.comment("Link " + id);
+        CodeVector z = code.axis(link), r = code.origin(link);
+        if (link.joint_type == PRISMATIC) {
+            w = code.define("w" + id, code.rotate_transpose(link, w));
+            dw = code.define("dw" + id, code.rotate_transpose(link, dw));
+            a = code.add(code.rotate_transpose(link, code.add(a, {{ DynamicsCode::number(0), DynamicsCode::number(0),
+                                                                    link.q_ddot }})),
+                         code.scale(code.multiply(DynamicsCode::number(2), link.q_dot), code.cross(w, z)));
+        } else {
+            // Revolute joints rotate about the previous z axis; static transforms have no joint velocity
+            CodeVector z0 {{ DynamicsCode::number(0), DynamicsCode::number(0), DynamicsCode::number(1) }};
+            CodeVector dw_joint = code.add(code.scale(link.q_ddot, z0), code.scale(link.q_dot, code.cross(w, z0)));
+            w = code.define("w" + id, code.rotate_transpose(link, code.add(w, code.scale(link.q_dot, z0))));
+            dw = code.define("dw" + id, code.rotate_transpose(link, code.add(dw, dw_joint)));
+            a = code.rotate_transpose(link, a);
+        }
+        a = code.define("a" + id, code.add(a, code.add(code.cross(dw, r), code.cross(w, code.cross(w, r)))));
+
+        // Net force & moment about the center of mass, F = m*a_c & N = I*dw + w x (I*w)
+        CodeVector c = DynamicsCode::vector(link.center_of_mass[0], link.center_of_mass[1], link.center_of_mass[2]);
+        CodeVector a_c = code.add(a, code.add(code.cross(dw, c), code.cross(w, code.cross(w, c))));
+        forces[index] = code.define("F" + id, code.scale(DynamicsCode::number(link.mass), a_c));
+        moments[index] = code.define("N" + id, code.add(code.inertia(link.inertia, dw),
+                                                        code.cross(w, code.inertia(link.inertia, w))));
+    }
+
+    CodeVector f = zero, n = zero;
+    int joint = std::count_if(links.begin(), links.end(), [] (const CodeLink& link) {
+        return link.joint_type != STATIC;
+    });
+    for (int index = links.size() - 1; index >= 0; index--) {
+        const CodeLink& link = links[index];
+        std::string id = std::to_string(index + 1);
+        CodeVector r = code.origin(link);
+        CodeVector c = DynamicsCode::vector(link.center_of_mass[0], link.center_of_mass[1], link.center_of_mass[2]);
+        if (index == links.size() - 1) {
+            code.comment("Backward recursion");
+        }
+        // f_i = R_i+1*f_i+1 + F_i, n_i = R_i+1*n_i+1 + r x R_i+1*f_i+1 + (r + c) x F_i + N_i
+        CodeVector f_next = f, n_next = n;
+        if (index + 1 < links.size()) {
+            f_next = code.rotate(links[index + 1], f);
+            n_next = code.rotate(links[index + 1], n);
+        }
+        f_next = code.define("fr" + id, f_next);
+        f = code.define("f" + id, code.add(f_next, forces[index]));
+        n = code.define("n" + id, code.add(code.add(n_next, code.cross(r, f_next)),
+                                           code.add(code.cross(code.add(r, c), forces[index]), moments[index])));
+        if (link.joint_type != STATIC) {
+            joint--;
+            code.assign(tau + "[" + std::to_string(joint) + "]",
+                        code.dot(code.axis(link), (link.joint_type == PRISMATIC) ? f : n));
+        }
+    }
+}
+
+void emit_composite_rigid_body(DynamicsCode& code, const std::vector<CodeLink>& links,
+                               const CodeVector& gravity, const std::string& M, const std::string& g) {
+    struct Composite {
+        CodeValue mass;
+        CodeVector h;
+        CodeSymmetric I;
+    };
+    CodeValue zero = DynamicsCode::number(0);
+    int joints = std::count_if(links.begin(), links.end(), [] (const CodeLink& link) {
+        return link.joint_type != STATIC;
+    });
+
+    // Gravity in each link's frame
+    std::vector<CodeVector> gravities (links.size());
+    CodeVector frame_gravity = gravity;
+    for (int index = 0; index < links.size(); index++) {
+        frame_gravity = code.define("gravity" + std::to_string(index + 1), code.rotate_transpose(links[index], frame_gravity));
+        gravities[index] = frame_gravity;
+    }
+
+    // Composite inertias, backwards: the link's own inertia about its origin, plus its successor's
+    // composite moved to the successor's joint axis point (this origin) & rotated into this frame
+    std::vector<Composite> composites (links.size());
+    for (int index = links.size() - 1; index >= 0; index--) {
+        const CodeLink& link = links[index];
+        std::string id = std::to_string(index + 1);
+        const double* c = link.center_of_mass;
+        const double* I = link.inertia;
+        double m = link.mass, cc = c[0]*c[0] + c[1]*c[1] + c[2]*c[2];
+        Composite composite {
+            DynamicsCode::number(m),
+            DynamicsCode::vector(m*c[0], m*c[1], m*c[2]),
+            {{ DynamicsCode::number(I[0] + m*(cc - c[0]*c[0])), DynamicsCode::number(I[1] + m*(cc - c[1]*c[1])),
+               DynamicsCode::number(I[2] + m*(cc - c[2]*c[2])), DynamicsCode::number(I[3] - m*c[0]*c[1]),
+               DynamicsCode::number(I[4] - m*c[0]*c[2]), DynamicsCode::number(I[5] - m*c[1]*c[2]) }}
+        };
+        if (index + 1 < links.size()) {
+            const CodeLink& next = links[index + 1];
+            const Composite& child = composites[index + 1];
+            // About the point -r of the successor's frame: I + m*(|r|^2 - r*r^T) + 2*(r.h) - r*h^T - h*r^T
+            CodeVector r = code.origin(next);
+            CodeValue rr = code.dot(r, r), rh = code.multiply(DynamicsCode::number(2), code.dot(r, child.h));
+            auto shifted = [&] (int row, int column) {
+                CodeValue value = code.add(code.multiply(child.mass, code.multiply(r[row], r[column])),
+                                           code.add(code.multiply(r[row], child.h[column]),
+                                                    code.multiply(child.h[row], r[column])));
+                return (row == column) ? code.add(code.add(code.multiply(child.mass, rr), rh), code.negate(value))
+                                       : code.negate(value);
+            };
+            CodeSymmetric I_shifted {{ code.add(child.I[0], shifted(0, 0)), code.add(child.I[1], shifted(1, 1)),
+                                       code.add(child.I[2], shifted(2, 2)), code.add(child.I[3], shifted(0, 1)),
+                                       code.add(child.I[4], shifted(0, 2)), code.add(child.I[5], shifted(1, 2)) }};
+            I_shifted = code.define("Is" + id, I_shifted);
+            CodeVector h = code.rotate(next, code.add(child.h, code.scale(child.mass, r)));
+
+            // R*I*R^T, as R*(R*I)^T
+            std::array<CodeVector, 3> RI;
+            for (int column = 0; column < 3; column++) {
+                CodeVector axis = DynamicsCode::vector(column == 0, column == 1, column == 2);
+                RI[column] = code.define("RI" + id + "_" + std::to_string(column),
+                                         code.rotate(next, code.multiply(I_shifted, axis)));
+            }
+            std::array<CodeVector, 3> RIR;
+            for (int column = 0; column < 3; column++) {
+                RIR[column] = code.rotate(next, {{ RI[0][column], RI[1][column], RI[2][column] }});
+            }
+            composite.mass = code.add(composite.mass, child.mass);
+            composite.h = code.add(composite.h, h);
+            composite.I = {{ code.add(composite.I[0], RIR[0][0]), code.add(composite.I[1], RIR[1][1]),
+                             code.add(composite.I[2], RIR[2][2]), code.add(composite.I[3], RIR[1][0]),
+                             code.add(composite.I[4], RIR[2][0]), code.add(composite.I[5], RIR[2][1]) }};
+        }
+        composites[index] = { composite.mass, code.define("hc" + id, composite.h), code.define("Ic" + id, composite.I) };
+    }
+
+    // Columns of M: the spatial force of joint i's unit acceleration on its composite, about the
+    // joint's axis point (the previous origin), projected onto each joint axis on the way to the base
+    int column = joints;
+    for (int index = links.size() - 1; index >= 0; index--) {
+        const CodeLink& link = links[index];
+        if (link.joint_type == STATIC) {
+            continue;
+        }
+        column--;
+        std::string id = std::to_string(index + 1);
+        const Composite& composite = composites[index];
+        CodeVector z = code.axis(link), r = code.origin(link);
+        CodeVector w = DynamicsCode::vector(0, 0, 0), v = z;
+        if (link.joint_type == REVOLUTE) {
+            w = z;
+            v = code.cross(z, r);
+        }
+        CodeVector f = code.add(code.scale(composite.mass, v), code.cross(w, composite.h));
+        CodeVector n = code.add(code.multiply(composite.I, w), code.cross(composite.h, v));
+
+        // Gravity torque: the moment of the composite's weight, which the joint supports
+        CodeVector weight = code.scale(composite.mass, gravities[index]);
+        CodeValue gravity_torque = (link.joint_type == PRISMATIC) ? code.dot(z, weight) :
+            code.dot(z, code.add(code.cross(composite.h, gravities[index]), code.cross(r, weight)));
+        code.assign(g + "[" + std::to_string(column) + "]", code.negate(gravity_torque));
+
+        int row = column + 1;
+        for (int previous = index; previous >= 0; previous--) {
+            const CodeLink& joint = links[previous];
+            std::string name = id + "_" + std::to_string(previous + 1);
+            if (previous < index) {
+                f = code.rotate(links[previous + 1], f);
+                n = code.rotate(links[previous + 1], n);
+            }
+            f = code.define("fc" + name, f);
+            n = code.define("nc" + name, code.add(n, code.cross(code.origin(joint), f)));
+            if (joint.joint_type == STATIC) {
+                continue;
+            }
+            row--;
+            CodeValue value = code.dot(code.axis(joint), (joint.joint_type == PRISMATIC) ? f : n);
+            std::string entry = M + "[" + std::to_string(row*joints + column) + "]";
+            if (row != column) {
+                entry += " = " + M + "[" + std::to_string(column*joints + row) + "]";
+            }
+            code.assign(entry, value);
+        }
+    }
+}
+
+void emit_articulated_body(DynamicsCode& code, const std::vector<CodeLink>& links,
+                           const CodeVector& gravity, const std::string& tau, const std::string& q_ddot) {
+    struct Motion {
+        CodeVector w, v;
+    };
+    struct Force {
+        CodeVector n, f;
+    };
+    struct Inertia {
+        CodeMatrix A, B, C;  // n = A*w + B*v, f = B^T*w + C*v
+    };
+    struct State {
+        Motion S, c;
+        Inertia I;
+        Force p, U;
+        CodeValue D_inverse, u;
+    };
+    CodeVector zero = DynamicsCode::vector(0, 0, 0);
+    auto force = [&] (const Inertia& I, const Motion& m) -> Force {
+        return { code.add(code.multiply(I.A, m.w), code.multiply(I.B, m.v)),
+                 code.add(code.multiply(code.transpose(I.B), m.w), code.multiply(I.C, m.v)) };
+    };
+    // Motion from the previous frame's origin to this one's, in this frame
+    auto transform = [&] (const CodeLink& link, const Motion& m) -> Motion {
+        CodeVector w = code.rotate_transpose(link, m.w);
+        return { w, code.add(code.rotate_transpose(link, m.v), code.cross(w, code.origin(link))) };
+    };
+    std::vector<State> states (links.size());
+    int joints = std::count_if(links.begin(), links.end(), [] (const CodeLink& link) {
+        return link.joint_type != STATIC;
+    });
+
+    // Velocities, velocity product accelerations c = v x S*q_dot & rigid body bias forces v x* I*v
+    Motion v { zero, zero };
+    for (int index = 0; index < links.size(); index++) {
+        const CodeLink& link = links[index];
+        State& state = states[index];
+        std::string id = std::to_string(index + 1);
+        code.comment("Link " + id);
+        CodeVector z = code.axis(link);
+        state.S = { zero, zero };
+        if (link.joint_type == REVOLUTE) {
+            state.S = { z, code.cross(z, code.origin(link)) };
+        } else if (link.joint_type == PRISMATIC) {
+            state.S = { zero, z };
+        }
+        Motion joint { code.scale(link.q_dot, state.S.w), code.scale(link.q_dot, state.S.v) };
+        v = transform(link, v);
+        v = { code.define("w" + id, code.add(v.w, joint.w)), code.define("v" + id, code.add(v.v, joint.v)) };
+        state.c = { code.define("cw" + id, code.cross(v.w, joint.w)),
+                    code.define("cv" + id, code.add(code.cross(v.w, joint.v), code.cross(v.v, joint.w))) };
+
+        // Spatial inertia about the origin: A = I + m*(|c|^2 - c*c^T), B = m*c x, C = m
+        const double* c = link.center_of_mass;
+        const double* I = link.inertia;
+        double m = link.mass, cc = c[0]*c[0] + c[1]*c[1] + c[2]*c[2];
+        CodeSymmetric A {{ DynamicsCode::number(I[0] + m*(cc - c[0]*c[0])), DynamicsCode::number(I[1] + m*(cc - c[1]*c[1])),
+                           DynamicsCode::number(I[2] + m*(cc - c[2]*c[2])), DynamicsCode::number(I[3] - m*c[0]*c[1]),
+                           DynamicsCode::number(I[4] - m*c[0]*c[2]), DynamicsCode::number(I[5] - m*c[1]*c[2]) }};
+        state.I = { code.matrix(A), code.skew(DynamicsCode::vector(m*c[0], m*c[1], m*c[2])),
+                    code.matrix({{ DynamicsCode::number(m), DynamicsCode::number(m), DynamicsCode::number(m),
+                                   DynamicsCode::number(0), DynamicsCode::number(0), DynamicsCode::number(0) }}) };
+        Force momentum = force(state.I, v);
+        state.p = { code.add(code.cross(v.w, momentum.n), code.cross(v.v, momentum.f)), code.cross(v.w, momentum.f) };
+    }
+
+    // Articulated inertias & bias forces, each link's handed to its predecessor
+    int joint = joints;
+    for (int index = links.size() - 1; index >= 0; index--) {
+        const CodeLink& link = links[index];
+        State& state = states[index];
+        std::string id = std::to_string(index + 1);
+        if (index == links.size() - 1) {
+            code.comment("Articulated inertias");
+        }
+        Inertia I { code.matrix(code.define("Iw" + id, code.symmetric(state.I.A))), code.define("Iwv" + id, state.I.B),
+                    code.matrix(code.define("Iv" + id, code.symmetric(state.I.C))) };
+        Force p { code.define("pn" + id, state.p.n), code.define("pf" + id, state.p.f) };
+        if (link.joint_type != STATIC) {
+            // U = I*S, D = S^T*U, u = tau - S^T*p; the joint's acceleration is then resolved, leaving
+            // I - U*U^T/D & p + I*c + U*u/D to the predecessor
+            joint--;
+            state.U = force(I, state.S);
+            state.U = { code.define("Un" + id, state.U.n), code.define("Uf" + id, state.U.f) };
+            CodeValue D = code.add(code.dot(state.S.w, state.U.n), code.dot(state.S.v, state.U.f));
+            if (D.constant && !(D.value > 0)) {
+                throw std::invalid_argument("Joint " + std::to_string(joint + 1) + " moves no inertia, so the "
+                                            "joint-space inertia is singular & has no forward dynamics");
+            }
+            state.D_inverse = code.define("D" + id + "_inverse", code.divide(DynamicsCode::number(1), D));
+            state.u = code.define("u" + id, code.subtract(DynamicsCode::symbol(tau + "[" + std::to_string(joint) + "]"),
+                code.add(code.dot(state.S.w, p.n), code.dot(state.S.v, p.f))));
+            if (index == 0) {
+                continue;
+            }
+            I.A = code.subtract(I.A, code.scale(state.D_inverse, code.outer(state.U.n, state.U.n)));
+            I.B = code.subtract(I.B, code.scale(state.D_inverse, code.outer(state.U.n, state.U.f)));
+            I.C = code.subtract(I.C, code.scale(state.D_inverse, code.outer(state.U.f, state.U.f)));
+            I = { code.matrix(code.define("Ia" + id + "_w", code.symmetric(I.A))), code.define("Ia" + id + "_wv", I.B),
+                  code.matrix(code.define("Ia" + id + "_v", code.symmetric(I.C))) };
+            CodeValue scaled = code.define("ud" + id, code.multiply(state.u, state.D_inverse));
+            Force Ic = force(I, state.c);
+            p = { code.add(code.add(p.n, Ic.n), code.scale(scaled, state.U.n)),
+                  code.add(code.add(p.f, Ic.f), code.scale(scaled, state.U.f)) };
+        } else if (index == 0) {
+            continue;
+        }
+
+        // To the previous origin, X^T*I*X with the blocks moved by r: A - B*r x + r x*B^T - r x*C*r x,
+        // B + r x*C & C, then rotated into the previous frame; forces n + r x f & f, rotated
+        CodeMatrix r = code.skew(code.origin(link));
+        CodeMatrix rB = code.multiply(r, code.transpose(I.B));
+        CodeMatrix A = code.subtract(code.add(I.A, code.add(rB, code.transpose(rB))), code.multiply(code.multiply(r, I.C), r));
+        CodeMatrix B = code.add(I.B, code.multiply(r, I.C));
+        State& previous = states[index - 1];
+        previous.I.A = code.add(previous.I.A, code.rotate(link, A, "RIw" + id));
+        previous.I.B = code.add(previous.I.B, code.rotate(link, B, "RIwv" + id));
+        previous.I.C = code.add(previous.I.C, code.rotate(link, I.C, "RIv" + id));
+        p = { code.define("pa" + id + "_n", p.n), code.define("pa" + id + "_f", p.f) };
+        previous.p.n = code.add(previous.p.n, code.rotate(link, code.add(p.n, code.cross(code.origin(link), p.f))));
+        previous.p.f = code.add(previous.p.f, code.rotate(link, p.f));
+    }
+
+    // Accelerations, from the base accelerating at -gravity
+    code.comment("Joint accelerations");
+    Motion a { zero, code.scale(DynamicsCode::number(-1), gravity) };
+    joint = 0;
+    for (int index = 0; index < links.size(); index++) {
+        const CodeLink& link = links[index];
+        const State& state = states[index];
+        std::string id = std::to_string(index + 1);
+        a = transform(link, a);
+        a = { code.add(a.w, state.c.w), code.add(a.v, state.c.v) };
+        if (link.joint_type != STATIC) {
+            CodeValue acceleration = code.define("ddq" + id, code.multiply(code.subtract(state.u,
+                code.add(code.dot(state.U.n, a.w), code.dot(state.U.f, a.v))), state.D_inverse));
+            code.assign(q_ddot + "[" + std::to_string(joint++) + "]", acceleration);
+            a = { code.add(a.w, code.scale(acceleration, state.S.w)), code.add(a.v, code.scale(acceleration, state.S.v)) };
+        }
+        if (index + 1 < links.size()) {
+            a = { code.define("aw" + id, a.w), code.define("av" + id, a.v) };
+        }
+    }
+}
+
+void articulated_body(const std::vector<DynamicsLink>& links, const double* gravity,
+                      const double* q, const double* q_dot, const double* tau, double* q_ddot) {
+    // Spatial vectors (angular, linear) at each link's origin in its frame, X the 6x6 motion transform
+    // from the previous link's frame: [R^T, 0; -r x R^T, R^T]
+    struct State {
+        double X[36], S[6], v[6], c[6], I[36], p[6], U[6], D, u;
+        int joint;
+    };
+    auto multiply = [] (const double* M, const double* x, double* out, bool transposed) {
+        for (int row = 0; row < 6; row++) {
+            out[row] = 0;
+            for (int k = 0; k < 6; k++) {
+                out[row] += (transposed ? M[6*k + row] : M[6*row + k])*x[k];
+            }
+        }
+    };
+    auto cross = [] (const double* a, const double* b, double* out) {
+        out[0] = a[1]*b[2] - a[2]*b[1];
+        out[1] = a[2]*b[0] - a[0]*b[2];
+        out[2] = a[0]*b[1] - a[1]*b[0];
+    };
+    // v x m & v x* f
+    auto cross_motion = [&cross] (const double* v, const double* m, double* out) {
+        double term[3];
+        cross(v, m, out);
+        cross(v, m + 3, out + 3);
+        cross(v + 3, m, term);
+        for (int k = 0; k < 3; k++) {
+            out[3 + k] += term[k];
+        }
+    };
+    auto cross_force = [&cross] (const double* v, const double* f, double* out) {
+        double term[3];
+        cross(v, f, out);
+        cross(v + 3, f + 3, term);
+        cross(v, f + 3, out + 3);
+        for (int k = 0; k < 3; k++) {
+            out[k] += term[k];
+        }
+    };
+    std::vector<State> states (links.size());
+
+    int joint = 0;
+    double v_previous[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int index = 0; index < links.size(); index++) {
+        const DynamicsLink& link = links[index];
+        State& state = states[index];
+        double theta = link.theta, d = link.d, velocity = 0;
+        state.joint = -1;
+        if (link.joint_type != STATIC) {
+            (link.joint_type == REVOLUTE ? theta : d) = q[joint];
+            velocity = q_dot[joint];
+            state.joint = joint++;
+        }
+        double c = std::cos(theta), s = std::sin(theta), ca = std::cos(link.alpha), sa = std::sin(link.alpha);
+        double R[9] = { c, -s*ca, s*sa, s, c*ca, -c*sa, 0, sa, ca };
+        double r[3] = { link.a, d*sa, d*ca }, z[3] = { 0, sa, ca };
+        std::fill(state.X, state.X + 36, 0.0);
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++) {
+                state.X[6*row + column] = state.X[6*(row + 3) + column + 3] = R[3*column + row];
+            }
+        }
+        // -r x R^T, column by column
+        for (int column = 0; column < 3; column++) {
+            double Rt[3] = { R[3*column], R[3*column + 1], R[3*column + 2] }, term[3];
+            cross(Rt, r, term);
+            for (int row = 0; row < 3; row++) {
+                state.X[6*(row + 3) + column] = term[row];
+            }
+        }
+        std::fill(state.S, state.S + 6, 0.0);
+        if (link.joint_type == REVOLUTE) {
+            std::copy(z, z + 3, state.S);
+            cross(z, r, state.S + 3);
+        } else if (link.joint_type == PRISMATIC) {
+            std::copy(z, z + 3, state.S + 3);
+        }
+        double joint_motion[6];
+        multiply(state.X, v_previous, state.v, false);
+        for (int k = 0; k < 6; k++) {
+            joint_motion[k] = velocity*state.S[k];
+            state.v[k] += joint_motion[k];
+        }
+        cross_motion(state.v, joint_motion, state.c);
+
+        // Spatial inertia about the origin: [I + m*(|c|^2 - c*c^T), m*c x; -m*c x, m]
+        const double* com = link.center_of_mass;
+        const double* I = link.inertia;
+        double m = link.mass, h[3] = { m*com[0], m*com[1], m*com[2] };
+        double inertia[9] = { I[0], I[3], I[4], I[3], I[1], I[5], I[4], I[5], I[2] };
+        double skew[9] = { 0, -h[2], h[1], h[2], 0, -h[0], -h[1], h[0], 0 };
+        std::fill(state.I, state.I + 36, 0.0);
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++) {
+                state.I[6*row + column] = inertia[3*row + column] + ((row == column) ? m*(com[0]*com[0] + com[1]*com[1] +
+                                                                     com[2]*com[2]) : 0) - m*com[row]*com[column];
+                state.I[6*row + column + 3] = skew[3*row + column];
+                state.I[6*(row + 3) + column] = -skew[3*row + column];
+            }
+            state.I[6*(row + 3) + row + 3] = m;
+        }
+        double momentum[6];
+        multiply(state.I, state.v, momentum, false);
+        cross_force(state.v, momentum, state.p);
+        std::copy(state.v, state.v + 6, v_previous);
+    }
+
+    for (int index = links.size() - 1; index >= 0; index--) {
+        State& state = states[index];
+        double Ia[36], pa[6];
+        std::copy(state.I, state.I + 36, Ia);
+        std::copy(state.p, state.p + 6, pa);
+        if (state.joint >= 0) {
+            multiply(state.I, state.S, state.U, false);
+            state.D = 0;
+            state.u = tau[state.joint];
+            for (int k = 0; k < 6; k++) {
+                state.D += state.S[k]*state.U[k];
+                state.u -= state.S[k]*state.p[k];
+            }
+            if (!(state.D > 0)) {
+                throw std::invalid_argument("Joint " + std::to_string(state.joint + 1) + " moves no inertia, so the "
+                                            "joint-space inertia is singular & has no forward dynamics");
+            }
+            for (int row = 0; row < 6; row++) {
+                for (int column = 0; column < 6; column++) {
+                    Ia[6*row + column] -= state.U[row]*state.U[column]/state.D;
+                }
+            }
+            double Ic[6];
+            multiply(Ia, state.c, Ic, false);
+            for (int k = 0; k < 6; k++) {
+                pa[k] += Ic[k] + state.U[k]*state.u/state.D;
+            }
+        }
+        if (index == 0) {
+            break;
+        }
+        // X^T*Ia*X & X^T*pa to the previous link
+        State& previous = states[index - 1];
+        double IaX[36], column[6], product[6];
+        for (int k = 0; k < 6; k++) {
+            for (int row = 0; row < 6; row++) {
+                column[row] = state.X[6*row + k];
+            }
+            multiply(Ia, column, product, false);
+            for (int row = 0; row < 6; row++) {
+                IaX[6*row + k] = product[row];
+            }
+        }
+        for (int k = 0; k < 6; k++) {
+            for (int row = 0; row < 6; row++) {
+                column[row] = IaX[6*row + k];
+            }
+            multiply(state.X, column, product, true);
+            for (int row = 0; row < 6; row++) {
+                previous.I[6*row + k] += product[row];
+            }
+        }
+        multiply(state.X, pa, product, true);
+        for (int k = 0; k < 6; k++) {
+            previous.p[k] += product[k];
+        }
+    }
+
+    double a_previous[6] = { 0, 0, 0, -gravity[0], -gravity[1], -gravity[2] };
+    for (int index = 0; index < links.size(); index++) {
+        State& state = states[index];
+        double a[6];
+        multiply(state.X, a_previous, a, false);
+        for (int k = 0; k < 6; k++) {
+            a[k] += state.c[k];
+        }
+        if (state.joint >= 0) {
+            double acceleration = state.u;
+            for (int k = 0; k < 6; k++) {
+                acceleration -= state.U[k]*a[k];
+            }
+            acceleration /= state.D;
+            q_ddot[state.joint] = acceleration;
+            for (int k = 0; k < 6; k++) {
+                a[k] += acceleration*state.S[k];
+            }
+        }
+        std::copy(a, a + 6, a_previous);
+    }
+}
+
+void joint_space_dynamics(const std::vector<DynamicsLink>& links, const double* gravity,
+                          const double* q, const double* q_dot, double* M, double* c, double* g) {
+    int joints = std::count_if(links.begin(), links.end(), [] (const DynamicsLink& link) {
+        return link.joint_type != STATIC;
+    });
+    std::vector<double> zero (joints, 0.0), unit (joints, 0.0), column (joints);
+    const double no_gravity[3] = { 0, 0, 0 };
+    recursive_newton_euler(links, gravity, q, zero.data(), zero.data(), g);
+    recursive_newton_euler(links, no_gravity, q, q_dot, zero.data(), c);
+    for (int joint = 0; joint < joints; joint++) {
+        unit[joint] = 1;
+        recursive_newton_euler(links, no_gravity, q, zero.data(), unit.data(), column.data());
+        unit[joint] = 0;
+        for (int row = 0; row < joints; row++) {
+            M[row*joints + joint] = column[row];
+        }
+    }
+}
+
+void recursive_newton_euler(const std::vector<DynamicsLink>& links, const double* gravity,
+                            const double* q, const double* q_dot, const double* q_ddot, double* tau) {
+    struct State {
+        double R[9], r[3], w[3], dw[3], F[3], N[3];
+    };
+    auto cross = [] (const double* a, const double* b, double* out) {
+        double x = a[1]*b[2] - a[2]*b[1], y = a[2]*b[0] - a[0]*b[2], z = a[0]*b[1] - a[1]*b[0];
+        out[0] = x;
+        out[1] = y;
+        out[2] = z;
+    };
+    auto inertia = [] (const double* I, const double* v, double* out) {
+        out[0] = I[0]*v[0] + I[3]*v[1] + I[4]*v[2];
+        out[1] = I[3]*v[0] + I[1]*v[1] + I[5]*v[2];
+        out[2] = I[4]*v[0] + I[5]*v[1] + I[2]*v[2];
+    };
+    std::vector<State> states (links.size());
+    double w[3] = { 0, 0, 0 }, dw[3] = { 0, 0, 0 }, a[3] = { -gravity[0], -gravity[1], -gravity[2] };
+
+    int joint = 0;
+    for (int index = 0; index < links.size(); index++) {
+        const DynamicsLink& link = links[index];
+        State& state = states[index];
+        double theta = link.theta, d = link.d, velocity = 0, acceleration = 0;
+        if (link.joint_type != STATIC) {
+            (link.joint_type == REVOLUTE ? theta : d) = q[joint];
+            velocity = q_dot[joint];
+            acceleration = q_ddot[joint];
+            joint++;
+        }
+        double c = std::cos(theta), s = std::sin(theta), ca = std::cos(link.alpha), sa = std::sin(link.alpha);
+        double R[9] = { c, -s*ca, s*sa, s, c*ca, -c*sa, 0, sa, ca };
+        std::copy(R, R + 9, state.R);
+        state.r[0] = link.a;
+        state.r[1] = d*sa;
+        state.r[2] = d*ca;
+
+        // Previous frame quantities with the joint's contribution, then rotated into this frame by R^T
+        double w_prev[3] = { w[0], w[1], w[2] }, dw_prev[3] = { dw[0], dw[1], dw[2] }, a_prev[3] = { a[0], a[1], a[2] };
+        if (link.joint_type == PRISMATIC) {
+            a_prev[2] += acceleration;
+        } else {
+            dw_prev[0] += velocity*w[1];
+            dw_prev[1] -= velocity*w[0];
+            dw_prev[2] += acceleration;
+            w_prev[2] += velocity;
+        }
+        for (int row = 0; row < 3; row++) {
+            w[row] = R[row]*w_prev[0] + R[3 + row]*w_prev[1] + R[6 + row]*w_prev[2];
+            dw[row] = R[row]*dw_prev[0] + R[3 + row]*dw_prev[1] + R[6 + row]*dw_prev[2];
+            a[row] = R[row]*a_prev[0] + R[3 + row]*a_prev[1] + R[6 + row]*a_prev[2];
+        }
+        double term[3];
+        if (link.joint_type == PRISMATIC) {
+            double z[3] = { 0, sa, ca };
+            cross(w, z, term);
+            for (int row = 0; row < 3; row++) {
+                a[row] += 2*velocity*term[row];
+            }
+        }
+        cross(dw, state.r, term);
+        double wr[3];
+        cross(w, state.r, wr);
+        cross(w, wr, wr);
+        for (int row = 0; row < 3; row++) {
+            a[row] += term[row] + wr[row];
+        }
+
+        double a_c[3], wc[3];
+        cross(dw, link.center_of_mass, term);
+        cross(w, link.center_of_mass, wc);
+        cross(w, wc, wc);
+        for (int row = 0; row < 3; row++) {
+            a_c[row] = a[row] + term[row] + wc[row];
+            state.F[row] = link.mass*a_c[row];
+        }
+        double Iw[3];
+        inertia(link.inertia, dw, state.N);
+        inertia(link.inertia, w, Iw);
+        cross(w, Iw, Iw);
+        for (int row = 0; row < 3; row++) {
+            state.N[row] += Iw[row];
+            state.w[row] = w[row];
+            state.dw[row] = dw[row];
+        }
+    }
+
+    double f[3] = { 0, 0, 0 }, n[3] = { 0, 0, 0 };
+    for (int index = links.size() - 1; index >= 0; index--) {
+        const DynamicsLink& link = links[index];
+        State& state = states[index];
+        double f_next[3] = { f[0], f[1], f[2] }, n_next[3] = { n[0], n[1], n[2] };
+        if (index + 1 < links.size()) {
+            const double* R = states[index + 1].R;
+            for (int row = 0; row < 3; row++) {
+                f_next[row] = R[3*row]*f[0] + R[3*row + 1]*f[1] + R[3*row + 2]*f[2];
+                n_next[row] = R[3*row]*n[0] + R[3*row + 1]*n[1] + R[3*row + 2]*n[2];
+            }
+        }
+        double rc[3] = { state.r[0] + link.center_of_mass[0], state.r[1] + link.center_of_mass[1],
+                         state.r[2] + link.center_of_mass[2] };
+        double term[3], lever[3];
+        cross(state.r, f_next, term);
+        cross(rc, state.F, lever);
+        for (int row = 0; row < 3; row++) {
+            f[row] = f_next[row] + state.F[row];
+            n[row] = n_next[row] + term[row] + lever[row] + state.N[row];
+        }
+        if (link.joint_type != STATIC) {
+            joint--;
+            const double* axis = (link.joint_type == PRISMATIC) ? f : n;
+            tau[joint] = state.R[7]*axis[1] + state.R[8]*axis[2];
+        }
+    }
+}
+
+#endif
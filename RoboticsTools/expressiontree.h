@@ -9,6 +9,11 @@
 #include <regex>
 #include <algorithm>
 #include <set>
+#include <map>
+#include <tuple>
+#include <list>
+#include <sstream>
+#include <iomanip>
 #include "symbolicc++.h"
 
 /////////////////////////////////////////////////
@@ -24,12 +29,33 @@ struct SumExpression {
 class ExpressionTree {
 public:
     ExpressionTree(std::string expr);
+    // Walks a SymbolicC++ expression directly. sin(x) & cos(x) of a symbol become
+    // the factors s_x & c_x, and positive integer powers become repeated factors.
+    ExpressionTree(const Symbolic& expr);
     ~ExpressionTree();
     std::set<std::string> simplify();
 
     SumExpression m_expr;
 };
 
+// Product or sum hoisted out of several expressions into a temporary
+struct Subexpression {
+    std::string name;
+    SumExpression expr;
+};
+
+// Number of multiplications & additions needed to evaluate an expression
+int count_flops(const SumExpression& expr);
+
+// Hoists products of two factors and sums of two terms shared between expressions
+// into temporaries, greedily extracting the most frequent pair first.
+// Returns the temporaries in evaluation order.
+std::vector<Subexpression> eliminate_common_subexpressions(const std::vector<ExpressionTree*>& trees);
+
+// Temporaries needed to evaluate the given trees, in evaluation order
+std::vector<Subexpression> used_subexpressions(const std::vector<Subexpression>& subexpressions,
+                                               const std::vector<ExpressionTree>& trees);
+
 /////////////////////////////////////////////////
 
 std::ostream &operator<<(std::ostream &os, MultiplyExpression const &mult_exp) {
@@ -59,10 +85,32 @@ ExpressionTree::ExpressionTree(std::string expr) {
     MultiplyExpression mult;
     mult.positive = true;
 
+    // Integer powers, printed as "x^(n)", are expanded into n repeated factors when positive & kept
+    // as pow(x,n) otherwise
+    auto add_element = [&] () {
+        size_t power = element.find("^(");
+        if (power != std::string::npos) {
+            std::string exponent = element.substr(power+2, element.size() - power - 3);
+            size_t sign = (exponent[0] == '-') ? 1 : 0;
+            if (exponent.size() == sign || exponent.find_first_not_of("0123456789", sign) != std::string::npos) {
+                throw invalid_argument("Cannot compile non-integer power " + element);
+            }
+            element.erase(power);
+            int count = std::stoi(exponent);
+            if (count <= 0) {
+                element = "pow(" + element + "," + exponent + ")";
+            }
+            for (int i = 1; i < count; i++) {
+                mult.elements.push_back(element);
+            }
+        }
+        mult.elements.push_back(element);
+        element.clear();
+    };
+
     auto add_element_to_tree = [&] () {
         if (element.size()) {
-            mult.elements.push_back(element);
-            element.clear();
+            add_element();
         }
         if (mult.elements.size()) {
             m_expr.elements.push_back(mult);
@@ -70,7 +118,14 @@ ExpressionTree::ExpressionTree(std::string expr) {
         }
     };
 
+    // Signs & products inside parentheses belong to the element, e.g. x^(-1) or cos(q1+q2)
+    int depth = 0;
     for (char c : expr) {
+        if (depth > 0 || c == '(') {
+            depth += (c == '(') - (c == ')');
+            element.append(1,c);
+            continue;
+        }
         switch (c) {
             case '+':
                 add_element_to_tree();
@@ -82,8 +137,7 @@ ExpressionTree::ExpressionTree(std::string expr) {
                 break;
             case '*':
                 if (element.size()) {
-                    mult.elements.push_back(element);
-                    element.clear();
+                    add_element();
                 }
                 break;
             default:
@@ -94,6 +148,92 @@ ExpressionTree::ExpressionTree(std::string expr) {
     add_element_to_tree();
 }
 
+// Shortest decimal representation that reads back as the same double. -0.0 prints as 0.
+static std::string print_number(double value) {
+    if (value == 0) {
+        value = 0;
+    }
+    std::ostringstream stream;
+    for (int precision = 15; precision <= 17; precision++) {
+        stream.str(std::string());
+        stream << std::setprecision(precision) << value;
+        if (std::stod(stream.str()) == value) {
+            break;
+        }
+    }
+    return stream.str();
+}
+
+static std::string print_symbolic(const Symbolic& expr) {
+    std::ostringstream stream;
+    stream << ExpressionTree(expr);
+    return stream.str();
+}
+
+// Appends the factors of a product to mult, folding the sign of numeric factors into it
+static void add_factors(const Symbolic& factor, MultiplyExpression* mult) {
+    if (factor.type() == typeid(Product)) {
+        for (auto sub_factor : CastPtr<const Product>(factor)->factors) {
+            add_factors(sub_factor, mult);
+        }
+    } else if (factor.type() == typeid(Numeric)) {
+        double value = double(factor);
+        if (value < 0) {
+            mult->positive = !mult->positive;
+            value = -value;
+        }
+        if (value != 1) {
+            mult->elements.push_back(print_number(value));
+        }
+    } else if (factor.type() == typeid(Power)) {
+        CastPtr<const Power> power(factor);
+        const Symbolic& base = power->parameters.front();
+        const Symbolic& exponent = power->parameters.back();
+        if (exponent.type() == typeid(Numeric) &&
+            Number<void>(exponent).numerictype() == typeid(int) && int(exponent) > 0) {
+            for (int i = 0; i < int(exponent); i++) {
+                add_factors(base, mult);
+            }
+        } else {
+            mult->elements.push_back("pow(" + print_symbolic(base) + "," + print_symbolic(exponent) + ")");
+        }
+    } else if (factor.type() == typeid(Sin) || factor.type() == typeid(Cos)) {
+        bool sine = (factor.type() == typeid(Sin));
+        const Symbolic& argument = CastPtr<const Symbol>(factor)->parameters.front();
+        if (argument.type() == typeid(Symbol)) {
+            mult->elements.push_back((sine ? "s_" : "c_") + CastPtr<const Symbol>(argument)->name);
+        } else {
+            mult->elements.push_back((sine ? "sin(" : "cos(") + print_symbolic(argument) + ")");
+        }
+    } else if (factor.type() == typeid(Symbol)) {
+        mult->elements.push_back(CastPtr<const Symbol>(factor)->name);
+    } else if (factor.type() == typeid(Sum)) {
+        mult->elements.push_back("(" + print_symbolic(factor) + ")");
+    } else {
+        std::ostringstream stream;
+        stream << factor;
+        throw invalid_argument("Cannot compile expression " + stream.str());
+    }
+}
+
+ExpressionTree::ExpressionTree(const Symbolic& expr) {
+    std::list<Symbolic> terms;
+    if (expr.type() == typeid(Sum)) {
+        terms = CastPtr<const Sum>(expr)->summands;
+    } else {
+        terms.push_back(expr);
+    }
+    for (auto term : terms) {
+        MultiplyExpression mult;
+        mult.positive = true;
+        add_factors(term, &mult);
+        if (mult.elements.empty()) {
+            mult.elements.push_back("1");
+        }
+        m_expr.elements.push_back(mult);
+    }
+}
+
 ExpressionTree::~ExpressionTree() {}
 
 std::set<std::string> ExpressionTree::simplify() {
@@ -231,6 +371,8 @@ std::set<std::string> ExpressionTree::simplify() {
     // Angle-sum difference simplification
     bool simplifying = false;
     do {
+        // Reset each pass, a single remaining term never enters the inner loop
+        simplifying = false;
         for (auto expr1 = m_expr.elements.begin(); expr1 != m_expr.elements.end(); expr1++) {
             std::string scalar1 = get_scalar(*expr1);
             for (auto expr2 = (expr1+1); expr2 != m_expr.elements.end(); expr2++) {
@@ -281,6 +423,193 @@ std::set<std::string> ExpressionTree::simplify() {
     return declared_variables;
 }
 
+int count_flops(const SumExpression& expr) {
+    int flops = 0;
+    for (auto mult_exp : expr.elements) {
+        if (mult_exp.elements.size() > 1) {
+            flops += mult_exp.elements.size() - 1;
+        }
+    }
+    if (expr.elements.size() > 1) {
+        flops += expr.elements.size() - 1;
+    }
+    return flops;
+}
+
+std::vector<Subexpression> eliminate_common_subexpressions(const std::vector<ExpressionTree*>& trees) {
+
+    std::vector<Subexpression> subexpressions;
+
+    auto new_name = [&subexpressions] () {
+        return "t" + std::to_string(subexpressions.size());
+    };
 
+    auto term_key = [](const MultiplyExpression& expr) {
+        std::vector<std::string> factors = expr.elements;
+        std::sort(factors.begin(), factors.end());
+        std::string key;
+        for (auto factor : factors) {
+            key += factor + "*";
+        }
+        return key;
+    };
+
+    // Products: the pair of factors found in the most terms becomes a temporary
+    auto extract_product = [&] () {
+        std::map<std::pair<std::string, std::string>, int> counts;
+        for (auto tree : trees) {
+            for (auto mult_exp : tree->m_expr.elements) {
+                std::set<std::pair<std::string, std::string>> pairs;
+                std::vector<std::string> factors = mult_exp.elements;
+                std::sort(factors.begin(), factors.end());
+                for (int i = 0; i < factors.size(); i++) {
+                    for (int j = i+1; j < factors.size(); j++) {
+                        pairs.insert(std::make_pair(factors[i], factors[j]));
+                    }
+                }
+                for (auto pair : pairs) {
+                    counts[pair]++;
+                }
+            }
+        }
+
+        auto best = counts.end();
+        for (auto count = counts.begin(); count != counts.end(); count++) {
+            if (count->second >= 2 && (best == counts.end() || count->second > best->second)) {
+                best = count;
+            }
+        }
+        if (best == counts.end()) {
+            return false;
+        }
+
+        Subexpression product;
+        product.name = new_name();
+        product.expr.elements.push_back(MultiplyExpression{true, {best->first.first, best->first.second}});
+        subexpressions.push_back(product);
+
+        for (auto tree : trees) {
+            for (auto& mult_exp : tree->m_expr.elements) {
+                auto first = std::find(mult_exp.elements.begin(), mult_exp.elements.end(), best->first.first);
+                if (first == mult_exp.elements.end()) {
+                    continue;
+                }
+                auto second = std::find(first+1, mult_exp.elements.end(), best->first.second);
+                if (second == mult_exp.elements.end()) {
+                    second = std::find(mult_exp.elements.begin(), first, best->first.second);
+                    if (second == first) {
+                        continue;
+                    }
+                }
+                mult_exp.elements.erase(std::max(first, second));
+                mult_exp.elements.erase(std::min(first, second));
+                mult_exp.elements.push_back(product.name);
+            }
+        }
+        return true;
+    };
+
+    // Sums: the pair of terms (with the same relative sign) found in the most
+    // expressions becomes a temporary
+    auto extract_sum = [&] () {
+        std::map<std::tuple<std::string, std::string, bool>, int> counts;
+        for (auto tree : trees) {
+            std::set<std::tuple<std::string, std::string, bool>> pairs;
+            auto& terms = tree->m_expr.elements;
+            for (int i = 0; i < terms.size(); i++) {
+                for (int j = i+1; j < terms.size(); j++) {
+                    std::string key_i = term_key(terms[i]);
+                    std::string key_j = term_key(terms[j]);
+                    if (key_i == key_j) {
+                        continue;
+                    }
+                    pairs.insert(std::make_tuple(std::min(key_i, key_j), std::max(key_i, key_j),
+                                                 terms[i].positive == terms[j].positive));
+                }
+            }
+            for (auto pair : pairs) {
+                counts[pair]++;
+            }
+        }
+
+        auto best = counts.end();
+        for (auto count = counts.begin(); count != counts.end(); count++) {
+            if (count->second >= 2 && (best == counts.end() || count->second > best->second)) {
+                best = count;
+            }
+        }
+        if (best == counts.end()) {
+            return false;
+        }
+
+        std::string key_a = std::get<0>(best->first);
+        std::string key_b = std::get<1>(best->first);
+        bool same_sign = std::get<2>(best->first);
+        Subexpression sum;
+        sum.name = new_name();
+
+        for (auto tree : trees) {
+            auto& terms = tree->m_expr.elements;
+            auto term_a = terms.end();
+            auto term_b = terms.end();
+            for (auto term = terms.begin(); term != terms.end(); term++) {
+                std::string key = term_key(*term);
+                if (key == key_a && term_a == terms.end()) term_a = term;
+                else if (key == key_b && term_b == terms.end()) term_b = term;
+            }
+            if (term_a == terms.end() || term_b == terms.end() ||
+                (term_a->positive == term_b->positive) != same_sign) {
+                continue;
+            }
+            if (sum.expr.elements.empty()) {
+                MultiplyExpression a = *term_a, b = *term_b;
+                b.positive = same_sign;
+                a.positive = true;
+                sum.expr.elements.push_back(a);
+                sum.expr.elements.push_back(b);
+            }
+            MultiplyExpression replacement {term_a->positive, {sum.name}};
+            terms.erase(std::max(term_a, term_b));
+            terms.erase(std::min(term_a, term_b));
+            terms.push_back(replacement);
+        }
+        subexpressions.push_back(sum);
+        return true;
+    };
+
+    bool simplifying = true;
+    while (simplifying) {
+        simplifying = false;
+        while (extract_product()) {
+            simplifying = true;
+        }
+        while (extract_sum()) {
+            simplifying = true;
+        }
+    }
+    return subexpressions;
+}
+
+std::vector<Subexpression> used_subexpressions(const std::vector<Subexpression>& subexpressions,
+                                               const std::vector<ExpressionTree>& trees) {
+    std::set<std::string> used;
+    for (auto tree : trees) {
+        for (auto mult_exp : tree.m_expr.elements) {
+            used.insert(mult_exp.elements.begin(), mult_exp.elements.end());
+        }
+    }
+
+    // Temporaries only depend on earlier temporaries
+    std::vector<Subexpression> retval;
+    for (auto sub = subexpressions.rbegin(); sub != subexpressions.rend(); sub++) {
+        if (used.count(sub->name)) {
+            for (auto mult_exp : sub->expr.elements) {
+                used.insert(mult_exp.elements.begin(), mult_exp.elements.end());
+            }
+            retval.insert(retval.begin(), *sub);
+        }
+    }
+    return retval;
+}
 
 #endif
@@ -0,0 +1,341 @@
+#ifndef INVERSE_KINEMATICS_H
+#define INVERSE_KINEMATICS_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include "arm.h"
+
+// Bounds of the Levenberg-Marquardt damping, which is scaled by 10 per rejected or accepted step
+#define IK_MIN_DAMPING 1e-12
+#define IK_MAX_DAMPING 1e12
+
+/////////////////////////////////////////////////
+
+enum IKMethod {
+    IK_DAMPED_LEAST_SQUARES,  // dq = J^T*(J*J^T + damping^2*I)^-1*e, a fixed damping
+    IK_LEVENBERG_MARQUARDT    // (J^T*J + lambda*I)*dq = J^T*e, lambda adapted to each step's improvement
+};
+
+struct IKOptions {
+    int method = IK_LEVENBERG_MARQUARDT;
+    int max_iterations = 100;  // Per attempt
+    int restarts = 0;          // Attempts from random configurations after the seed fails
+    double tolerance = 1e-10;  // Of |e|, position error & orientation error (angle-axis) stacked
+    double damping = 1e-2;     // Damped least squares damping, initial Levenberg-Marquardt lambda
+    unsigned seed = 1;         // Of the random restarts
+};
+
+struct IKResult {
+    bool converged;
+    int iterations;  // Forward kinematics & Jacobian evaluations, over all attempts
+    int restarts;    // Random restarts used
+    double error;    // Final |e|
+};
+
+// Numerical inverse kinematics over the fused forward kinematics & geometric Jacobian of an
+// Arm::compile(EXPORT_FUSED) library. Scratch buffers are sized on construction, so solve()
+// does not allocate; each thread needs its own solver, which solve_batch() handles.
+class InverseKinematics {
+public:
+    InverseKinematics(const CompiledKinematics& kinematics, const IKOptions& options=IKOptions());
+
+    // Joints are clamped to [lower, upper] after every step, and restarts are drawn from these bounds
+    // ([-pi, pi) per joint without limits)
+    void set_joint_limits(const std::vector<double>& lower, const std::vector<double>& upper);
+
+    // target is a row-major 3x4 pose as written by forward_kinematics(). q[joint_count] is the seed
+    // on entry and the solution (or the best attempt) on return.
+    IKResult solve(const double* target, double* q);
+
+    // count targets (12 each) from seeds q[joint_count*count], solved in place across threads
+    // (the online CPUs when 0). results may be null.
+    void solve_batch(const double* targets, double* q, long count, IKResult* results=nullptr, int threads=0);
+
+    int joint_count() const { return m_joints; }
+    IKOptions m_options;
+
+private:
+    double evaluate(const double* q, const double* target, double* out, double* e);
+    bool step_damped_least_squares();
+    bool step_levenberg_marquardt(const double* target, double* q, double& cost, double& lambda);
+    void clamp(double* q);
+
+    CompiledKinematics::Function m_forward_kinematics_jacobian;
+    int m_joints;
+    std::vector<double> m_lower, m_upper;
+    std::mt19937_64 m_generator;
+
+    // Scratch: pose & Jacobian at the current & trial configurations, their errors, the normal
+    // equations, the step and the best attempt
+    std::vector<double> m_out, m_trial_out, m_error, m_trial_error, m_matrix, m_vector, m_step, m_trial_q, m_best_q;
+};
+
+/////////////////////////////////////////////////
+
+// Solves A*x = b in place (x in b) for a symmetric positive definite n x n A by Cholesky factorization
+static bool cholesky_solve(double* A, double* b, int n) {
+    for (int col = 0; col < n; col++) {
+        double diagonal = A[col*n + col];
+        for (int k = 0; k < col; k++) {
+            diagonal -= A[col*n + k]*A[col*n + k];
+        }
+        if (!(diagonal > 0)) {
+            return false;
+        }
+        diagonal = std::sqrt(diagonal);
+        A[col*n + col] = diagonal;
+        for (int row = col + 1; row < n; row++) {
+            double value = A[row*n + col];
+            for (int k = 0; k < col; k++) {
+                value -= A[row*n + k]*A[col*n + k];
+            }
+            A[row*n + col] = value/diagonal;
+        }
+    }
+    for (int row = 0; row < n; row++) {
+        for (int k = 0; k < row; k++) {
+            b[row] -= A[row*n + k]*b[k];
+        }
+        b[row] /= A[row*n + row];
+    }
+    for (int row = n - 1; row >= 0; row--) {
+        for (int k = row + 1; k < n; k++) {
+            b[row] -= A[k*n + row]*b[k];
+        }
+        b[row] /= A[row*n + row];
+    }
+    return true;
+}
+
+// Pose error of out (row-major 3x4) towards target: the position difference, then the angle-axis
+// vector of target*out^T, both in the base frame like the geometric Jacobian's rows
+static void pose_error(const double* out, const double* target, double* e) {
+    double R[9];
+    for (int r = 0; r < 3; r++) {
+        e[r] = target[4*r + 3] - out[4*r + 3];
+        for (int c = 0; c < 3; c++) {
+            R[3*r + c] = target[4*r]*out[4*c] + target[4*r + 1]*out[4*c + 1] + target[4*r + 2]*out[4*c + 2];
+        }
+    }
+    double v[3] = { (R[7] - R[5])/2, (R[2] - R[6])/2, (R[3] - R[1])/2 };
+    double sine = std::sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]), cosine = (R[0] + R[4] + R[8] - 1)/2;
+    if (cosine > 0 || sine > 1e-6) {
+        // sin(angle)*axis, rescaled to angle*axis
+        double scale = (sine > 1e-12) ? std::atan2(sine, cosine)/sine : 1;
+        for (int row = 0; row < 3; row++) {
+            e[3 + row] = scale*v[row];
+        }
+    } else {
+        // Half turn: the axis from the diagonal of R = 2*axis*axis^T - I, signed by the largest component
+        int largest = (R[0] >= R[4] && R[0] >= R[8]) ? 0 : ((R[4] >= R[8]) ? 1 : 2);
+        double axis[3];
+        axis[largest] = std::sqrt(std::max(0.0, (R[4*largest] + 1)/2));
+        for (int row = 0; row < 3; row++) {
+            if (row != largest) {
+                axis[row] = (R[3*row + largest] + R[3*largest + row])/(4*axis[largest]);
+            }
+        }
+        for (int row = 0; row < 3; row++) {
+            e[3 + row] = M_PI*axis[row];
+        }
+    }
+}
+
+InverseKinematics::InverseKinematics(const CompiledKinematics& kinematics, const IKOptions& options)
+    : m_options(options), m_forward_kinematics_jacobian(kinematics.forward_kinematics_jacobian),
+      m_joints(kinematics.joint_count), m_generator(options.seed) {
+    if (!m_forward_kinematics_jacobian) {
+        throw std::invalid_argument("InverseKinematics needs kinematics compiled with EXPORT_FUSED");
+    }
+    m_out.resize(12 + 6*m_joints);
+    m_trial_out.resize(12 + 6*m_joints);
+    m_error.resize(6);
+    m_trial_error.resize(6);
+    m_matrix.resize(std::max(36, m_joints*m_joints));
+    m_vector.resize(std::max(6, m_joints));
+    m_step.resize(m_joints);
+    m_trial_q.resize(m_joints);
+    m_best_q.resize(m_joints);
+}
+
+void InverseKinematics::set_joint_limits(const std::vector<double>& lower, const std::vector<double>& upper) {
+    if (lower.size() != m_joints || upper.size() != m_joints) {
+        throw std::invalid_argument("Joint limits need one lower & upper bound per joint");
+    }
+    for (int joint = 0; joint < m_joints; joint++) {
+        if (lower[joint] > upper[joint]) {
+            throw std::invalid_argument("Joint lower limit above its upper limit");
+        }
+    }
+    m_lower = lower;
+    m_upper = upper;
+}
+
+void InverseKinematics::clamp(double* q) {
+    if (!m_lower.empty()) {
+        for (int joint = 0; joint < m_joints; joint++) {
+            q[joint] = std::min(m_upper[joint], std::max(m_lower[joint], q[joint]));
+        }
+    }
+}
+
+// Evaluates the pose & Jacobian at q into out, the error into e, and returns the squared error
+double InverseKinematics::evaluate(const double* q, const double* target, double* out, double* e) {
+    m_forward_kinematics_jacobian(q, out);
+    pose_error(out, target, e);
+    double cost = 0;
+    for (int row = 0; row < 6; row++) {
+        cost += e[row]*e[row];
+    }
+    return cost;
+}
+
+// m_step = J^T*(J*J^T + damping^2*I)^-1*e, a 6x6 system whatever the joint count
+bool InverseKinematics::step_damped_least_squares() {
+    const double* J = &m_out[12];
+    double* A = &m_matrix[0];
+    double* y = &m_vector[0];
+    for (int r = 0; r < 6; r++) {
+        for (int c = 0; c <= r; c++) {
+            double value = (r == c) ? m_options.damping*m_options.damping : 0;
+            for (int k = 0; k < m_joints; k++) {
+                value += J[m_joints*r + k]*J[m_joints*c + k];
+            }
+            A[6*r + c] = A[6*c + r] = value;
+        }
+        y[r] = m_error[r];
+    }
+    if (!cholesky_solve(A, y, 6)) {
+        return false;
+    }
+    for (int joint = 0; joint < m_joints; joint++) {
+        m_step[joint] = 0;
+        for (int r = 0; r < 6; r++) {
+            m_step[joint] += J[m_joints*r + joint]*y[r];
+        }
+    }
+    return true;
+}
+
+// Tries (J^T*J + lambda*I)*dq = J^T*e: an improving step is taken & lambda decreased, otherwise
+// lambda is increased towards gradient descent. Returns whether q moved.
+bool InverseKinematics::step_levenberg_marquardt(const double* target, double* q, double& cost, double& lambda) {
+    const double* J = &m_out[12];
+    double* A = &m_matrix[0];
+    for (int r = 0; r < m_joints; r++) {
+        for (int c = 0; c <= r; c++) {
+            double value = (r == c) ? lambda : 0;
+            for (int k = 0; k < 6; k++) {
+                value += J[m_joints*k + r]*J[m_joints*k + c];
+            }
+            A[m_joints*r + c] = A[m_joints*c + r] = value;
+        }
+        m_step[r] = 0;
+        for (int k = 0; k < 6; k++) {
+            m_step[r] += J[m_joints*k + r]*m_error[k];
+        }
+    }
+    if (!cholesky_solve(A, &m_step[0], m_joints)) {
+        lambda = std::min(IK_MAX_DAMPING, lambda*10);
+        return false;
+    }
+    for (int joint = 0; joint < m_joints; joint++) {
+        m_trial_q[joint] = q[joint] + m_step[joint];
+    }
+    clamp(&m_trial_q[0]);
+    double trial_cost = evaluate(&m_trial_q[0], target, &m_trial_out[0], &m_trial_error[0]);
+    if (trial_cost < cost) {
+        std::copy(m_trial_q.begin(), m_trial_q.end(), q);
+        m_out.swap(m_trial_out);
+        m_error.swap(m_trial_error);
+        cost = trial_cost;
+        lambda = std::max(IK_MIN_DAMPING, lambda/10);
+        return true;
+    }
+    lambda = std::min(IK_MAX_DAMPING, lambda*10);
+    return false;
+}
+
+IKResult InverseKinematics::solve(const double* target, double* q) {
+    IKResult result = { false, 0, 0, std::numeric_limits<double>::infinity() };
+    const double tolerance = m_options.tolerance*m_options.tolerance;
+    std::uniform_real_distribution<double> unit (0, 1);
+
+    for (int attempt = 0; attempt <= m_options.restarts; attempt++) {
+        if (attempt > 0) {
+            for (int joint = 0; joint < m_joints; joint++) {
+                q[joint] = m_lower.empty() ? M_PI*(2*unit(m_generator) - 1)
+                                           : m_lower[joint] + (m_upper[joint] - m_lower[joint])*unit(m_generator);
+            }
+            result.restarts++;
+        }
+        clamp(q);
+        double cost = evaluate(q, target, &m_out[0], &m_error[0]);
+        double lambda = m_options.damping;
+        result.iterations++;
+        for (int iteration = 0; iteration < m_options.max_iterations && cost >= tolerance; iteration++) {
+            if (m_options.method == IK_DAMPED_LEAST_SQUARES) {
+                if (!step_damped_least_squares()) {
+                    break;
+                }
+                for (int joint = 0; joint < m_joints; joint++) {
+                    q[joint] += m_step[joint];
+                }
+                clamp(q);
+                cost = evaluate(q, target, &m_out[0], &m_error[0]);
+            } else {
+                step_levenberg_marquardt(target, q, cost, lambda);
+                if (lambda >= IK_MAX_DAMPING) {
+                    break;
+                }
+            }
+            result.iterations++;
+        }
+
+        if (std::sqrt(cost) < result.error) {
+            result.error = std::sqrt(cost);
+            std::copy(q, q + m_joints, m_best_q.begin());
+        }
+        if (cost < tolerance) {
+            result.converged = true;
+            return result;
+        }
+    }
+    std::copy(m_best_q.begin(), m_best_q.end(), q);
+    return result;
+}
+
+void InverseKinematics::solve_batch(const double* targets, double* q, long count, IKResult* results, int threads) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max(1L, std::min<long>(threads, count));
+    // Contiguous ranges per thread, each with its own copy of the solver & its scratch buffers. The
+    // restarts of thread t are seeded with options.seed + t, so results do not depend on scheduling.
+    auto solve_range = [&] (int thread) {
+        InverseKinematics solver (*this);
+        solver.m_generator.seed(m_options.seed + thread);
+        long begin = count*thread/threads, end = count*(thread + 1)/threads;
+        for (long index = begin; index < end; index++) {
+            IKResult result = solver.solve(targets + 12*index, q + m_joints*index);
+            if (results) {
+                results[index] = result;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int thread = 1; thread < threads; thread++) {
+        workers.emplace_back(solve_range, thread);
+    }
+    solve_range(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+#endif
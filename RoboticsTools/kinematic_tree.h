@@ -0,0 +1,308 @@
+#ifndef KINEMATIC_TREE_H
+#define KINEMATIC_TREE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "arm.h"
+
+/////////////////////////////////////////////////
+
+// Transforms attached to named parent frames, e.g. a torso carrying two arms or a palm carrying fingers.
+// Each transform's frame is named by Transform::set_frame() (frame<k> for the k-th transform otherwise)
+// and is attached to its parent frame, or to the base when the parent is empty. Parents come before their
+// children. The end effectors are the frames without children, in transform order, and the joints are
+// ordered as their transforms.
+class KinematicTree {
+public:
+    std::vector<Transform> m_transforms;
+    std::vector<int> m_parents;        // Index of each transform's parent frame, -1 for the base
+    std::vector<int> m_end_effectors;  // Indices of the transforms without children
+    std::vector<Symbolic> m_actuated_joints;
+
+    KinematicTree(const std::vector<Transform>& transforms);
+
+    // The serial chain from the base to an end effector, as exported one Arm per branch
+    Arm branch(int end_effector);
+
+    // Indices of the transforms from the base to an end effector
+    std::vector<int> path(int end_effector);
+
+    int end_effector_count() const { return m_end_effectors.size(); }
+
+    // Export all_frames(q..., frames[12*F]), forward_kinematics(q..., poses[12*E]) of the end effectors &,
+    // with EXPORT_GEOMETRIC_JACOBIAN, geometric_jacobian(q..., jacobian[6*N*E]): a row-major 6xN block per
+    // end effector, linear rows first, with zero columns for the joints off its branch. Every frame is its
+    // parent frame times its link transform, so the trunk is computed once for all branches.
+    // Also supports EXPORT_TRIG_IDENTITIES & EXPORT_SHARED_LIBRARY.
+    void export_expressions(std::string filename, int options=EXPORT_DEFAULT);
+
+    // As Arm::compile(); forward_kinematics writes out[12*E], geometric_jacobian out[6*N*E] &
+    // all_frames out[12*F]
+    CompiledKinematics compile(int options=EXPORT_GEOMETRIC_JACOBIAN, std::string cache_directory="");
+};
+
+/////////////////////////////////////////////////
+
+KinematicTree::KinematicTree(const std::vector<Transform>& transforms) {
+    m_transforms = transforms;
+    std::map<std::string, int> frames;
+    std::set<std::string> joints;
+    std::vector<bool> has_children (transforms.size(), false);
+    for (int index = 0; index < m_transforms.size(); index++) {
+        Transform& T = m_transforms[index];
+        if (T.m_name.empty()) {
+            T.m_name = "frame" + std::to_string(index + 1);
+        }
+        if (frames.count(T.m_name)) {
+            throw std::invalid_argument("Frame " + T.m_name + " is named twice");
+        }
+        int parent = -1;
+        if (!T.m_parent.empty()) {
+            auto found = frames.find(T.m_parent);
+            if (found == frames.end()) {
+                throw std::invalid_argument("Frame " + T.m_name + " is attached to " + T.m_parent +
+                                            ", which is not a preceding frame");
+            }
+            parent = found->second;
+            has_children[parent] = true;
+        }
+        frames[T.m_name] = index;
+        m_parents.push_back(parent);
+
+        if (T.is_actuated()) {
+            if (!joints.insert(T.m_joint_id).second) {
+                throw std::invalid_argument("Joint " + T.m_joint_id + " is used by more than one transform");
+            }
+            m_actuated_joints.push_back(T.get_actuated_joint());
+        }
+    }
+    for (int index = 0; index < m_transforms.size(); index++) {
+        if (!has_children[index]) {
+            m_end_effectors.push_back(index);
+        }
+    }
+}
+
+std::vector<int> KinematicTree::path(int end_effector) {
+    std::vector<int> indices;
+    for (int index = m_end_effectors.at(end_effector); index >= 0; index = m_parents[index]) {
+        indices.insert(indices.begin(), index);
+    }
+    return indices;
+}
+
+Arm KinematicTree::branch(int end_effector) {
+    std::vector<Transform> chain;
+    for (int index : path(end_effector)) {
+        chain.push_back(m_transforms[index]);
+    }
+    return Arm(chain);
+}
+
+void KinematicTree::export_expressions(std::string filename, int options) {
+    const int supported = EXPORT_GEOMETRIC_JACOBIAN | EXPORT_TRIG_IDENTITIES | EXPORT_SHARED_LIBRARY;
+    if (options & ~supported) {
+        throw std::invalid_argument("Kinematic trees support EXPORT_GEOMETRIC_JACOBIAN, EXPORT_TRIG_IDENTITIES "
+                                    "& EXPORT_SHARED_LIBRARY");
+    }
+    bool geometric = options & EXPORT_GEOMETRIC_JACOBIAN;
+    int frame_count = m_transforms.size();
+    int joint_count = m_actuated_joints.size();
+
+    ////////////
+    // Frame products:
+    // Each frame is its parent frame (symbols frame<k>_R11 ...) times its link transform
+    std::cout << "Generating kinematic tree ... " << std::flush;
+    std::set<std::string> variables;
+    std::vector<std::vector<std::string>> frame_expressions;
+    for (int index = 0; index < frame_count; index++) {
+        Symbolic product = m_transforms[index].m_transform;
+        if (m_parents[index] >= 0) {
+            Symbolic parent ("F", 4, 4);
+            for (int entry = 0; entry < 12; entry++) {
+                parent(entry/4, entry % 4) = Symbolic(frame_entry_name(m_parents[index] + 1, entry));
+            }
+            parent(3, 0) = 0;
+            parent(3, 1) = 0;
+            parent(3, 2) = 0;
+            parent(3, 3) = 1;
+            product = parent*product;
+        }
+        frame_expressions.push_back(print_expressions(simplify_expressions(product, &variables), options));
+    }
+    std::cout << "Done\n" << std::flush;
+
+    std::cout << "Exporting to file " << filename << " ... " << std::flush;
+    std::ostringstream outfile;
+    outfile << "#include <math.h>\n";
+    if (options & EXPORT_TRIG_IDENTITIES) {
+        outfile << "#if defined(__GNUC__)\n"
+                << "#define SINCOS(x, s, c) __builtin_sincos(x, s, c)\n"
+                << "#else\n"
+                << "#define SINCOS(x, s, c) (*(s) = sin(x), *(c) = cos(x))\n"
+                << "#endif\n";
+    }
+
+    auto begin_function = [&] (const std::string& function, const std::string& output) {
+        outfile << function_prefix(options) << "void " << function << "(";
+        emit_joint_arguments(outfile, m_actuated_joints, options);
+        outfile << ", double " << output << ") {\n";
+        emit_trigonometry(outfile, m_actuated_joints, variables, {}, "    ", options);
+        for (int frame = 0; frame < frame_count; frame++) {
+            for (int entry = 0; entry < 12; entry++) {
+                outfile << "    double " << frame_entry_name(frame + 1, entry)
+                        << " = " << frame_expressions[frame][entry] << ";\n";
+            }
+        }
+    };
+
+    ////////////
+    // Compile Frames:
+    // Frame k is row-major 3x4 at frames[12*k], the pose of end effector e at poses[12*e]
+    begin_function("all_frames", "frames[" + std::to_string(12*frame_count) + "]");
+    for (int frame = 0; frame < frame_count; frame++) {
+        for (int entry = 0; entry < 12; entry++) {
+            outfile << "    frames[" << 12*frame + entry << "] = " << frame_entry_name(frame + 1, entry) << ";\n";
+        }
+    }
+    outfile << "}\n";
+
+    begin_function("forward_kinematics", "poses[" + std::to_string(12*end_effector_count()) + "]");
+    for (int effector = 0; effector < end_effector_count(); effector++) {
+        for (int entry = 0; entry < 12; entry++) {
+            outfile << "    poses[" << 12*effector + entry << "] = "
+                    << frame_entry_name(m_end_effectors[effector] + 1, entry) << ";\n";
+        }
+    }
+    outfile << "}\n";
+
+    ////////////
+    // Compile Geometric Jacobian:
+    // The column of a joint is built from the axis z & origin o of its parent frame, (0, 0, 1) & 0 for the
+    // base: z x (p - o) & z when revolute, z & 0 when prismatic, with p the end effector position
+    if (geometric) {
+        begin_function("geometric_jacobian", "jacobian[" + std::to_string(6*joint_count*end_effector_count()) + "]");
+        DynamicsCode code (outfile);
+        for (int effector = 0; effector < end_effector_count(); effector++) {
+            std::vector<int> chain = path(effector);
+            int end = m_end_effectors[effector] + 1;
+            CodeVector p { DynamicsCode::symbol(frame_entry_name(end, 3)), DynamicsCode::symbol(frame_entry_name(end, 7)),
+                           DynamicsCode::symbol(frame_entry_name(end, 11)) };
+            int column = 0;
+            for (int index = 0; index < frame_count; index++) {
+                Transform& T = m_transforms[index];
+                if (!T.is_actuated()) {
+                    continue;
+                }
+                CodeVector z = DynamicsCode::vector(0, 0, 1), o = DynamicsCode::vector(0, 0, 0);
+                if (m_parents[index] >= 0) {
+                    int parent = m_parents[index] + 1;
+                    for (int row = 0; row < 3; row++) {
+                        z[row] = DynamicsCode::symbol(frame_entry_name(parent, 4*row + 2));
+                        o[row] = DynamicsCode::symbol(frame_entry_name(parent, 4*row + 3));
+                    }
+                }
+                CodeVector linear = z, angular = DynamicsCode::vector(0, 0, 0);
+                if (std::find(chain.begin(), chain.end(), index) == chain.end()) {
+                    linear = angular;
+                } else if (T.m_joint_type == REVOLUTE) {
+                    linear = code.cross(z, code.subtract(p, o));
+                    angular = z;
+                }
+                int offset = 6*joint_count*effector + column;
+                for (int row = 0; row < 3; row++) {
+                    code.assign("jacobian[" + std::to_string(offset + row*joint_count) + "]", linear[row]);
+                }
+                for (int row = 0; row < 3; row++) {
+                    code.assign("jacobian[" + std::to_string(offset + (row + 3)*joint_count) + "]", angular[row]);
+                }
+                column++;
+            }
+        }
+        outfile << "}\n";
+    }
+
+    if (options & EXPORT_SHARED_LIBRARY) {
+        std::ostringstream joint_values;
+        for (int index = 0; index < joint_count; index++) {
+            joint_values << "q[" << index << "], ";
+        }
+        auto emit_entry_point = [&] (const std::string& function) {
+            outfile << "extern \"C\" void kinematics_" << function << "(const double* q, double* out) {\n"
+                    << "    " << function << "(" << joint_values.str() << "out);\n"
+                    << "}\n";
+        };
+        outfile << "extern \"C\" int kinematics_joint_count() {\n"
+                << "    return " << joint_count << ";\n"
+                << "}\n"
+                << "extern \"C\" int kinematics_end_effector_count() {\n"
+                << "    return " << end_effector_count() << ";\n"
+                << "}\n";
+        emit_entry_point("forward_kinematics");
+        emit_entry_point("all_frames");
+        if (geometric) {
+            emit_entry_point("geometric_jacobian");
+        }
+    }
+
+    std::ofstream file (filename, std::ofstream::binary);
+    file << outfile.str();
+    std::cout << "Done\n" << std::flush;
+}
+
+CompiledKinematics KinematicTree::compile(int options, std::string cache_directory) {
+    options |= EXPORT_SHARED_LIBRARY;
+    cache_directory = compile_cache_directory(cache_directory);
+    std::string compiler = compiler_command();
+
+    std::ostringstream key;
+    key << compiler << "\n" << host_cpu() << "\n" << options << "\n" << transforms_key(m_transforms);
+    for (int index = 0; index < m_transforms.size(); index++) {
+        key << m_parents[index] << " ";
+    }
+    std::string name = cache_directory + "/kinematics_tree_" + hash_string(key.str());
+    std::string library = name + ".so";
+
+    if (access(library.c_str(), F_OK) == 0) {
+        std::cout << "Loading cached kinematics " << library << "\n" << std::flush;
+    } else {
+        // A per-process source, so a concurrent compile of the same tree never rewrites it mid-build
+        std::string source = name + "." + std::to_string(getpid()) + ".cpp";
+        try {
+            export_expressions(source, options);
+            std::cout << "Compiling kinematics " << library << " ... " << std::flush;
+            build_library(compiler, source, library);
+        } catch (...) {
+            std::remove(source.c_str());
+            throw;
+        }
+        std::remove(source.c_str());
+        std::cout << "Done\n" << std::flush;
+    }
+
+    CompiledKinematics kinematics = CompiledKinematics();
+    kinematics.library = library;
+    kinematics.handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!kinematics.handle) {
+        throw std::runtime_error("Failed to load kinematics: " + std::string(dlerror()));
+    }
+    auto symbol = [&kinematics] (const char* function) {
+        return reinterpret_cast<CompiledKinematics::Function>(dlsym(kinematics.handle, function));
+    };
+    kinematics.forward_kinematics = symbol("kinematics_forward_kinematics");
+    kinematics.geometric_jacobian = symbol("kinematics_geometric_jacobian");
+    kinematics.all_frames = symbol("kinematics_all_frames");
+    auto joint_count = reinterpret_cast<int (*)()>(dlsym(kinematics.handle, "kinematics_joint_count"));
+    auto end_effector_count = reinterpret_cast<int (*)()>(dlsym(kinematics.handle, "kinematics_end_effector_count"));
+    if (!kinematics.forward_kinematics || !joint_count || !end_effector_count) {
+        throw std::runtime_error("Invalid kinematics library " + library);
+    }
+    kinematics.joint_count = joint_count();
+    kinematics.end_effector_count = end_effector_count();
+    kinematics.frame_count = m_transforms.size();
+    return kinematics;
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include "arm.h"
+
+/////////////////////////////////////////////////
+
+enum Integrator {
+    INTEGRATOR_RK4,                 // Classical fourth order Runge-Kutta, four dynamics evaluations per step
+    INTEGRATOR_SEMI_IMPLICIT_EULER  // q_dot += h*q_ddot, then q += h*q_dot, one evaluation per step
+};
+
+// Joint accelerations q_ddot[N] from q, q_dot & tau[N]
+typedef std::function<void(const double* q, const double* q_dot, const double* tau, double* q_ddot)> ForwardDynamics;
+
+// Joint torques tau[N] of a rollout at time, sampled once per step & held over it. Called concurrently
+// from the threads of Simulator::rollouts().
+typedef std::function<void(long rollout, double time, const double* q, const double* q_dot, double* tau)> Controller;
+
+struct SimulationOptions {
+    int integrator = INTEGRATOR_RK4;
+    double time_step = 1e-3;  // Fixed step, seconds
+    double duration = 1;      // Simulated seconds per rollout
+};
+
+struct SimulationReport {
+    long rollouts;
+    long steps;                // Over all rollouts
+    int threads;
+    double simulated_seconds;  // Over all rollouts
+    double wall_seconds;
+    double realtime_factor;    // Simulated seconds per wall second
+};
+
+// Fixed step forward dynamics simulation, driven by the generated articulated-body algorithm of an
+// Arm::compile(EXPORT_FORWARD_DYNAMICS) library or by any ForwardDynamics. Scratch buffers are sized
+// on construction, so stepping does not allocate; each thread needs its own simulator, which
+// rollouts() handles.
+class Simulator {
+public:
+    Simulator(const CompiledKinematics& dynamics, const SimulationOptions& options=SimulationOptions());
+    // e.g. the runtime articulated_body() over Arm::dynamics_links()
+    Simulator(const ForwardDynamics& dynamics, int joints, const SimulationOptions& options=SimulationOptions());
+
+    // Advances (q, q_dot) in place by one time step under the torques tau
+    void step(double* q, double* q_dot, const double* tau);
+
+    // Advances (q, q_dot) in place over options.duration, with the torques of controller (zero
+    // without one); returns the steps taken
+    long simulate(double* q, double* q_dot, const Controller& controller=Controller(), long rollout=0);
+
+    // count independent rollouts from q & q_dot[joint_count*count], simulated in place across threads
+    // (the online CPUs when 0)
+    SimulationReport rollouts(double* q, double* q_dot, long count, const Controller& controller=Controller(),
+                              int threads=0);
+
+    int joint_count() const { return m_joints; }
+    SimulationOptions m_options;
+
+private:
+    ForwardDynamics m_dynamics;
+    int m_joints;
+
+    // Scratch: the torques, the Runge-Kutta slopes of q & q_dot and the intermediate state
+    std::vector<double> m_tau, m_dq, m_ddq, m_q, m_q_dot;
+};
+
+/////////////////////////////////////////////////
+
+Simulator::Simulator(const CompiledKinematics& dynamics, const SimulationOptions& options) :
+    Simulator(ForwardDynamics(dynamics.forward_dynamics), dynamics.joint_count, options) {
+    if (!dynamics.forward_dynamics) {
+        throw std::invalid_argument("Simulation needs forward_dynamics(), compile with EXPORT_FORWARD_DYNAMICS");
+    }
+}
+
+Simulator::Simulator(const ForwardDynamics& dynamics, int joints, const SimulationOptions& options) :
+    m_options(options), m_dynamics(dynamics), m_joints(joints),
+    m_tau(joints), m_dq(4*joints), m_ddq(4*joints), m_q(joints), m_q_dot(joints) {
+    if (!(options.time_step > 0) || options.duration < 0) {
+        throw std::invalid_argument("Simulation needs a positive time step & a duration");
+    }
+}
+
+void Simulator::step(double* q, double* q_dot, const double* tau) {
+    const double h = m_options.time_step;
+    const int n = m_joints;
+    if (m_options.integrator == INTEGRATOR_SEMI_IMPLICIT_EULER) {
+        m_dynamics(q, q_dot, tau, m_ddq.data());
+        for (int joint = 0; joint < n; joint++) {
+            q_dot[joint] += h*m_ddq[joint];
+            q[joint] += h*q_dot[joint];
+        }
+        return;
+    }
+
+    // Slopes k1..k4 of (q, q_dot) at the start, twice at the midpoint & at the end of the step
+    static const double fractions[3] = { 0.5, 0.5, 1 };
+    std::copy(q_dot, q_dot + n, m_dq.begin());
+    m_dynamics(q, q_dot, tau, m_ddq.data());
+    for (int stage = 1; stage < 4; stage++) {
+        const double* dq = &m_dq[(stage - 1)*n];
+        const double* ddq = &m_ddq[(stage - 1)*n];
+        for (int joint = 0; joint < n; joint++) {
+            m_q[joint] = q[joint] + fractions[stage - 1]*h*dq[joint];
+            m_q_dot[joint] = q_dot[joint] + fractions[stage - 1]*h*ddq[joint];
+        }
+        std::copy(m_q_dot.begin(), m_q_dot.end(), m_dq.begin() + stage*n);
+        m_dynamics(m_q.data(), m_q_dot.data(), tau, &m_ddq[stage*n]);
+    }
+    for (int joint = 0; joint < n; joint++) {
+        q[joint] += h/6*(m_dq[joint] + 2*m_dq[n + joint] + 2*m_dq[2*n + joint] + m_dq[3*n + joint]);
+        q_dot[joint] += h/6*(m_ddq[joint] + 2*m_ddq[n + joint] + 2*m_ddq[2*n + joint] + m_ddq[3*n + joint]);
+    }
+}
+
+long Simulator::simulate(double* q, double* q_dot, const Controller& controller, long rollout) {
+    // The step count is rounded, so a duration of whole steps does not lose one to rounding
+    long steps = std::lround(m_options.duration/m_options.time_step);
+    std::fill(m_tau.begin(), m_tau.end(), 0.0);
+    for (long index = 0; index < steps; index++) {
+        if (controller) {
+            controller(rollout, index*m_options.time_step, q, q_dot, m_tau.data());
+        }
+        step(q, q_dot, m_tau.data());
+    }
+    return steps;
+}
+
+SimulationReport Simulator::rollouts(double* q, double* q_dot, long count, const Controller& controller, int threads) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max(1L, std::min<long>(threads, count));
+    auto start = std::chrono::steady_clock::now();
+
+    // Contiguous ranges of rollouts per thread, each with its own copy of the simulator
+    std::vector<long> steps (threads, 0);
+    auto simulate_range = [&] (int thread) {
+        Simulator simulator (*this);
+        long begin = count*thread/threads, end = count*(thread + 1)/threads;
+        for (long rollout = begin; rollout < end; rollout++) {
+            steps[thread] += simulator.simulate(q + m_joints*rollout, q_dot + m_joints*rollout, controller, rollout);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int thread = 1; thread < threads; thread++) {
+        workers.emplace_back(simulate_range, thread);
+    }
+    simulate_range(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    SimulationReport report;
+    report.rollouts = count;
+    report.threads = threads;
+    report.steps = 0;
+    for (long thread_steps : steps) {
+        report.steps += thread_steps;
+    }
+    report.simulated_seconds = report.steps*m_options.time_step;
+    report.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report.realtime_factor = (report.wall_seconds > 0) ? report.simulated_seconds/report.wall_seconds : 0;
+    return report;
+}
+
+#endif
@@ -0,0 +1,430 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include <stdexcept>
+#include "expressiontree.h"
+
+// Number of configurations a batch evaluation steps through each instruction at once
+#define TAPE_LANES 64
+
+/////////////////////////////////////////////////
+
+// Register machine instructions. Registers hold doubles; constants occupy the first
+// registers of the file and are never overwritten.
+enum TapeOp {
+    TAPE_LOAD,   // r[dst] = q[a]
+    TAPE_SINCOS, // r[dst] = sin(r[a]), r[b] = cos(r[a])
+    TAPE_MUL,    // r[dst] = r[a]*r[b]
+    TAPE_ADD,    // r[dst] = r[a] + r[b]
+    TAPE_SUB,    // r[dst] = r[a] - r[b]
+    TAPE_NEG,    // r[dst] = -r[a]
+    TAPE_FMA,    // r[dst] = r[a]*r[b] + r[c]
+    TAPE_FMS,    // r[dst] = r[a]*r[b] - r[c]
+    TAPE_FNMA,   // r[dst] = r[c] - r[a]*r[b]
+    TAPE_STORE   // out[dst] = r[a]
+};
+
+struct TapeInstruction {
+    int op, dst, a, b, c;
+};
+
+// Evaluates simplified kinematics expressions without a compiler, by interpreting a flat
+// instruction tape. Sines & cosines of compound angles such as c_q1_q3 are derived from
+// one sincos per joint, and temporaries from common subexpression elimination are
+// evaluated once. Registers are reused once their value is dead.
+class KinematicsTape {
+public:
+    // joints: joint names in input order, outputs: one tree per output entry
+    KinematicsTape(const std::vector<std::string>& joints, const std::vector<ExpressionTree>& outputs,
+                   const std::vector<Subexpression>& temporaries);
+    ~KinematicsTape();
+
+    // out[output_count()] for one configuration q[joint_count()].
+    // Uses scratch registers of the tape, so each thread needs its own copy.
+    void evaluate(const double* q, double* out);
+
+    // count configurations, structure-of-arrays: joint j of configuration i is q[j*count + i],
+    // output entry e of configuration i is written to out[e*count + i]
+    void evaluate_batch(const double* q, int count, double* out);
+
+    int joint_count() const { return m_joint_count; }
+    int output_count() const { return m_output_count; }
+    int register_count() const { return m_register_count; }
+    const std::vector<TapeInstruction>& instructions() const { return m_tape; }
+
+private:
+    int constant(double value);
+    int emit(int op, int a, int b=-1, int c=-1);
+    int lower_token(const std::string& token);
+    int lower_sum(const SumExpression& expr);
+    void allocate_registers();
+
+    int m_joint_count, m_output_count, m_register_count;
+    std::vector<double> m_constants;
+    std::vector<TapeInstruction> m_tape;
+    std::vector<double> m_registers;
+    std::vector<double> m_batch_registers;
+
+    // Lowering state: virtual registers of constants, joint sines & cosines and named values
+    std::map<double, int> m_constant_registers;
+    std::map<std::string, int> m_named_registers;
+    std::map<std::string, const Subexpression*> m_temporaries;
+    int m_virtual_count;
+};
+
+/////////////////////////////////////////////////
+
+KinematicsTape::KinematicsTape(const std::vector<std::string>& joints,
+                               const std::vector<ExpressionTree>& outputs,
+                               const std::vector<Subexpression>& temporaries)
+    : m_joint_count(joints.size()), m_output_count(outputs.size()), m_register_count(0),
+      m_virtual_count(0) {
+    for (auto& temp : temporaries) {
+        m_temporaries[temp.name] = &temp;
+    }
+    for (int index = 0; index < m_joint_count; index++) {
+        int joint = emit(TAPE_LOAD, index);
+        int sine = emit(TAPE_SINCOS, joint);
+        m_tape.back().b = m_virtual_count++;
+        m_named_registers[joints[index]] = joint;
+        m_named_registers["s_" + joints[index]] = sine;
+        m_named_registers["c_" + joints[index]] = m_tape.back().b;
+    }
+    for (int entry = 0; entry < m_output_count; entry++) {
+        int value = lower_sum(outputs[entry].m_expr);
+        m_tape.push_back({TAPE_STORE, entry, value, -1, -1});
+    }
+    m_constant_registers.clear();
+    m_named_registers.clear();
+    m_temporaries.clear();
+    allocate_registers();
+}
+
+KinematicsTape::~KinematicsTape() {}
+
+// Constants are virtual registers numbered from -2 downwards until registers are allocated
+int KinematicsTape::constant(double value) {
+    auto found = m_constant_registers.find(value);
+    if (found != m_constant_registers.end()) {
+        return found->second;
+    }
+    m_constants.push_back(value);
+    int reg = -1 - int(m_constants.size());
+    m_constant_registers[value] = reg;
+    return reg;
+}
+
+int KinematicsTape::emit(int op, int a, int b, int c) {
+    m_tape.push_back({op, m_virtual_count, a, b, c});
+    return m_virtual_count++;
+}
+
+int KinematicsTape::lower_token(const std::string& token) {
+    auto found = m_named_registers.find(token);
+    if (found != m_named_registers.end()) {
+        return found->second;
+    }
+
+    int reg;
+    auto temp = m_temporaries.find(token);
+    std::vector<std::string> terms;
+    for (size_t start = 0, end = 0; end != std::string::npos; start = end + 1) {
+        end = token.find('_', start);
+        terms.push_back(token.substr(start, end - start));
+    }
+    if (temp != m_temporaries.end()) {
+        reg = lower_sum(temp->second->expr);
+    } else if (token.size() > 2 && token.front() == '(' && token.back() == ')') {
+        reg = lower_sum(ExpressionTree(token.substr(1, token.size() - 2)).m_expr);
+    } else if (terms.size() > 2 && (terms[0] == "c" || terms[0] == "s")) {
+        // Compound angle a+b of ExpressionTree::simplify, from the angle-sum identities
+        std::string a = terms[1], b = "_" + terms.back();
+        for (int index = 2; index < terms.size() - 1; index++) {
+            a += "_" + terms[index];
+        }
+        int ca = lower_token("c_" + a), sa = lower_token("s_" + a);
+        int cb = lower_token("c" + b), sb = lower_token("s" + b);
+        if (terms[0] == "c") {
+            // cos(a+b) == cos(a)cos(b) - sin(a)sin(b)
+            reg = emit(TAPE_FMS, ca, cb, emit(TAPE_MUL, sa, sb));
+        } else {
+            // sin(a+b) == sin(a)cos(b) + cos(a)sin(b)
+            reg = emit(TAPE_FMA, sa, cb, emit(TAPE_MUL, ca, sb));
+        }
+    } else {
+        throw std::invalid_argument("Cannot lower expression token " + token);
+    }
+    m_named_registers[token] = reg;
+    return reg;
+}
+
+// Accumulates the terms of a sum, multiplying the last factor of each term into the
+// running sum with a fused multiply-add
+int KinematicsTape::lower_sum(const SumExpression& expr) {
+    int sum = 0;
+    bool empty = true;
+    for (auto& term : expr.elements) {
+        double coefficient = term.positive ? 1 : -1;
+        std::vector<int> factors;
+        for (auto& element : term.elements) {
+            // Numeric factors, signed ones included (e.g. -0)
+            size_t sign = (element[0] == '-' || element[0] == '+') ? 1 : 0;
+            if (element.size() > sign && (std::isdigit(element[sign]) || element[sign] == '.')) {
+                coefficient *= std::stod(element);
+            } else {
+                factors.push_back(lower_token(element));
+            }
+        }
+        if (coefficient == 0) {
+            continue;
+        }
+        if (std::fabs(coefficient) != 1 || factors.empty()) {
+            factors.push_back(constant(std::fabs(coefficient)));
+        }
+        bool negative = coefficient < 0;
+
+        int product = factors.front();
+        for (int index = 1; index + 1 < factors.size(); index++) {
+            product = emit(TAPE_MUL, product, factors[index]);
+        }
+        if (factors.size() == 1) {
+            if (empty) {
+                sum = negative ? emit(TAPE_NEG, product) : product;
+            } else {
+                sum = emit(negative ? TAPE_SUB : TAPE_ADD, sum, product);
+            }
+        } else if (empty) {
+            sum = emit(TAPE_MUL, product, factors.back());
+            if (negative) {
+                sum = emit(TAPE_NEG, sum);
+            }
+        } else {
+            sum = emit(negative ? TAPE_FNMA : TAPE_FMA, product, factors.back(), sum);
+        }
+        empty = false;
+    }
+    return empty ? constant(0) : sum;
+}
+
+// Removes dead instructions & maps virtual registers onto a register file, constants first,
+// reusing a register as soon as the last instruction reading its value has executed
+void KinematicsTape::allocate_registers() {
+    auto sources = [] (TapeInstruction& inst) {
+        std::vector<int*> regs;
+        if (inst.op == TAPE_LOAD) {
+            return regs;
+        }
+        regs.push_back(&inst.a);
+        if (inst.op == TAPE_MUL || inst.op == TAPE_ADD || inst.op == TAPE_SUB ||
+            inst.op == TAPE_FMA || inst.op == TAPE_FMS || inst.op == TAPE_FNMA) {
+            regs.push_back(&inst.b);
+        }
+        if (inst.op == TAPE_FMA || inst.op == TAPE_FMS || inst.op == TAPE_FNMA) {
+            regs.push_back(&inst.c);
+        }
+        return regs;
+    };
+
+    // Liveness, backwards from the stores
+    std::vector<bool> live (m_virtual_count, false);
+    std::vector<TapeInstruction> tape;
+    for (int index = m_tape.size() - 1; index >= 0; index--) {
+        TapeInstruction inst = m_tape[index];
+        bool needed = (inst.op == TAPE_STORE) || live[inst.dst] ||
+                      (inst.op == TAPE_SINCOS && live[inst.b]);
+        if (!needed) {
+            continue;
+        }
+        for (int* reg : sources(inst)) {
+            if (*reg >= 0) {
+                live[*reg] = true;
+            }
+        }
+        tape.push_back(inst);
+    }
+    std::reverse(tape.begin(), tape.end());
+
+    std::vector<int> last_use (m_virtual_count, -1);
+    for (int index = 0; index < tape.size(); index++) {
+        for (int* reg : sources(tape[index])) {
+            if (*reg >= 0) {
+                last_use[*reg] = index;
+            }
+        }
+    }
+
+    int constants = m_constants.size();
+    m_register_count = constants;
+    std::vector<int> physical (m_virtual_count, -1);
+    std::vector<int> free_registers;
+    auto allocate = [&] (int* reg, int index) {
+        int assigned;
+        if (!free_registers.empty()) {
+            assigned = free_registers.back();
+            free_registers.pop_back();
+        } else {
+            assigned = m_register_count++;
+        }
+        physical[*reg] = assigned;
+        if (last_use[*reg] < index) {
+            free_registers.push_back(assigned);
+        }
+        *reg = assigned;
+    };
+    for (int index = 0; index < tape.size(); index++) {
+        TapeInstruction& inst = tape[index];
+        for (int* reg : sources(inst)) {
+            int virtual_reg = *reg;
+            *reg = (virtual_reg < 0) ? (-2 - virtual_reg) : physical[virtual_reg];
+            if (virtual_reg >= 0 && last_use[virtual_reg] == index) {
+                free_registers.push_back(*reg);
+            }
+        }
+        if (inst.op != TAPE_STORE) {
+            allocate(&inst.dst, index);
+        }
+        if (inst.op == TAPE_SINCOS) {
+            allocate(&inst.b, index);
+        }
+    }
+    m_tape = tape;
+
+    m_registers.assign(m_register_count, 0);
+    m_batch_registers.assign(m_register_count*TAPE_LANES, 0);
+    for (int reg = 0; reg < constants; reg++) {
+        m_registers[reg] = m_constants[reg];
+        for (int lane = 0; lane < TAPE_LANES; lane++) {
+            m_batch_registers[reg*TAPE_LANES + lane] = m_constants[reg];
+        }
+    }
+}
+
+void KinematicsTape::evaluate(const double* q, double* out) {
+    double* r = m_registers.data();
+    for (const TapeInstruction& inst : m_tape) {
+        switch (inst.op) {
+            case TAPE_LOAD:   r[inst.dst] = q[inst.a]; break;
+            case TAPE_SINCOS: {
+                double x = r[inst.a];
+                r[inst.dst] = std::sin(x);
+                r[inst.b] = std::cos(x);
+                break;
+            }
+            case TAPE_MUL:    r[inst.dst] = r[inst.a]*r[inst.b]; break;
+            case TAPE_ADD:    r[inst.dst] = r[inst.a] + r[inst.b]; break;
+            case TAPE_SUB:    r[inst.dst] = r[inst.a] - r[inst.b]; break;
+            case TAPE_NEG:    r[inst.dst] = -r[inst.a]; break;
+            case TAPE_FMA:    r[inst.dst] = r[inst.a]*r[inst.b] + r[inst.c]; break;
+            case TAPE_FMS:    r[inst.dst] = r[inst.a]*r[inst.b] - r[inst.c]; break;
+            case TAPE_FNMA:   r[inst.dst] = r[inst.c] - r[inst.a]*r[inst.b]; break;
+            case TAPE_STORE:  out[inst.dst] = r[inst.a]; break;
+        }
+    }
+}
+
+// Steps each instruction through a block of TAPE_LANES configurations, so that the
+// dispatch cost is amortized & the lane loops can be vectorized
+void KinematicsTape::evaluate_batch(const double* q, int count, double* out) {
+    double* r = m_batch_registers.data();
+    // Lanes of a register, taken only for the operands an instruction uses: unused operands are -1
+    // & the destination of a store is an output index
+    auto lanes_of = [r] (int reg) { return r + reg*TAPE_LANES; };
+    for (int base = 0; base < count; base += TAPE_LANES) {
+        int lanes = std::min(TAPE_LANES, count - base);
+        for (const TapeInstruction& inst : m_tape) {
+            switch (inst.op) {
+                case TAPE_LOAD: {
+                    double* d = lanes_of(inst.dst);
+                    const double* in = q + inst.a*count + base;
+                    for (int l = 0; l < lanes; l++) d[l] = in[l];
+                    break;
+                }
+                case TAPE_SINCOS: {
+                    double* d = lanes_of(inst.dst);
+                    double* e = lanes_of(inst.b);
+                    const double* a = lanes_of(inst.a);
+                    #pragma omp simd
+                    for (int l = 0; l < lanes; l++) {
+                        double x = a[l];
+                        d[l] = std::sin(x);
+                        e[l] = std::cos(x);
+                    }
+                    break;
+                }
+                case TAPE_MUL: {
+                    double* d = lanes_of(inst.dst);
+                    const double* a = lanes_of(inst.a);
+                    const double* b = lanes_of(inst.b);
+                    #pragma omp simd
+                    for (int l = 0; l < lanes; l++) d[l] = a[l]*b[l];
+                    break;
+                }
+                case TAPE_ADD: {
+                    double* d = lanes_of(inst.dst);
+                    const double* a = lanes_of(inst.a);
+                    const double* b = lanes_of(inst.b);
+                    #pragma omp simd
+                    for (int l = 0; l < lanes; l++) d[l] = a[l] + b[l];
+                    break;
+                }
+                case TAPE_SUB: {
+                    double* d = lanes_of(inst.dst);
+                    const double* a = lanes_of(inst.a);
+                    const double* b = lanes_of(inst.b);
+                    #pragma omp simd
+                    for (int l = 0; l < lanes; l++) d[l] = a[l] - b[l];
+                    break;
+                }
+                case TAPE_NEG: {
+                    double* d = lanes_of(inst.dst);
+                    const double* a = lanes_of(inst.a);
+                    #pragma omp simd
+                    for (int l = 0; l < lanes; l++) d[l] = -a[l];
+                    break;
+                }
+                case TAPE_FMA: {
+                    double* d = lanes_of(inst.dst);
+                    const double* a = lanes_of(inst.a);
+                    const double* b = lanes_of(inst.b);
+                    const double* c = lanes_of(inst.c);
+                    #pragma omp simd
+                    for (int l = 0; l < lanes; l++) d[l] = a[l]*b[l] + c[l];
+                    break;
+                }
+                case TAPE_FMS: {
+                    double* d = lanes_of(inst.dst);
+                    const double* a = lanes_of(inst.a);
+                    const double* b = lanes_of(inst.b);
+                    const double* c = lanes_of(inst.c);
+                    #pragma omp simd
+                    for (int l = 0; l < lanes; l++) d[l] = a[l]*b[l] - c[l];
+                    break;
+                }
+                case TAPE_FNMA: {
+                    double* d = lanes_of(inst.dst);
+                    const double* a = lanes_of(inst.a);
+                    const double* b = lanes_of(inst.b);
+                    const double* c = lanes_of(inst.c);
+                    #pragma omp simd
+                    for (int l = 0; l < lanes; l++) d[l] = c[l] - a[l]*b[l];
+                    break;
+                }
+                case TAPE_STORE: {
+                    const double* a = lanes_of(inst.a);
+                    double* dst = out + inst.dst*count + base;
+                    for (int l = 0; l < lanes; l++) dst[l] = a[l];
+                    break;
+                }
+            }
+        }
+    }
+}
+
+#endif
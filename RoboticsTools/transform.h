@@ -9,6 +9,7 @@
 #include <regex>
 #include <algorithm>
 #include <set>
+#include <cmath>
 #include "symbolicc++.h"
 
 #define PRISMATIC 1
@@ -21,27 +22,95 @@ public:
     int m_joint_type;
     std::string m_joint_id;
 
-    Transform(double theta, double d, double a, double alpha,
+    // Inertial parameters of the link moving with this transform's frame, in that frame: mass, center of
+    // mass & inertia tensor about the center of mass (Ixx, Iyy, Izz, Ixy, Ixz, Iyz). Massless by default.
+    double m_mass;
+    std::vector<double> m_center_of_mass;
+    std::vector<double> m_inertia;
+
+    // Kinematic trees: the name of this transform's frame & of the frame it is attached to, the base when
+    // empty. Arms chain their transforms in order and ignore both.
+    std::string m_name, m_parent;
+
+    // Angles given as multiples of SymbolicConstant::pi/4 or pi/6 are exact & other constant angles are
+    // folded to doubles, e.g. Transform(0, 1, 0, SymbolicConstant::pi/2, REVOLUTE, 1)
+    Transform(const Symbolic& theta, const Symbolic& d, const Symbolic& a, const Symbolic& alpha,
                      int joint_type, int joint_id=STATIC);
     ~Transform();
 
     Symbolic get_actuated_joint();
     bool is_actuated();
     std::vector<std::vector<double>> evaluate(double joint=0);
+    void set_inertia(double mass, const std::vector<double>& center_of_mass, const std::vector<double>& inertia);
+    bool has_inertia() const;
+    void set_frame(const std::string& name, const std::string& parent="");
 };
 
-Transform::Transform(double theta, double d, double a, double alpha,
+// Angles k*pi/12 with cos(k*pi/12) in {0, +-1/2, +-sqrt(2)/2, +-sqrt(3)/2, +-1}
+static bool pi_multiple(const Symbolic& angle, int* twelfths) {
+    Symbolic ratio = angle.coeff(SymbolicConstant::pi);
+    if (ratio.type() != typeid(Numeric) || (angle - ratio*SymbolicConstant::pi) != 0) {
+        return false;
+    }
+    double k = double(ratio)*12;
+    *twelfths = int(std::lround(k));
+    return std::fabs(k - *twelfths) < 1e-12 && (*twelfths % 2 == 0 || *twelfths % 3 == 0);
+}
+
+// Any other constant angle, e.g. pi/5 or pi/12 + 0.1, with pi evaluated so it folds to a double
+static Symbolic constant_angle(const Symbolic& angle) {
+    return angle[SymbolicConstant::pi == M_PI];
+}
+
+// Cosine of an angle, folded to an exact value for multiples of pi/4 & pi/6 & to a double for any
+// other constant angle. Irrational values are doubles since SymbolicC++ rationals print as integer divisions.
+static Symbolic exact_cos(const Symbolic& angle) {
+    int twelfths;
+    if (!pi_multiple(angle, &twelfths)) {
+        Symbolic value = constant_angle(angle);
+        if (value.type() == typeid(Numeric)) {
+            return Symbolic(std::cos(double(value)));
+        }
+        return cos(angle);
+    }
+    switch (((twelfths % 24) + 24) % 24) {
+        case 0:            return Symbolic(1);
+        case 2:  case 22:  return Symbolic(std::sqrt(3.0)/2);
+        case 3:  case 21:  return Symbolic(std::sqrt(2.0)/2);
+        case 4:  case 20:  return Symbolic(0.5);
+        case 6:  case 18:  return Symbolic(0);
+        case 8:  case 16:  return Symbolic(-0.5);
+        case 9:  case 15:  return Symbolic(-std::sqrt(2.0)/2);
+        case 10: case 14:  return Symbolic(-std::sqrt(3.0)/2);
+        default:           return Symbolic(-1);
+    }
+}
+
+static Symbolic exact_sin(const Symbolic& angle) {
+    int twelfths;
+    if (!pi_multiple(angle, &twelfths)) {
+        Symbolic value = constant_angle(angle);
+        if (value.type() == typeid(Numeric)) {
+            return Symbolic(std::sin(double(value)));
+        }
+        return sin(angle);
+    }
+    // sin(x) == cos(x - pi/2)
+    return exact_cos(angle - SymbolicConstant::pi/2);
+}
+
+Transform::Transform(const Symbolic& theta, const Symbolic& d, const Symbolic& a, const Symbolic& alpha,
                      int joint_type, int joint_id){
     std::string id = std::to_string(joint_id);
-    m_theta = Symbolic("theta"+id);
-    m_d = Symbolic("d"+id);
-    m_a = Symbolic("a"+id);
-    m_alpha = Symbolic("alpha"+id);
+    m_theta = theta;
+    m_d = d;
+    m_a = a;
+    m_alpha = alpha;
     m_joint_type = joint_type;
-    m_joint_id = joint_id;
-
-    Symbolic zero("0");
-    Symbolic one("1");
+    m_joint_id = id;
+    m_mass = 0;
+    m_center_of_mass = std::vector<double>(3, 0.0);
+    m_inertia = std::vector<double>(6, 0.0);
 
     switch(joint_type) {
         case REVOLUTE:
@@ -57,29 +126,20 @@ Transform::Transform(double theta, double d, double a, double alpha,
             break;
     }
 
+    // Folding sin & cos of constant angles here keeps terms with an exactly zero
+    // coefficient out of the kinematic chain
+    Symbolic cos_theta = exact_cos(m_theta);
+    Symbolic sin_theta = exact_sin(m_theta);
+    Symbolic cos_alpha = exact_cos(m_alpha);
+    Symbolic sin_alpha = exact_sin(m_alpha);
+    Symbolic zero(0);
+    Symbolic one(1);
+
     m_transform = (
-        (cos(m_theta), -sin(m_theta)*cos(m_alpha), sin(m_theta)*sin(m_alpha), m_a*cos(m_theta)),
-        (sin(m_theta), cos(m_theta)*cos(m_alpha), -cos(m_theta)*sin(m_alpha), m_a*sin(m_theta)),
-        (zero, sin(m_alpha), cos(m_alpha), m_d),
+        (cos_theta, -sin_theta*cos_alpha, sin_theta*sin_alpha, m_a*cos_theta),
+        (sin_theta, cos_theta*cos_alpha, -cos_theta*sin_alpha, m_a*sin_theta),
+        (zero, sin_alpha, cos_alpha, m_d),
         (zero, zero, zero, one) );
-
-    switch(joint_type) {
-        case REVOLUTE:
-            m_transform = m_transform[zero == 0, one == 1,
-                                      m_d == d, m_a == a, m_alpha == alpha];
-            break;
-        case PRISMATIC:
-            m_transform = m_transform[zero == 0, one == 1,
-                                      m_theta == theta, m_a == a, m_alpha == alpha];
-            break;
-        case STATIC:
-            m_transform = m_transform[zero == 0, one == 1,
-                                      m_theta == theta, m_d == d, m_a == a, m_alpha == alpha];
-            break;
-        default:
-            throw out_of_range("Transforms must be either REVOLUTE, PRISMATIC, or STATIC");
-            break;
-    }
 }
 
 Transform::~Transform(){
@@ -106,6 +166,31 @@ std::vector<std::vector<double>> Transform::evaluate(double joint_value) {
     return retval;
 }
 
+void Transform::set_inertia(double mass, const std::vector<double>& center_of_mass,
+                            const std::vector<double>& inertia) {
+    if (center_of_mass.size() != 3 || inertia.size() != 6) {
+        throw invalid_argument("Inertial parameters need a 3 entry center of mass & 6 inertia tensor entries");
+    }
+    if (mass < 0) {
+        throw invalid_argument("Link mass cannot be negative");
+    }
+    m_mass = mass;
+    m_center_of_mass = center_of_mass;
+    m_inertia = inertia;
+}
+
+bool Transform::has_inertia() const {
+    return m_mass != 0 || std::count(m_inertia.begin(), m_inertia.end(), 0.0) != 6;
+}
+
+void Transform::set_frame(const std::string& name, const std::string& parent) {
+    if (name.empty()) {
+        throw invalid_argument("Frames need a name");
+    }
+    m_name = name;
+    m_parent = parent;
+}
+
 bool Transform::is_actuated() {
     return (m_joint_type == REVOLUTE || m_joint_type == PRISMATIC);
 }
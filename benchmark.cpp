@@ -0,0 +1,316 @@
+
+#include "RoboticsTools/arm.h"
+#include "RoboticsTools/benchmark.h"
+#include "RoboticsTools/inverse_kinematics.h"
+#include "RoboticsTools/simulator.h"
+#include "RoboticsTools/kinematic_tree.h"
+using SymbolicConstant::pi;
+
+// usage: robotics_benchmark [calls] [results.json]
+int main (int argc, char* argv[]) {
+    // 6 revolute joint arm with a spherical wrist
+    Transform T1(0,0.4,0.025,pi/2,REVOLUTE,1);
+    Transform T2(0,0,0.455,0,REVOLUTE,2);
+    Transform T3(0,0,0.035,pi/2,REVOLUTE,3);
+    Transform T4(0,0.42,0,-pi/2,REVOLUTE,4);
+    Transform T5(0,0,0,pi/2,REVOLUTE,5);
+    Transform T6(0,0.08,0,0,REVOLUTE,6);
+    T1.set_inertia(4.0, {0, -0.1, 0}, {0.05, 0.03, 0.05, 0, 0, 0});
+    T2.set_inertia(6.0, {-0.25, 0, 0.1}, {0.02, 0.14, 0.13, 0, 0, 0});
+    T3.set_inertia(2.5, {0, 0, 0.02}, {0.02, 0.02, 0.01, 0, 0, 0});
+    T4.set_inertia(1.5, {0, 0.1, 0}, {0.01, 0.005, 0.01, 0, 0, 0});
+    T5.set_inertia(0.6, {0, 0, 0}, {0.002, 0.002, 0.001, 0, 0, 0});
+    T6.set_inertia(0.3, {0, 0, -0.02}, {0.0005, 0.0005, 0.0003, 0, 0, 0});
+    Arm arm({T1, T2, T3, T4, T5, T6});
+    const int joints = 6;
+    // At least 1000, so the benchmarks given calls/1000 still make a call
+    const long calls = std::max(1000L, (argc > 1) ? std::atol(argv[1]) : 2000000L);
+    const std::string json = (argc > 2) ? argv[2] : "benchmark.json";
+
+    // Compiled forward & differential kinematics, get_positions
+    std::vector<BenchmarkResult> results = benchmark_arm(arm, calls, std::max(1L, calls/1000));
+
+    // Compiled batch kernel & instruction tape, over structure-of-arrays blocks of configurations
+    const int block = 256;
+    const long blocks = std::max(1L, calls/block);
+    CompiledKinematics compiled = arm.compile(EXPORT_CSE|EXPORT_TRIG_IDENTITIES|EXPORT_BATCH);
+    KinematicsTape tape = arm.tape(EXPORT_CSE);
+    std::cout << "Instruction tape: " << tape.instructions().size() << " instructions, "
+              << tape.register_count() << " registers\n";
+
+    std::vector<double> q = random_configurations(joints, block);
+    std::vector<double> q_soa (joints*block);
+    for (int i = 0; i < block; i++) {
+        for (int joint = 0; joint < joints; joint++) {
+            q_soa[joint*block + i] = q[i*joints + joint];
+        }
+    }
+    std::vector<double> out (12*block), expected (12*block);
+
+    results.push_back(run_benchmark("forward_kinematics_batch", [&] (long i) {
+        compiled.forward_kinematics_batch(q_soa.data(), block, expected.data());
+    }, blocks, blocks/10, block));
+    results.push_back(run_benchmark("tape_forward_kinematics", [&] (long i) {
+        tape.evaluate(&q[(i % block)*joints], &out[12*(i % block)]);
+    }, calls, calls/10));
+    results.push_back(run_benchmark("tape_forward_kinematics_batch", [&] (long i) {
+        tape.evaluate_batch(q_soa.data(), block, out.data());
+    }, blocks, blocks/10, block));
+
+    // Closed-form inverse kinematics (all branches) versus the numerical solvers, from seeds within
+    // 0.3 rad per joint of the solution or from random seeds with restarts
+    CompiledKinematics solver = arm.compile(EXPORT_NO_ALLOC|EXPORT_CSE|EXPORT_TRIG_IDENTITIES|EXPORT_FUSED|
+                                            EXPORT_GEOMETRIC_JACOBIAN|EXPORT_INVERSE_KINEMATICS);
+    const long targets = 4096;
+    std::vector<double> poses (12*targets), near_seeds = random_configurations(joints, targets, 2);
+    std::vector<double> q_targets = random_configurations(joints, targets);
+    std::vector<double> random_seeds = random_configurations(joints, targets, 3);
+    for (long i = 0; i < targets; i++) {
+        solver.forward_kinematics(&q_targets[i*joints], &poses[12*i]);
+        for (int joint = 0; joint < joints; joint++) {
+            near_seeds[i*joints + joint] = q_targets[i*joints + joint] + 0.3*near_seeds[i*joints + joint]/M_PI;
+        }
+    }
+    double solutions[48], q_numeric[6];
+    long solution_count = 0, numeric_calls = std::max(1L, calls/100);
+    results.push_back(run_benchmark("inverse_kinematics_closed_form", [&] (long i) {
+        solution_count += solver.inverse_kinematics(&poses[12*(i % targets)], solutions);
+    }, calls/10, calls/100));
+
+    struct NumericCase { std::string name; int method, restarts; const std::vector<double>& seeds; };
+    std::vector<NumericCase> cases { { "ik_dls_near_seed", IK_DAMPED_LEAST_SQUARES, 0, near_seeds },
+                                     { "ik_lm_near_seed", IK_LEVENBERG_MARQUARDT, 0, near_seeds },
+                                     { "ik_lm_random_seed_8_restarts", IK_LEVENBERG_MARQUARDT, 8, random_seeds } };
+    std::vector<std::string> convergence;
+    for (auto& numeric : cases) {
+        IKOptions options;
+        options.method = numeric.method;
+        options.restarts = numeric.restarts;
+        InverseKinematics ik (solver, options);
+        long converged = 0, solves = 0;
+        results.push_back(run_benchmark(numeric.name, [&] (long i) {
+            std::copy(&numeric.seeds[(i % targets)*joints], &numeric.seeds[(i % targets + 1)*joints], q_numeric);
+            converged += ik.solve(&poses[12*(i % targets)], q_numeric).converged;
+            solves++;
+        }, numeric_calls, numeric_calls/10));
+        convergence.push_back(numeric.name + " converged " + std::to_string(100.0*converged/solves) + "%");
+    }
+
+    // Batch mode, every target per call across all online CPUs
+    InverseKinematics ik (solver);
+    std::vector<double> q_batch (joints*targets);
+    std::vector<IKResult> batch_results (targets);
+    long batch_converged = 0, batch_solves = 0;
+    results.push_back(run_benchmark("ik_lm_near_seed_batch", [&] (long i) {
+        std::copy(near_seeds.begin(), near_seeds.end(), q_batch.begin());
+        ik.solve_batch(poses.data(), q_batch.data(), targets, batch_results.data());
+        for (auto& result : batch_results) {
+            batch_converged += result.converged;
+        }
+        batch_solves += targets;
+    }, std::max(1L, numeric_calls/targets), 1, targets));
+    convergence.push_back("ik_lm_near_seed_batch converged " + std::to_string(100.0*batch_converged/batch_solves) +
+                          "% on " + std::to_string(std::max(1u, std::thread::hardware_concurrency())) + " threads");
+
+    // Generated recursive Newton-Euler inverse dynamics versus the runtime recursion, with the link
+    // parameters extracted from the transforms on every call or once up front, and the generated mass
+    // matrix, Coriolis & gravity terms versus N + 2 runtime recursions, and the generated articulated-body
+    // forward dynamics versus the runtime algorithm
+    CompiledKinematics dynamics = arm.compile(EXPORT_CSE|EXPORT_INVERSE_DYNAMICS|EXPORT_DYNAMICS_TERMS|
+                                              EXPORT_FORWARD_DYNAMICS);
+    std::vector<double> q_dot = random_configurations(joints, block, 4), q_ddot = random_configurations(joints, block, 5);
+    std::vector<DynamicsLink> links = arm.dynamics_links();
+    std::vector<double> tau (joints*block), tau_runtime (joints*block);
+    results.push_back(run_benchmark("inverse_dynamics_compiled", [&] (long i) {
+        long k = (i % block)*joints;
+        dynamics.inverse_dynamics(&q[k], &q_dot[k], &q_ddot[k], &tau[k]);
+    }, calls, calls/10));
+    results.push_back(run_benchmark("inverse_dynamics_runtime_links", [&] (long i) {
+        long k = (i % block)*joints;
+        recursive_newton_euler(links, arm.m_gravity.data(), &q[k], &q_dot[k], &q_ddot[k], &tau_runtime[k]);
+    }, calls/10, calls/100));
+    results.push_back(run_benchmark("inverse_dynamics_runtime", [&] (long i) {
+        long k = (i % block)*joints;
+        std::vector<double> torques = arm.inverse_dynamics(std::vector<double>(&q[k], &q[k] + joints),
+                                                           std::vector<double>(&q_dot[k], &q_dot[k] + joints),
+                                                           std::vector<double>(&q_ddot[k], &q_ddot[k] + joints));
+        std::copy(torques.begin(), torques.end(), &tau_runtime[k]);
+    }, calls/100, calls/1000));
+    double M[joints*joints], c[joints], g[joints];
+    results.push_back(run_benchmark("dynamics_terms_compiled", [&] (long i) {
+        long k = (i % block)*joints;
+        dynamics.dynamics_terms(&q[k], &q_dot[k], M, c, g);
+    }, calls, calls/10));
+    results.push_back(run_benchmark("dynamics_terms_runtime_links", [&] (long i) {
+        long k = (i % block)*joints;
+        joint_space_dynamics(links, arm.m_gravity.data(), &q[k], &q_dot[k], M, c, g);
+    }, calls/10, calls/100));
+    std::vector<double> q_ddot_out (joints*block);
+    results.push_back(run_benchmark("forward_dynamics_compiled", [&] (long i) {
+        long k = (i % block)*joints;
+        dynamics.forward_dynamics(&q[k], &q_dot[k], &tau[k], &q_ddot_out[k]);
+    }, calls, calls/10));
+    results.push_back(run_benchmark("forward_dynamics_runtime_links", [&] (long i) {
+        long k = (i % block)*joints;
+        articulated_body(links, arm.m_gravity.data(), &q[k], &q_dot[k], &tau[k], &q_ddot_out[k]);
+    }, calls/10, calls/100));
+
+    double torque_error = 0;
+    for (long k = 0; k < joints*block; k += joints) {
+        dynamics.inverse_dynamics(&q[k], &q_dot[k], &q_ddot[k], &tau[k]);
+        recursive_newton_euler(links, arm.m_gravity.data(), &q[k], &q_dot[k], &q_ddot[k], &tau_runtime[k]);
+    }
+    for (int i = 0; i < joints*block; i++) {
+        torque_error = std::max(torque_error, std::fabs(tau[i] - tau_runtime[i]));
+    }
+    // The forward dynamics of the inverse dynamics' torques recover the accelerations
+    double acceleration_error = 0;
+    for (long k = 0; k < joints*block; k += joints) {
+        dynamics.forward_dynamics(&q[k], &q_dot[k], &tau[k], &q_ddot_out[k]);
+        for (int joint = 0; joint < joints; joint++) {
+            acceleration_error = std::max(acceleration_error, std::fabs(q_ddot_out[k + joint] - q_ddot[k + joint]));
+        }
+    }
+    // M(q)*q_ddot + C(q, q_dot)*q_dot + g(q) reproduces the inverse dynamics
+    double terms_error = 0;
+    for (long k = 0; k < joints*block; k += joints) {
+        dynamics.dynamics_terms(&q[k], &q_dot[k], M, c, g);
+        for (int row = 0; row < joints; row++) {
+            double torque = c[row] + g[row];
+            for (int column = 0; column < joints; column++) {
+                torque += M[row*joints + column]*q_ddot[k + column];
+            }
+            terms_error = std::max(terms_error, std::fabs(torque - tau[k + row]));
+        }
+    }
+
+    // Monte Carlo rollouts of 1 s at 1 kHz under joint space PD control towards random set points, on
+    // the generated & runtime forward dynamics
+    std::vector<double> set_points = random_configurations(joints, block, 6);
+    Controller controller = [&] (long rollout, double time, const double* q, const double* q_dot, double* tau) {
+        const double* set_point = &set_points[(rollout % block)*joints];
+        for (int joint = 0; joint < joints; joint++) {
+            tau[joint] = 20*(set_point[joint] - q[joint]) - 0.2*q_dot[joint];
+        }
+    };
+    ForwardDynamics runtime_dynamics = [&] (const double* q, const double* q_dot, const double* tau, double* q_ddot) {
+        articulated_body(links, arm.m_gravity.data(), q, q_dot, tau, q_ddot);
+    };
+    struct SimulationCase { std::string name; int integrator; bool generated; long rollouts; };
+    const long rollouts = std::max(1L, calls/20000);
+    std::vector<SimulationCase> simulations { { "rollouts_rk4_generated", INTEGRATOR_RK4, true, rollouts },
+                                              { "rollouts_semi_implicit_generated", INTEGRATOR_SEMI_IMPLICIT_EULER, true, rollouts },
+                                              { "rollouts_rk4_runtime", INTEGRATOR_RK4, false, std::max(1L, rollouts/10) } };
+    std::vector<std::string> simulation_reports;
+    for (auto& simulation : simulations) {
+        SimulationOptions options;
+        options.integrator = simulation.integrator;
+        Simulator simulator = simulation.generated ? Simulator(dynamics, options) : Simulator(runtime_dynamics, joints, options);
+        std::vector<double> q_rollouts (joints*simulation.rollouts), q_dot_rollouts (joints*simulation.rollouts, 0.0);
+        for (long rollout = 0; rollout < simulation.rollouts; rollout++) {
+            std::copy(&q[(rollout % block)*joints], &q[(rollout % block + 1)*joints], &q_rollouts[rollout*joints]);
+        }
+        SimulationReport report = simulator.rollouts(q_rollouts.data(), q_dot_rollouts.data(), simulation.rollouts, controller);
+        simulation_reports.push_back(simulation.name + " : " + std::to_string(report.rollouts) + " rollouts, " +
+                                     std::to_string(report.realtime_factor) + " simulated s per wall s on " +
+                                     std::to_string(report.threads) + " threads");
+    }
+
+    // Dual-arm torso: two copies of the arm on a revolute torso, as one kinematic tree sharing the torso
+    // frames & as one Arm per branch recomputing them
+    Transform torso(0, 0.3, 0, 0, REVOLUTE, 0);
+    torso.set_frame("torso");
+    Transform chest(0, 0.5, 0, pi/2, STATIC);
+    chest.set_frame("chest", "torso");
+    std::vector<Transform> torso_transforms { torso, chest };
+    for (int side = 0; side < 2; side++) {
+        std::vector<Transform> side_arm { T1, T2, T3, T4, T5, T6 };
+        for (int index = 0; index < joints; index++) {
+            Transform& T = side_arm[index];
+            T = Transform(T.m_theta, (side && index == 0) ? -T.m_d : T.m_d, T.m_a, T.m_alpha, REVOLUTE,
+                          1 + side*joints + index);
+            T.set_frame(std::string(side ? "right" : "left") + std::to_string(index + 1),
+                        index ? std::string(side ? "right" : "left") + std::to_string(index) : "chest");
+            torso_transforms.push_back(T);
+        }
+    }
+    KinematicTree torso_tree (torso_transforms);
+    const int tree_joints = torso_tree.m_actuated_joints.size();
+    CompiledKinematics tree = torso_tree.compile(EXPORT_GEOMETRIC_JACOBIAN|EXPORT_TRIG_IDENTITIES);
+    std::vector<CompiledKinematics> branches;
+    for (int effector = 0; effector < tree.end_effector_count; effector++) {
+        branches.push_back(torso_tree.branch(effector).compile(EXPORT_GEOMETRIC_JACOBIAN|EXPORT_TRIG_IDENTITIES));
+    }
+    // The joints of a branch are the torso's followed by its side's
+    std::vector<double> q_tree = random_configurations(tree_joints, block), q_branch (2*(joints + 1));
+    std::vector<double> tree_poses (24), tree_jacobian (12*tree_joints), branch_jacobian (12*(joints + 1));
+    auto branch_joints = [&] (long i) {
+        const double* q = &q_tree[(i % block)*tree_joints];
+        for (int side = 0; side < 2; side++) {
+            q_branch[side*(joints + 1)] = q[0];
+            std::copy(q + 1 + side*joints, q + 1 + (side + 1)*joints, &q_branch[side*(joints + 1) + 1]);
+        }
+    };
+    results.push_back(run_benchmark("tree_forward_kinematics", [&] (long i) {
+        tree.forward_kinematics(&q_tree[(i % block)*tree_joints], tree_poses.data());
+    }, calls, calls/10));
+    results.push_back(run_benchmark("branches_forward_kinematics", [&] (long i) {
+        branch_joints(i);
+        branches[0].forward_kinematics(&q_branch[0], &tree_poses[0]);
+        branches[1].forward_kinematics(&q_branch[joints + 1], &tree_poses[12]);
+    }, calls, calls/10));
+    results.push_back(run_benchmark("tree_geometric_jacobian", [&] (long i) {
+        tree.geometric_jacobian(&q_tree[(i % block)*tree_joints], tree_jacobian.data());
+    }, calls, calls/10));
+    results.push_back(run_benchmark("branches_geometric_jacobian", [&] (long i) {
+        branch_joints(i);
+        branches[0].geometric_jacobian(&q_branch[0], &branch_jacobian[0]);
+        branches[1].geometric_jacobian(&q_branch[joints + 1], &branch_jacobian[6*(joints + 1)]);
+    }, calls, calls/10));
+
+    // Both ways give the same end effector tree_poses & Jacobian columns
+    double tree_error = 0;
+    for (long i = 0; i < block; i++) {
+        double branch_poses[24];
+        branch_joints(i);
+        tree.forward_kinematics(&q_tree[i*tree_joints], tree_poses.data());
+        tree.geometric_jacobian(&q_tree[i*tree_joints], tree_jacobian.data());
+        for (int side = 0; side < 2; side++) {
+            branches[side].forward_kinematics(&q_branch[side*(joints + 1)], &branch_poses[12*side]);
+            branches[side].geometric_jacobian(&q_branch[side*(joints + 1)], &branch_jacobian[6*(joints + 1)*side]);
+            for (int row = 0; row < 6; row++) {
+                for (int column = 0; column <= joints; column++) {
+                    int tree_column = column ? side*joints + column : 0;
+                    tree_error = std::max(tree_error, std::fabs(
+                        tree_jacobian[(6*side + row)*tree_joints + tree_column] -
+                        branch_jacobian[(6*side + row)*(joints + 1) + column]));
+                }
+            }
+        }
+        for (int entry = 0; entry < 24; entry++) {
+            tree_error = std::max(tree_error, std::fabs(tree_poses[entry] - branch_poses[entry]));
+        }
+    }
+
+    double error = 0;
+    for (int i = 0; i < 12*block; i++) {
+        error = std::max(error, std::fabs(out[i] - expected[i]));
+    }
+
+    print_benchmarks(results);
+    std::cout << "Tape/compiled max abs diff : " << error << "\n";
+    std::cout << "Compiled/runtime inverse dynamics max abs diff : " << torque_error << "\n";
+    std::cout << "Dynamics terms/inverse dynamics max abs diff : " << terms_error << "\n";
+    std::cout << "Forward/inverse dynamics max abs acceleration diff : " << acceleration_error << "\n";
+    std::cout << "Kinematic tree/per-branch arms max abs diff : " << tree_error << "\n";
+    for (auto& line : simulation_reports) {
+        std::cout << line << "\n";
+    }
+    std::cout << "Closed-form IK solutions per pose : " << double(solution_count)/(calls/10 + calls/100) << "\n";
+    for (auto& line : convergence) {
+        std::cout << line << "\n";
+    }
+    write_benchmarks_json(json, results);
+    std::cout << "Results written to " << json << "\n";
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <iostream>
+#include <unistd.h>
+
+// Minimal assertions for the make check programs. Failures are reported & counted, and
+// check_result() is the program's exit code.
+static int s_check_failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+#define CHECK_NEAR(actual, expected, tolerance) \
+    check_near((actual), (expected), (tolerance), #actual, __FILE__, __LINE__)
+
+static void check(bool passed, const std::string& expression, const char* file, int line) {
+    if (!passed) {
+        std::cout << file << ":" << line << ": check failed: " << expression << "\n";
+        s_check_failures++;
+    }
+}
+
+static void check_near(double actual, double expected, double tolerance, const std::string& expression,
+                       const char* file, int line) {
+    if (!(std::fabs(actual - expected) <= tolerance)) {
+        std::cout << file << ":" << line << ": " << expression << " = " << actual << ", expected " << expected
+                  << " within " << tolerance << "\n";
+        s_check_failures++;
+    }
+}
+
+// Fresh cache directory for compile(), so libraries of an older generator are never loaded
+static std::string check_cache_directory() {
+    const char* tmp = std::getenv("TMPDIR");
+    return std::string(tmp ? tmp : "/tmp") + "/robotics_check_" + std::to_string(getpid());
+}
+
+static int check_result(const std::string& name) {
+    std::system(("rm -rf \"" + check_cache_directory() + "\"").c_str());
+    std::cout << name << ": " << (s_check_failures ? std::to_string(s_check_failures) + " failed checks" : "passed")
+              << "\n";
+    return s_check_failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,391 @@
+#include "../RoboticsTools/arm.h"
+#include "../RoboticsTools/benchmark.h"
+#include "../RoboticsTools/simulator.h"
+#include "check.h"
+using SymbolicConstant::pi;
+
+static const int s_samples = 50;
+
+// 6 revolute joints with a spherical wrist & the inertias of benchmark.cpp
+static std::vector<Transform> revolute_arm() {
+    std::vector<Transform> transforms { Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2),
+                                        Transform(0, 0, 0.035, pi/2, REVOLUTE, 3), Transform(0, 0.42, 0, -pi/2, REVOLUTE, 4),
+                                        Transform(0, 0, 0, pi/2, REVOLUTE, 5), Transform(0, 0.08, 0, 0, REVOLUTE, 6) };
+    transforms[0].set_inertia(4.0, {0, -0.1, 0}, {0.05, 0.03, 0.05, 0, 0, 0});
+    transforms[1].set_inertia(6.0, {-0.25, 0, 0.1}, {0.02, 0.14, 0.13, 0, 0, 0});
+    transforms[2].set_inertia(2.5, {0, 0, 0.02}, {0.02, 0.02, 0.01, 0, 0, 0});
+    transforms[3].set_inertia(1.5, {0, 0.1, 0}, {0.01, 0.005, 0.01, 0, 0, 0});
+    transforms[4].set_inertia(0.6, {0, 0, 0}, {0.002, 0.002, 0.001, 0, 0, 0});
+    transforms[5].set_inertia(0.3, {0, 0, -0.02}, {0.0005, 0.0005, 0.0003, 0, 0, 0});
+    return transforms;
+}
+
+// A static base tilt, a prismatic joint, a static link between joints & products of inertia
+static std::vector<Transform> mixed_arm() {
+    std::vector<Transform> transforms { Transform(0.2, 0.1, 0.05, pi/6, STATIC), Transform(0, 0.3, 0.1, pi/2, REVOLUTE, 1),
+                                        Transform(0.3, 0, 0, -pi/2, PRISMATIC, 2), Transform(0.1, 0.05, 0.2, pi/3, STATIC),
+                                        Transform(0, 0.1, 0.3, 0, REVOLUTE, 3), Transform(0, 0, 0.1, pi/2, REVOLUTE, 4) };
+    transforms[1].set_inertia(3.0, {0.02, -0.05, 0.01}, {0.04, 0.03, 0.05, 0.002, -0.001, 0.003});
+    transforms[2].set_inertia(2.0, {0, 0.05, -0.1}, {0.03, 0.02, 0.01, 0, 0.002, 0});
+    transforms[3].set_inertia(0.5, {0.05, 0, 0}, {0.001, 0.002, 0.002, 0, 0, 0});
+    transforms[4].set_inertia(1.5, {-0.15, 0.01, 0}, {0.005, 0.02, 0.02, 0.001, 0, -0.001});
+    transforms[5].set_inertia(0.8, {0, 0, 0.05}, {0.004, 0.004, 0.002, 0, 0, 0});
+    return transforms;
+}
+
+typedef std::vector<std::vector<double>> Matrix4;
+
+// Base frame of every link, from the numeric link transforms
+static std::vector<Matrix4> link_frames(Arm& arm, const double* q) {
+    Matrix4 frame { {1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1} };
+    std::vector<Matrix4> frames;
+    int joint = 0;
+    for (auto& T : arm.m_transforms) {
+        Matrix4 link = T.evaluate(T.is_actuated() ? q[joint++] : 0), product (4, std::vector<double>(4, 0.0));
+        for (int row = 0; row < 4; row++) {
+            for (int column = 0; column < 4; column++) {
+                for (int k = 0; k < 4; k++) {
+                    product[row][column] += frame[row][k]*link[k][column];
+                }
+            }
+        }
+        frame = product;
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+// Base frame positions of the centers of mass
+static std::vector<std::vector<double>> centers_of_mass(Arm& arm, const double* q) {
+    std::vector<Matrix4> frames = link_frames(arm, q);
+    std::vector<std::vector<double>> centers;
+    for (int index = 0; index < frames.size(); index++) {
+        std::vector<double> center (3);
+        for (int row = 0; row < 3; row++) {
+            center[row] = frames[index][row][3];
+            for (int k = 0; k < 3; k++) {
+                center[row] += frames[index][row][k]*arm.m_transforms[index].m_center_of_mass[k];
+            }
+        }
+        centers.push_back(center);
+    }
+    return centers;
+}
+
+static double potential_energy(Arm& arm, const double* q) {
+    auto centers = centers_of_mass(arm, q);
+    double energy = 0;
+    for (int index = 0; index < arm.m_transforms.size(); index++) {
+        for (int axis = 0; axis < 3; axis++) {
+            energy -= arm.m_transforms[index].m_mass*arm.m_gravity[axis]*centers[index][axis];
+        }
+    }
+    return energy;
+}
+
+// Torques at rest are the gradient of the potential energy, by central differences
+static void check_gravity_torques(Arm& arm) {
+    const int joints = arm.m_actuated_joints.size();
+    std::vector<double> q = random_configurations(joints, s_samples, 3), zero (joints, 0.0);
+    for (int sample = 0; sample < s_samples; sample++) {
+        std::vector<double> q_sample (&q[joints*sample], &q[joints*(sample + 1)]);
+        std::vector<double> tau = arm.inverse_dynamics(q_sample, zero, zero);
+        for (int joint = 0; joint < joints; joint++) {
+            const double h = 1e-6;
+            std::vector<double> plus = q_sample, minus = q_sample;
+            plus[joint] += h;
+            minus[joint] -= h;
+            double gradient = (potential_energy(arm, plus.data()) - potential_energy(arm, minus.data()))/(2*h);
+            CHECK_NEAR(tau[joint], gradient, 1e-6);
+        }
+    }
+}
+
+// The generated recursion against the runtime one
+static void check_compiled_inverse_dynamics(Arm& arm, const std::string& cache_directory) {
+    const int joints = arm.m_actuated_joints.size();
+    CompiledKinematics dynamics = arm.compile(EXPORT_CSE|EXPORT_INVERSE_DYNAMICS, cache_directory);
+    std::vector<DynamicsLink> links = arm.dynamics_links();
+    std::vector<double> q = random_configurations(joints, s_samples, 4), q_dot = random_configurations(joints, s_samples, 5),
+                        q_ddot = random_configurations(joints, s_samples, 6), tau (joints), expected (joints);
+    for (int sample = 0; sample < s_samples; sample++) {
+        int k = joints*sample;
+        dynamics.inverse_dynamics(&q[k], &q_dot[k], &q_ddot[k], tau.data());
+        recursive_newton_euler(links, arm.m_gravity.data(), &q[k], &q_dot[k], &q_ddot[k], expected.data());
+        for (int joint = 0; joint < joints; joint++) {
+            CHECK_NEAR(tau[joint], expected[joint], 1e-10);
+        }
+    }
+}
+
+// Kinetic energy of the links, from their velocities by central differences of the frames along q_dot
+static double kinetic_energy(Arm& arm, const double* q, const double* q_dot) {
+    const int joints = arm.m_actuated_joints.size();
+    const double h = 1e-6;
+    std::vector<double> plus (q, q + joints), minus (q, q + joints);
+    for (int joint = 0; joint < joints; joint++) {
+        plus[joint] += h*q_dot[joint];
+        minus[joint] -= h*q_dot[joint];
+    }
+    std::vector<Matrix4> frames = link_frames(arm, q), frames_plus = link_frames(arm, plus.data()),
+                         frames_minus = link_frames(arm, minus.data());
+    auto centers_plus = centers_of_mass(arm, plus.data()), centers_minus = centers_of_mass(arm, minus.data());
+    double energy = 0;
+    for (int index = 0; index < frames.size(); index++) {
+        const Transform& T = arm.m_transforms[index];
+        double W[3][3], w[3], w_link[3] = { 0, 0, 0 };
+        for (int axis = 0; axis < 3; axis++) {
+            double v = (centers_plus[index][axis] - centers_minus[index][axis])/(2*h);
+            energy += 0.5*T.m_mass*v*v;
+        }
+        // Angular velocity from the skew matrix dR/dt*R^T, then in the link's frame
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++) {
+                W[row][column] = 0;
+                for (int k = 0; k < 3; k++) {
+                    W[row][column] += (frames_plus[index][row][k] - frames_minus[index][row][k])/(2*h)*frames[index][column][k];
+                }
+            }
+        }
+        w[0] = W[2][1];
+        w[1] = W[0][2];
+        w[2] = W[1][0];
+        for (int row = 0; row < 3; row++) {
+            for (int k = 0; k < 3; k++) {
+                w_link[row] += frames[index][k][row]*w[k];
+            }
+        }
+        const std::vector<double>& I = T.m_inertia;
+        double inertia[3][3] = { { I[0], I[3], I[4] }, { I[3], I[1], I[5] }, { I[4], I[5], I[2] } };
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++) {
+                energy += 0.5*w_link[row]*inertia[row][column]*w_link[column];
+            }
+        }
+    }
+    return energy;
+}
+
+// M, C(q, q_dot)*q_dot & g generated against the runtime terms & the inverse dynamics, and against
+// the energies: 1/2 q_dot^T M q_dot is the kinetic energy, q_dot^T c = 1/2 q_dot^T dM/dt q_dot (dM/dt - 2C is
+// skew-symmetric) & g is the gradient of the potential energy
+static void check_dynamics_terms(Arm& arm, const std::string& cache_directory) {
+    const int joints = arm.m_actuated_joints.size();
+    CompiledKinematics dynamics = arm.compile(EXPORT_CSE|EXPORT_INVERSE_DYNAMICS|EXPORT_DYNAMICS_TERMS, cache_directory);
+    std::vector<DynamicsLink> links = arm.dynamics_links();
+    std::vector<double> q = random_configurations(joints, s_samples, 8), q_dot = random_configurations(joints, s_samples, 9),
+                        q_ddot = random_configurations(joints, s_samples, 10);
+    std::vector<double> M (joints*joints), c (joints), g (joints), M_runtime (joints*joints), c_runtime (joints),
+                        g_runtime (joints), tau (joints), M_plus (joints*joints), M_minus (joints*joints), unused (joints);
+    for (int sample = 0; sample < s_samples; sample++) {
+        const double* q_sample = &q[joints*sample];
+        const double* q_dot_sample = &q_dot[joints*sample];
+        dynamics.dynamics_terms(q_sample, q_dot_sample, M.data(), c.data(), g.data());
+        joint_space_dynamics(links, arm.m_gravity.data(), q_sample, q_dot_sample, M_runtime.data(), c_runtime.data(),
+                             g_runtime.data());
+        dynamics.inverse_dynamics(q_sample, q_dot_sample, &q_ddot[joints*sample], tau.data());
+        for (int row = 0; row < joints; row++) {
+            double torque = c[row] + g[row];
+            for (int column = 0; column < joints; column++) {
+                CHECK_NEAR(M[joints*row + column], M_runtime[joints*row + column], 1e-10);
+                CHECK_NEAR(M[joints*row + column], M[joints*column + row], 0);
+                torque += M[joints*row + column]*q_ddot[joints*sample + column];
+            }
+            CHECK_NEAR(c[row], c_runtime[row], 1e-10);
+            CHECK_NEAR(g[row], g_runtime[row], 1e-10);
+            CHECK_NEAR(torque, tau[row], 1e-10);
+        }
+
+        // dM/dt along q_dot by central differences
+        const double h = 1e-6;
+        std::vector<double> plus (q_sample, q_sample + joints), minus (q_sample, q_sample + joints);
+        for (int joint = 0; joint < joints; joint++) {
+            plus[joint] += h*q_dot_sample[joint];
+            minus[joint] -= h*q_dot_sample[joint];
+        }
+        dynamics.dynamics_terms(plus.data(), q_dot_sample, M_plus.data(), unused.data(), unused.data());
+        dynamics.dynamics_terms(minus.data(), q_dot_sample, M_minus.data(), unused.data(), unused.data());
+        double kinetic = 0, power = 0, rate = 0;
+        for (int row = 0; row < joints; row++) {
+            power += q_dot_sample[row]*c[row];
+            for (int column = 0; column < joints; column++) {
+                kinetic += 0.5*q_dot_sample[row]*M[joints*row + column]*q_dot_sample[column];
+                rate += 0.5*q_dot_sample[row]*(M_plus[joints*row + column] - M_minus[joints*row + column])/(2*h)*
+                        q_dot_sample[column];
+            }
+        }
+        CHECK_NEAR(kinetic, kinetic_energy(arm, q_sample, q_dot_sample), 1e-7);
+        CHECK_NEAR(power, rate, 1e-6);
+
+        // Positive definite: x^T M x > 0
+        for (int trial = 0; trial < 4; trial++) {
+            double quadratic = 0;
+            for (int row = 0; row < joints; row++) {
+                for (int column = 0; column < joints; column++) {
+                    quadratic += q_ddot[(joints*(sample + trial) + row) % q_ddot.size()]*M[joints*row + column]*
+                                 q_ddot[(joints*(sample + trial) + column) % q_ddot.size()];
+                }
+            }
+            CHECK(quadratic > 0);
+        }
+    }
+}
+
+// The articulated-body accelerations, generated & at runtime, invert the inverse dynamics
+static void check_forward_dynamics(Arm& arm, const std::string& cache_directory) {
+    const int joints = arm.m_actuated_joints.size();
+    CompiledKinematics dynamics = arm.compile(EXPORT_CSE|EXPORT_INVERSE_DYNAMICS|EXPORT_DYNAMICS_TERMS|
+                                              EXPORT_FORWARD_DYNAMICS, cache_directory);
+    std::vector<DynamicsLink> links = arm.dynamics_links();
+    std::vector<double> q = random_configurations(joints, s_samples, 12), q_dot = random_configurations(joints, s_samples, 13),
+                        q_ddot = random_configurations(joints, s_samples, 14);
+    std::vector<double> tau (joints), accelerations (joints), runtime (joints), M (joints*joints), c (joints), g (joints);
+    for (int sample = 0; sample < s_samples; sample++) {
+        const double* q_sample = &q[joints*sample];
+        const double* q_dot_sample = &q_dot[joints*sample];
+        dynamics.inverse_dynamics(q_sample, q_dot_sample, &q_ddot[joints*sample], tau.data());
+        dynamics.forward_dynamics(q_sample, q_dot_sample, tau.data(), accelerations.data());
+        articulated_body(links, arm.m_gravity.data(), q_sample, q_dot_sample, tau.data(), runtime.data());
+        std::vector<double> wrapper = arm.forward_dynamics(std::vector<double>(q_sample, q_sample + joints),
+                                                           std::vector<double>(q_dot_sample, q_dot_sample + joints), tau);
+        for (int joint = 0; joint < joints; joint++) {
+            CHECK_NEAR(accelerations[joint], q_ddot[joints*sample + joint], 1e-9);
+            CHECK_NEAR(runtime[joint], accelerations[joint], 1e-10);
+            CHECK_NEAR(wrapper[joint], accelerations[joint], 1e-10);
+        }
+
+        // M*q_ddot + c + g = tau for arbitrary torques too
+        std::vector<double> torques (&q_ddot[joints*sample], &q_ddot[joints*(sample + 1)]);
+        dynamics.forward_dynamics(q_sample, q_dot_sample, torques.data(), accelerations.data());
+        dynamics.dynamics_terms(q_sample, q_dot_sample, M.data(), c.data(), g.data());
+        for (int row = 0; row < joints; row++) {
+            double torque = c[row] + g[row];
+            for (int column = 0; column < joints; column++) {
+                torque += M[joints*row + column]*accelerations[column];
+            }
+            CHECK_NEAR(torque, torques[row], 1e-9);
+        }
+    }
+}
+
+static double total_energy(Arm& arm, CompiledKinematics& dynamics, const double* q, const double* q_dot) {
+    const int joints = arm.m_actuated_joints.size();
+    std::vector<double> M (joints*joints), c (joints), g (joints);
+    dynamics.dynamics_terms(q, q_dot, M.data(), c.data(), g.data());
+    double energy = potential_energy(arm, q);
+    for (int row = 0; row < joints; row++) {
+        for (int column = 0; column < joints; column++) {
+            energy += 0.5*q_dot[row]*M[joints*row + column]*q_dot[column];
+        }
+    }
+    return energy;
+}
+
+// Unforced motion conserves energy, RK4 converges at fourth order & rollouts match single simulations
+static void check_simulator(Arm& arm, const std::string& cache_directory) {
+    const int joints = arm.m_actuated_joints.size();
+    CompiledKinematics dynamics = arm.compile(EXPORT_CSE|EXPORT_INVERSE_DYNAMICS|EXPORT_DYNAMICS_TERMS|
+                                              EXPORT_FORWARD_DYNAMICS, cache_directory);
+    std::vector<double> start = random_configurations(joints, 1, 15), rest (joints, 0.0);
+    double energy = total_energy(arm, dynamics, start.data(), rest.data());
+
+    // Final positions of 0.5 s falls from rest
+    auto fall = [&] (int integrator, double time_step) {
+        SimulationOptions options;
+        options.integrator = integrator;
+        options.time_step = time_step;
+        options.duration = 0.5;
+        Simulator simulator (dynamics, options);
+        std::vector<double> q = start, q_dot = rest;
+        simulator.simulate(q.data(), q_dot.data());
+        CHECK_NEAR(total_energy(arm, dynamics, q.data(), q_dot.data()), energy,
+                   (integrator == INTEGRATOR_RK4) ? 1e-6 : 0.05*std::fabs(energy) + 0.5);
+        return q;
+    };
+    std::vector<double> coarse = fall(INTEGRATOR_RK4, 2e-3), fine = fall(INTEGRATOR_RK4, 1e-3),
+                        finest = fall(INTEGRATOR_RK4, 5e-4);
+    fall(INTEGRATOR_SEMI_IMPLICIT_EULER, 1e-3);
+    double coarse_error = 0, fine_error = 0;
+    for (int joint = 0; joint < joints; joint++) {
+        coarse_error = std::max(coarse_error, std::fabs(coarse[joint] - finest[joint]));
+        fine_error = std::max(fine_error, std::fabs(fine[joint] - finest[joint]));
+    }
+    // Halving the step divides the error by ~16; against the finest solution the ratio is (1 - 1/16)/(1/16 - 1/256)
+    CHECK(coarse_error > 10*fine_error);
+
+    // Rollouts across threads give the single simulations' states
+    const long count = 6;
+    std::vector<double> q = random_configurations(joints, count, 16), q_dot (joints*count, 0.0);
+    std::vector<double> q_single = q, q_dot_single = q_dot;
+    Controller controller = [&] (long rollout, double time, const double* q, const double* q_dot, double* tau) {
+        for (int joint = 0; joint < joints; joint++) {
+            tau[joint] = 20*(0.1*rollout - q[joint]) - 0.2*q_dot[joint];
+        }
+    };
+    SimulationOptions options;
+    options.duration = 0.2;
+    Simulator simulator (dynamics, options);
+    SimulationReport report = simulator.rollouts(q.data(), q_dot.data(), count, controller, 3);
+    CHECK(report.steps == 200*count);
+    for (long rollout = 0; rollout < count; rollout++) {
+        simulator.simulate(&q_single[joints*rollout], &q_dot_single[joints*rollout], controller, rollout);
+    }
+    for (int index = 0; index < joints*count; index++) {
+        CHECK_NEAR(q[index], q_single[index], 0);
+        CHECK_NEAR(q_dot[index], q_dot_single[index], 0);
+    }
+}
+
+// A last link without inertia leaves its joint's row of M zero: both forward dynamics refuse the arm
+static void check_singular_inertia(const std::string& cache_directory) {
+    std::vector<Transform> transforms { Transform(0, 0.4, 0, pi/2, REVOLUTE, 1), Transform(0, 0, 0.4, 0, REVOLUTE, 2),
+                                        Transform(0, 0, 0.3, 0, REVOLUTE, 3) };
+    transforms[0].set_inertia(4.0, {0, -0.1, 0}, {0.05, 0.03, 0.05, 0, 0, 0});
+    transforms[1].set_inertia(2.0, {-0.2, 0, 0}, {0.01, 0.03, 0.03, 0, 0, 0});
+    Arm arm (transforms);
+    bool generated = false, runtime = false;
+    try {
+        arm.compile(EXPORT_FORWARD_DYNAMICS, cache_directory);
+    } catch (std::invalid_argument&) {
+        generated = true;
+    }
+    try {
+        arm.forward_dynamics({0.1, 0.2, 0.3}, {0, 0, 0}, {0, 0, 0});
+    } catch (std::invalid_argument&) {
+        runtime = true;
+    }
+    CHECK(generated);
+    CHECK(runtime);
+}
+
+int main() {
+    std::string cache_directory = check_cache_directory();
+
+    // Pendulum about a vertical plane: a point mass with inertia Izz at the tip of a link of length L
+    const double mass = 2, length = 0.5, inertia = 0.1;
+    Transform swing (0, 0, length, 0, REVOLUTE, 1);
+    swing.set_inertia(mass, {0, 0, 0}, {0, 0, inertia, 0, 0, 0});
+    Arm pendulum ({swing});
+    pendulum.m_gravity = {0, -9.81, 0};
+    for (double q : {-2.0, 0.3, 1.1}) {
+        std::vector<double> tau = pendulum.inverse_dynamics({q}, {1.7}, {-0.6});
+        CHECK_NEAR(tau[0], (mass*length*length + inertia)*-0.6 + mass*9.81*length*std::cos(q), 1e-12);
+    }
+
+    // A vertical prismatic joint lifts its mass
+    Transform lift (0, 0, 0, 0, PRISMATIC, 1);
+    lift.set_inertia(3, {0.1, 0, 0.2}, {0.01, 0.01, 0.01, 0, 0, 0});
+    Arm slider ({lift});
+    CHECK_NEAR(slider.inverse_dynamics({0.4}, {2.0}, {1.5})[0], 3*(1.5 + 9.81), 1e-12);
+
+    for (auto transforms : { revolute_arm(), mixed_arm() }) {
+        Arm arm (transforms);
+        check_gravity_torques(arm);
+        check_compiled_inverse_dynamics(arm, cache_directory);
+        check_dynamics_terms(arm, cache_directory);
+        check_forward_dynamics(arm, cache_directory);
+        check_simulator(arm, cache_directory);
+    }
+    check_singular_inertia(cache_directory);
+    return check_result("test_dynamics");
+}
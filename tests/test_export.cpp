@@ -0,0 +1,166 @@
+#include "../RoboticsTools/arm.h"
+#include "check.h"
+using SymbolicConstant::pi;
+
+static const int s_second_order = EXPORT_CSE | EXPORT_GEOMETRIC_JACOBIAN | EXPORT_HESSIAN | EXPORT_JACOBIAN_DERIVATIVE |
+                                  EXPORT_ALL_FRAMES;
+
+// Every function of two compiled exports of the same transforms agrees
+static void check_same_kinematics(CompiledKinematics& actual, CompiledKinematics& expected, int options) {
+    const int joints = expected.joint_count;
+    CHECK(actual.joint_count == joints);
+    std::vector<std::pair<CompiledKinematics::Function, CompiledKinematics::Function>> functions {
+        { actual.forward_kinematics, expected.forward_kinematics } };
+    int size = 12;
+    if (options & EXPORT_GEOMETRIC_JACOBIAN) {
+        functions.push_back({ actual.geometric_jacobian, expected.geometric_jacobian });
+        functions.push_back({ actual.kinematic_hessian, expected.kinematic_hessian });
+        functions.push_back({ actual.all_frames, expected.all_frames });
+        size = std::max(6*joints*joints, 12*expected.frame_count);
+    } else {
+        for (int joint = 0; joint < joints; joint++) {
+            functions.push_back({ actual.differential_kinematics[joint], expected.differential_kinematics[joint] });
+        }
+    }
+    std::vector<double> q (joints), q_dot (joints), out (size), reference (size);
+    for (int sample = 0; sample < 10; sample++) {
+        for (int joint = 0; joint < joints; joint++) {
+            q[joint] = std::sin(1.3*sample + 0.7*joint)*3;
+            q_dot[joint] = std::cos(0.9*sample + 1.1*joint)*2;
+        }
+        for (auto& function : functions) {
+            function.first(q.data(), out.data());
+            function.second(q.data(), reference.data());
+            for (int entry = 0; entry < size; entry++) {
+                CHECK_NEAR(out[entry], reference[entry], 1e-12);
+            }
+        }
+        if (options & EXPORT_JACOBIAN_DERIVATIVE) {
+            actual.jacobian_derivative_product(q.data(), q_dot.data(), out.data());
+            expected.jacobian_derivative_product(q.data(), q_dot.data(), reference.data());
+            for (int entry = 0; entry < 6; entry++) {
+                CHECK_NEAR(out[entry], reference[entry], 1e-12);
+            }
+        }
+    }
+}
+
+// Links edited with set_transform() & directly in m_transforms after a first export, which fills the
+// derivation caches, export as a fresh Arm over the same transforms. Each is compiled in its own
+// directory, since both share the geometry's cache key.
+static void check_incremental_export(int options, const std::string& cache_directory) {
+    std::vector<Transform> transforms { Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2),
+                                        Transform(0.1, 0.05, 0, 0, STATIC), Transform(0, 0.42, 0, -pi/2, REVOLUTE, 3) };
+    Arm arm (transforms);
+    arm.m_export_cache = "";
+    std::string edited = compile_cache_directory(cache_directory + "/edited");
+    std::string fresh = compile_cache_directory(cache_directory + "/fresh");
+    arm.compile(options, edited);
+
+    std::vector<std::pair<int, Transform>> edits { { 1, Transform(0, 0.1, 0.5, pi/2, REVOLUTE, 2) },
+                                                   { 3, Transform(0, 0.3, 0.05, -pi/2, REVOLUTE, 3) },
+                                                   { 0, Transform(0, 0.35, 0, pi/2, REVOLUTE, 1) } };
+    for (int index = 0; index < edits.size(); index++) {
+        transforms[edits[index].first] = edits[index].second;
+        if (index % 2 == 0) {
+            arm.set_transform(edits[index].first, edits[index].second);
+        } else {
+            arm.m_transforms[edits[index].first] = edits[index].second;
+        }
+        Arm reference (transforms);
+        reference.m_export_cache = "";
+        CompiledKinematics actual = arm.compile(options, edited);
+        CompiledKinematics expected = reference.compile(options, fresh);
+        check_same_kinematics(actual, expected, options);
+    }
+}
+
+static std::string read_file(const std::string& filename) {
+    std::ifstream file (filename, std::ifstream::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// EXPORT_PARALLEL writes the same file as a serial export, each from a fresh Arm
+static void check_parallel_export(int options, const std::string& cache_directory) {
+    std::vector<Transform> transforms { Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2),
+                                        Transform(0, 0, 0.035, pi/2, REVOLUTE, 3), Transform(0, 0.42, 0, -pi/2, REVOLUTE, 4),
+                                        Transform(0.1, 0.05, 0, pi/2, STATIC), Transform(0, 0, 0, pi/2, PRISMATIC, 5) };
+    Arm serial (transforms), parallel (transforms);
+    serial.m_export_cache = parallel.m_export_cache = "";
+    parallel.m_export_workers = 3;
+    serial.export_expressions(cache_directory + "/serial.cpp", options);
+    parallel.export_expressions(cache_directory + "/parallel.cpp", options | EXPORT_PARALLEL);
+    std::string expected = read_file(cache_directory + "/serial.cpp");
+    CHECK(!expected.empty());
+    CHECK(read_file(cache_directory + "/parallel.cpp") == expected);
+}
+
+// Both batch kernels write entry e of configuration i at [e*count + i], the last frame of all_frames_batch being
+// the pose of forward_kinematics_batch
+static void check_batch_layout(const std::string& cache_directory) {
+    Arm arm({Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2),
+             Transform(0.1, 0.05, 0, pi/2, STATIC)});
+    arm.m_export_cache = "";
+    CompiledKinematics compiled = arm.compile(EXPORT_BATCH | EXPORT_ALL_FRAMES, cache_directory);
+    const int count = 5, joints = compiled.joint_count, frames = compiled.frame_count;
+    std::vector<double> q (joints*count), pose (12*count), all_frames (12*frames*count), scalar_q (joints), expected (12);
+    for (int index = 0; index < q.size(); index++) {
+        q[index] = std::sin(1.7*index);
+    }
+    compiled.forward_kinematics_batch(q.data(), count, pose.data());
+    compiled.all_frames_batch(q.data(), count, all_frames.data());
+    for (int i = 0; i < count; i++) {
+        for (int joint = 0; joint < joints; joint++) {
+            scalar_q[joint] = q[joint*count + i];
+        }
+        compiled.forward_kinematics(scalar_q.data(), expected.data());
+        for (int entry = 0; entry < 12; entry++) {
+            CHECK_NEAR(pose[entry*count + i], expected[entry], 1e-12);
+            CHECK_NEAR(all_frames[(12*(frames - 1) + entry)*count + i], expected[entry], 1e-12);
+        }
+    }
+}
+
+// A header with a source file declares each function that source defines, once, & only includes what it uses
+static void check_split_header(const std::string& cache_directory) {
+    Arm arm({Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2)});
+    arm.m_export_cache = "";
+    int options = EXPORT_NO_ALLOC | EXPORT_NO_VECTOR | EXPORT_BATCH | EXPORT_ALL_FRAMES;
+    arm.export_header(cache_directory + "/split.h", "split", options, cache_directory + "/split.cpp");
+    std::string header = read_file(cache_directory + "/split.h");
+    std::string source = read_file(cache_directory + "/split.cpp");
+    CHECK(header.find("#include <iostream>") == std::string::npos);
+    CHECK(header.find("#include <vector>") == std::string::npos);
+    for (std::string function : { "void forward_kinematics_batch(", "void all_frames(", "void all_frames_batch(" }) {
+        CHECK(header.find(function) != std::string::npos);
+        CHECK(header.find(function) == header.rfind(function));
+        CHECK(header.find("inline " + function) == std::string::npos);
+        CHECK(source.find(function) != std::string::npos);
+    }
+
+    // The dh_table of a header needs numeric link parameters
+    Arm symbolic({Transform(0, Symbolic("length"), 0, 0, REVOLUTE, 1)});
+    symbolic.m_export_cache = "";
+    bool thrown = false;
+    try {
+        symbolic.export_header(cache_directory + "/symbolic.h", "symbolic");
+    } catch (std::invalid_argument&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+int main() {
+    std::string cache_directory = compile_cache_directory(check_cache_directory());
+    for (int options : { EXPORT_DEFAULT, s_second_order }) {
+        check_incremental_export(options, cache_directory);
+    }
+    for (int options : { EXPORT_DEFAULT, EXPORT_CSE, EXPORT_CSE | EXPORT_SHARED_LIBRARY }) {
+        check_parallel_export(options, cache_directory);
+    }
+    check_batch_layout(cache_directory);
+    check_split_header(cache_directory);
+    return check_result("test_export");
+}
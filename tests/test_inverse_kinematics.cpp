@@ -0,0 +1,154 @@
+#include "../RoboticsTools/inverse_kinematics.h"
+#include "../RoboticsTools/benchmark.h"
+#include "check.h"
+using SymbolicConstant::pi;
+
+static const int s_samples = 200;
+
+// Spherical wrist arms covering each closed form for joint 3, with static base & tool transforms
+static std::vector<std::vector<Transform>> spherical_wrist_arms() {
+    auto wrist = [] (double d4, const Symbolic& alpha4, const Symbolic& alpha5, double d6) {
+        return std::vector<Transform> { Transform(0, d4, 0, alpha4, REVOLUTE, 4), Transform(0, 0, 0, alpha5, REVOLUTE, 5),
+                                        Transform(0, d6, 0, 0, REVOLUTE, 6) };
+    };
+    std::vector<std::vector<Transform>> arms {
+        // Axes 2 & 3 parallel (quadratic), the arm of benchmark.cpp
+        { Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2),
+          Transform(0, 0, 0.035, pi/2, REVOLUTE, 3) },
+        // Axes 1 & 2 intersect
+        { Transform(0, 0.3, 0, pi/2, REVOLUTE, 1), Transform(0, 0.1, 0.4, pi/3, REVOLUTE, 2),
+          Transform(0, 0.05, 0.1, pi/2, REVOLUTE, 3) },
+        // Axes 1 & 2 parallel
+        { Transform(0, 0.2, 0.3, 0, REVOLUTE, 1), Transform(0, 0.1, 0.25, pi/2, REVOLUTE, 2),
+          Transform(0, 0.05, 0.15, -pi/2, REVOLUTE, 3) },
+        // General axes (quartic)
+        { Transform(0, 0.3, 0.1, pi/2, REVOLUTE, 1), Transform(0, 0.05, 0.4, pi/3, REVOLUTE, 2),
+          Transform(0, 0.02, 0.08, pi/2, REVOLUTE, 3) },
+        { Transform(0, 0.25, 0.15, -pi/3, REVOLUTE, 1), Transform(0, -0.1, 0.35, pi/4, REVOLUTE, 2),
+          Transform(0, 0.1, 0.05, -pi/2, REVOLUTE, 3) },
+    };
+    std::vector<std::vector<Transform>> wrists { wrist(0.42, -pi/2, pi/2, 0.08), wrist(0.3, pi/2, -pi/2, 0.1),
+                                                 wrist(0.35, pi/2, pi/2, 0), wrist(0.4, pi/3, -pi/2, 0.12),
+                                                 wrist(0.3, -pi/2, pi/3, 0.05) };
+    for (int index = 0; index < arms.size(); index++) {
+        arms[index].insert(arms[index].end(), wrists[index].begin(), wrists[index].end());
+    }
+    // Static base & tool transforms around the first arm
+    std::vector<Transform> mounted { Transform(0.3, 0.2, 0.1, pi/6, STATIC) };
+    mounted.insert(mounted.end(), arms[0].begin(), arms[0].end());
+    mounted.push_back(Transform(0.1, 0.05, 0.02, 0, STATIC));
+    arms.push_back(mounted);
+    return arms;
+}
+
+static double pose_difference(const double* a, const double* b) {
+    double difference = 0;
+    for (int entry = 0; entry < 12; entry++) {
+        difference = std::max(difference, std::fabs(a[entry] - b[entry]));
+    }
+    return difference;
+}
+
+static double angle_difference(double a, double b) {
+    return std::fabs(std::remainder(a - b, 2*M_PI));
+}
+
+// Every closed-form solution reaches the pose, and one of them is the configuration it came from
+static void check_closed_form(Arm& arm, const std::string& cache_directory) {
+    CHECK(arm.spherical_wrist());
+    CompiledKinematics kinematics = arm.compile(EXPORT_CSE|EXPORT_INVERSE_KINEMATICS, cache_directory);
+    std::vector<double> q = random_configurations(6, s_samples, 7);
+    int solved = 0;
+    for (int sample = 0; sample < s_samples; sample++) {
+        double pose[12], solutions[48], reached[12];
+        kinematics.forward_kinematics(&q[6*sample], pose);
+        int count = kinematics.inverse_kinematics(pose, solutions);
+        CHECK(count >= 1 && count <= 8);
+        double nearest = INFINITY;
+        for (int solution = 0; solution < count; solution++) {
+            kinematics.forward_kinematics(&solutions[6*solution], reached);
+            CHECK_NEAR(pose_difference(reached, pose), 0, 1e-8);
+            double distance = 0;
+            for (int joint = 0; joint < 6; joint++) {
+                distance = std::max(distance, angle_difference(solutions[6*solution + joint], q[6*sample + joint]));
+            }
+            nearest = std::min(nearest, distance);
+        }
+        solved += nearest < 1e-6;
+    }
+    // Configurations within rounding of the wrist singularity (q5 = 0) come back with q4 = 0
+    CHECK(solved >= s_samples - 2);
+}
+
+// Numerical solutions from seeds within 0.3 rad of the target configuration reach the pose; a 7 joint
+// arm has no closed form
+static void check_numerical(Arm& arm, int method, double converged_fraction, const std::string& cache_directory) {
+    CompiledKinematics kinematics = arm.compile(EXPORT_CSE|EXPORT_FUSED|EXPORT_GEOMETRIC_JACOBIAN, cache_directory);
+    const int joints = kinematics.joint_count;
+    IKOptions options;
+    options.method = method;
+    InverseKinematics ik (kinematics, options);
+    std::vector<double> q = random_configurations(joints, s_samples, 11);
+    std::vector<double> seeds = q, targets (12*s_samples);
+    std::mt19937 generator (5);
+    std::uniform_real_distribution<double> offset (-0.3, 0.3);
+    for (int sample = 0; sample < s_samples; sample++) {
+        kinematics.forward_kinematics(&q[joints*sample], &targets[12*sample]);
+        for (int joint = 0; joint < joints; joint++) {
+            seeds[joints*sample + joint] += offset(generator);
+        }
+    }
+    std::vector<double> solutions = seeds;
+    int converged = 0;
+    for (int sample = 0; sample < s_samples; sample++) {
+        IKResult result = ik.solve(&targets[12*sample], &solutions[joints*sample]);
+        double reached[12];
+        kinematics.forward_kinematics(&solutions[joints*sample], reached);
+        if (result.converged) {
+            converged++;
+            CHECK(result.error <= options.tolerance);
+            CHECK_NEAR(pose_difference(reached, &targets[12*sample]), 0, 1e-9);
+        }
+    }
+    CHECK(converged >= converged_fraction*s_samples);
+
+    // A batch over two threads gives the single solves' results
+    std::vector<double> batch = seeds;
+    std::vector<IKResult> results (s_samples);
+    ik.solve_batch(targets.data(), batch.data(), s_samples, results.data(), 2);
+    for (int index = 0; index < joints*s_samples; index++) {
+        CHECK_NEAR(batch[index], solutions[index], 1e-12);
+    }
+
+    // Joint limits hold for every solution, converged or not
+    std::vector<double> lower (joints, -1), upper (joints, 1);
+    ik.set_joint_limits(lower, upper);
+    for (int sample = 0; sample < s_samples; sample++) {
+        std::vector<double> limited (&seeds[joints*sample], &seeds[joints*(sample + 1)]);
+        ik.solve(&targets[12*sample], limited.data());
+        for (int joint = 0; joint < joints; joint++) {
+            CHECK(limited[joint] >= -1 && limited[joint] <= 1);
+        }
+    }
+}
+
+int main() {
+    std::string cache_directory = check_cache_directory();
+    for (auto& transforms : spherical_wrist_arms()) {
+        Arm arm (transforms);
+        check_closed_form(arm, cache_directory);
+    }
+
+    std::vector<Transform> redundant = spherical_wrist_arms()[0];
+    redundant.insert(redundant.begin() + 3, Transform(0, 0.1, 0.05, pi/2, REVOLUTE, 7));
+    Arm seven (redundant);
+    check_numerical(seven, IK_LEVENBERG_MARQUARDT, 0.98, cache_directory);
+    check_numerical(seven, IK_DAMPED_LEAST_SQUARES, 0.9, cache_directory);
+
+    // Unreachable poses have no solutions
+    Arm arm (spherical_wrist_arms()[0]);
+    CompiledKinematics kinematics = arm.compile(EXPORT_CSE|EXPORT_INVERSE_KINEMATICS, cache_directory);
+    double far[12] = { 1, 0, 0, 10, 0, 1, 0, 0, 0, 0, 1, 0 }, solutions[48];
+    CHECK(kinematics.inverse_kinematics(far, solutions) == 0);
+    return check_result("test_inverse_kinematics");
+}
@@ -0,0 +1,93 @@
+#include "../RoboticsTools/kinematic_tree.h"
+#include "../RoboticsTools/benchmark.h"
+#include "check.h"
+using SymbolicConstant::pi;
+
+static bool throws(const std::vector<Transform>& transforms) {
+    try {
+        KinematicTree tree (transforms);
+    } catch (std::invalid_argument&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    std::string cache_directory = check_cache_directory();
+
+    // Dual-arm torso: a revolute torso & static chest carrying a 3 joint arm (with a prismatic joint) & a
+    // 3 joint arm
+    Transform torso (0, 0.4, 0, pi/2, REVOLUTE, 1);
+    torso.set_frame("torso");
+    Transform chest (0, 0.2, 0.1, 0, STATIC);
+    chest.set_frame("chest", "torso");
+    Transform l1 (0, 0.1, 0, pi/2, REVOLUTE, 2), l2 (0, 0, 0.3, 0, REVOLUTE, 3), l3 (0, 0, 0.25, 0, PRISMATIC, 4);
+    Transform r1 (0, -0.1, 0, -pi/2, REVOLUTE, 5), r2 (0, 0, 0.3, 0, REVOLUTE, 6), r3 (0, 0.05, 0.25, pi/2, REVOLUTE, 7);
+    l1.set_frame("l1", "chest");
+    l2.set_frame("l2", "l1");
+    l3.set_frame("l3", "l2");
+    r1.set_frame("r1", "chest");
+    r2.set_frame("r2", "r1");
+    r3.set_frame("r3", "r2");
+    KinematicTree tree ({torso, chest, l1, l2, l3, r1, r2, r3});
+    CHECK(tree.end_effector_count() == 2);
+    CHECK(tree.path(1) == std::vector<int>({0, 1, 5, 6, 7}));
+
+    CompiledKinematics kinematics = tree.compile(EXPORT_GEOMETRIC_JACOBIAN|EXPORT_TRIG_IDENTITIES, cache_directory);
+    const int joints = kinematics.joint_count;
+    CHECK(joints == 7 && kinematics.end_effector_count == 2 && kinematics.frame_count == 8);
+
+    // Each end effector's pose & Jacobian block against its branch as an Arm, with zero columns off the branch
+    const int samples = 50;
+    std::vector<double> q = random_configurations(joints, samples, 21);
+    for (int effector = 0; effector < 2; effector++) {
+        Arm arm = tree.branch(effector);
+        CompiledKinematics branch = arm.compile(EXPORT_GEOMETRIC_JACOBIAN, cache_directory);
+        std::vector<int> columns;
+        for (int index = 0, column = 0; index < tree.m_transforms.size(); index++) {
+            if (tree.m_transforms[index].is_actuated()) {
+                std::vector<int> path = tree.path(effector);
+                if (std::find(path.begin(), path.end(), index) != path.end()) {
+                    columns.push_back(column);
+                }
+                column++;
+            }
+        }
+        const int branch_joints = columns.size();
+        for (int sample = 0; sample < samples; sample++) {
+            const double* q_sample = &q[joints*sample];
+            std::vector<double> q_branch, poses (24), jacobian (12*joints), frames (96), pose (12), branch_jacobian (6*branch_joints);
+            for (int column : columns) {
+                q_branch.push_back(q_sample[column]);
+            }
+            kinematics.forward_kinematics(q_sample, poses.data());
+            kinematics.geometric_jacobian(q_sample, jacobian.data());
+            kinematics.all_frames(q_sample, frames.data());
+            branch.forward_kinematics(q_branch.data(), pose.data());
+            branch.geometric_jacobian(q_branch.data(), branch_jacobian.data());
+            for (int entry = 0; entry < 12; entry++) {
+                CHECK_NEAR(poses[12*effector + entry], pose[entry], 1e-12);
+                CHECK_NEAR(frames[12*tree.m_end_effectors[effector] + entry], pose[entry], 1e-12);
+            }
+            for (int row = 0; row < 6; row++) {
+                for (int column = 0; column < joints; column++) {
+                    auto found = std::find(columns.begin(), columns.end(), column);
+                    double expected = (found == columns.end()) ? 0 : branch_jacobian[row*branch_joints + (found - columns.begin())];
+                    CHECK_NEAR(jacobian[6*joints*effector + row*joints + column], expected, 1e-12);
+                }
+            }
+        }
+    }
+
+    // Parents must be named & precede their children, and frames & joints are unique
+    Transform first (0, 0.1, 0, 0, REVOLUTE, 1), second (0, 0.1, 0, 0, REVOLUTE, 2);
+    first.set_frame("a");
+    second.set_frame("b", "c");
+    CHECK(throws({first, second}));
+    second.set_frame("a");
+    CHECK(throws({first, second}));
+    second.set_frame("b", "a");
+    CHECK(!throws({first, second}));
+    CHECK(throws({first, Transform(0, 0.1, 0, 0, REVOLUTE, 1)}));
+    return check_result("test_kinematic_tree");
+}
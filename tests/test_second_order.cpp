@@ -0,0 +1,59 @@
+#include "../RoboticsTools/arm.h"
+#include "check.h"
+using SymbolicConstant::pi;
+
+// The kinematic Hessian & dJ/dt*q_dot against central differences of the compiled geometric Jacobian
+static void check_second_order(Arm& arm, int options, const std::string& cache_directory) {
+    CompiledKinematics compiled = arm.compile(options | EXPORT_GEOMETRIC_JACOBIAN | EXPORT_HESSIAN |
+                                              EXPORT_JACOBIAN_DERIVATIVE, cache_directory);
+    const int joints = compiled.joint_count;
+    const double step = 1e-5;
+    std::vector<double> q (joints), q_dot (joints), shifted (joints), hessian (6*joints*joints), product (6);
+    std::vector<double> above (6*joints), below (6*joints), difference (6*joints*joints);
+    for (int sample = 0; sample < 20; sample++) {
+        for (int joint = 0; joint < joints; joint++) {
+            q[joint] = std::sin(1.3*sample + 0.7*joint)*3;
+            q_dot[joint] = std::cos(0.9*sample + 1.1*joint)*2;
+        }
+        compiled.kinematic_hessian(q.data(), hessian.data());
+        compiled.jacobian_derivative_product(q.data(), q_dot.data(), product.data());
+
+        // dJ(r, i)/dq_j at [(r*N + i)*N + j]
+        for (int j = 0; j < joints; j++) {
+            shifted = q;
+            shifted[j] = q[j] + step;
+            compiled.geometric_jacobian(shifted.data(), above.data());
+            shifted[j] = q[j] - step;
+            compiled.geometric_jacobian(shifted.data(), below.data());
+            for (int entry = 0; entry < 6*joints; entry++) {
+                difference[entry*joints + j] = (above[entry] - below[entry])/(2*step);
+            }
+        }
+        for (int entry = 0; entry < 6*joints*joints; entry++) {
+            CHECK_NEAR(hessian[entry], difference[entry], 1e-8);
+        }
+
+        // dJ/dt*q_dot = sum over i & j of dJ(r, i)/dq_j*q_dot_j*q_dot_i
+        for (int row = 0; row < 6; row++) {
+            double expected = 0;
+            for (int i = 0; i < joints; i++) {
+                for (int j = 0; j < joints; j++) {
+                    expected += difference[(row*joints + i)*joints + j]*q_dot[j]*q_dot[i];
+                }
+            }
+            CHECK_NEAR(product[row], expected, 1e-8);
+        }
+    }
+}
+
+int main() {
+    std::string cache_directory = check_cache_directory();
+
+    Arm arm({Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0.3, 0, 0, -pi/2, PRISMATIC, 2),
+             Transform(0.2, 0.1, 0.035, pi/3, STATIC), Transform(0, 0, 0.455, pi/2, REVOLUTE, 3),
+             Transform(0, 0.42, 0.1, 0, REVOLUTE, 4)});
+    for (int options : { EXPORT_DEFAULT, EXPORT_CSE }) {
+        check_second_order(arm, options, cache_directory);
+    }
+    return check_result("test_second_order");
+}
@@ -0,0 +1,71 @@
+#include "../RoboticsTools/arm.h"
+#include "check.h"
+using SymbolicConstant::pi;
+
+// The tape's pose & geometric Jacobian against the compiled kinematics, with & without CSE, and its
+// batches against single evaluations
+static void check_tape(Arm& arm, const std::string& cache_directory) {
+    CompiledKinematics compiled = arm.compile(EXPORT_GEOMETRIC_JACOBIAN, cache_directory);
+    const int joints = compiled.joint_count;
+    for (int options : { EXPORT_DEFAULT, EXPORT_CSE }) {
+        KinematicsTape tape = arm.tape(options | EXPORT_GEOMETRIC_JACOBIAN);
+        CHECK(tape.output_count() == 12 + 6*joints);
+        std::vector<double> q (joints), out (tape.output_count()), expected (tape.output_count());
+        for (int sample = 0; sample < 20; sample++) {
+            for (int joint = 0; joint < joints; joint++) {
+                q[joint] = std::sin(1.3*sample + 0.7*joint)*3;
+            }
+            tape.evaluate(q.data(), out.data());
+            compiled.forward_kinematics(q.data(), expected.data());
+            compiled.geometric_jacobian(q.data(), &expected[12]);
+            for (int entry = 0; entry < tape.output_count(); entry++) {
+                CHECK_NEAR(out[entry], expected[entry], 1e-12);
+            }
+        }
+
+        // Structure-of-arrays batches, partial & whole blocks of TAPE_LANES, against single evaluations
+        for (int count : { 1, 63, 64, 100 }) {
+            std::vector<double> q_batch (joints*count), out_batch (tape.output_count()*count);
+            for (int sample = 0; sample < count; sample++) {
+                for (int joint = 0; joint < joints; joint++) {
+                    q_batch[joint*count + sample] = std::cos(0.9*sample + 1.1*joint)*3;
+                }
+            }
+            tape.evaluate_batch(q_batch.data(), count, out_batch.data());
+            for (int sample = 0; sample < count; sample++) {
+                for (int joint = 0; joint < joints; joint++) {
+                    q[joint] = q_batch[joint*count + sample];
+                }
+                tape.evaluate(q.data(), out.data());
+                for (int entry = 0; entry < tape.output_count(); entry++) {
+                    CHECK_NEAR(out_batch[entry*count + sample], out[entry], 1e-13);
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    std::string cache_directory = check_cache_directory();
+
+    // A static base offset folds constant sines & cosines into the chain, leaving signed zero factors
+    Arm offset({Transform(0.3, 0.2, 0, 0, STATIC), Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1)});
+    check_tape(offset, cache_directory);
+
+    Arm arm({Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2),
+             Transform(0.2, 0.1, 0.035, pi/2, STATIC), Transform(0, 0, 0, 0, PRISMATIC, 3),
+             Transform(0, 0.42, 0, -pi/2, REVOLUTE, 4)});
+    check_tape(arm, cache_directory);
+
+    // Signed numeric factors are coefficients, not tokens: 2 - 1.5*q1 - (-0)*q1
+    MultiplyExpression constant_term { true, { "2" } }, scaled { false, { "1.5", "q1" } }, zero { false, { "-0", "q1" } };
+    SumExpression sum;
+    sum.elements = { constant_term, scaled, zero };
+    ExpressionTree tree (std::string("0"));
+    tree.m_expr = sum;
+    KinematicsTape signed_tape ({ "q1" }, { tree }, {});
+    double q1 = 0.5, value;
+    signed_tape.evaluate(&q1, &value);
+    CHECK_NEAR(value, 1.25, 1e-15);
+    return check_result("test_tape");
+}
@@ -0,0 +1,66 @@
+#include "../RoboticsTools/arm.h"
+#include "check.h"
+using SymbolicConstant::pi;
+
+static const int s_samples = 20000;
+
+// Pose errors of the float & fixed-point exports of a 6 joint arm stay within bounds
+static void check_target_errors(const std::string& cache_directory) {
+    Arm arm({Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2),
+             Transform(0, 0, 0.035, pi/2, REVOLUTE, 3), Transform(0, 0.42, 0, -pi/2, REVOLUTE, 4),
+             Transform(0, 0, 0, pi/2, REVOLUTE, 5), Transform(0, 0.08, 0, 0, REVOLUTE, 6)});
+    arm.m_export_cache = "";
+    TargetError float32 = arm.export_target(cache_directory + "/float32.cpp", EXPORT_FLOAT32|EXPORT_CSE, s_samples,
+                                            cache_directory);
+    CHECK(float32.samples == s_samples);
+    CHECK(float32.rotation < 2e-6);
+    CHECK(float32.position < 2e-6);
+
+    TargetError q16 = arm.export_target(cache_directory + "/q16.cpp", EXPORT_FIXED_POINT|EXPORT_CSE, s_samples,
+                                        cache_directory);
+    CHECK(q16.rotation < 3e-4);
+    CHECK(q16.position < 3e-4);
+
+    arm.m_fixed_point_bits = 24;
+    TargetError q24 = arm.export_target(cache_directory + "/q24.cpp", EXPORT_FIXED_POINT|EXPORT_CSE, s_samples,
+                                        cache_directory);
+    CHECK(q24.rotation < 1e-4);
+    CHECK(q24.position < 1e-4);
+    CHECK(q24.position < q16.position);
+}
+
+static std::string read_file(const std::string& filename) {
+    std::ifstream file (filename, std::ifstream::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// The fixed-point format is part of the export cache key
+static void check_fixed_point_cache(const std::string& cache_directory) {
+    Arm arm({Transform(0, 0.4, 0.025, pi/2, REVOLUTE, 1), Transform(0, 0, 0.455, 0, REVOLUTE, 2)});
+    arm.m_export_cache = cache_directory + "/exports";
+    const ExportCacheStatistics& statistics = Arm::export_cache_statistics();
+    long misses = statistics.misses, hits = statistics.hits;
+    arm.export_expressions(cache_directory + "/q16_cached.cpp", EXPORT_FIXED_POINT);
+    arm.export_expressions(cache_directory + "/q16_cached.cpp", EXPORT_FIXED_POINT);
+    CHECK(statistics.misses == misses + 1);
+    CHECK(statistics.hits == hits + 1);
+
+    arm.m_fixed_point_bits = 24;
+    arm.export_expressions(cache_directory + "/q24_cached.cpp", EXPORT_FIXED_POINT);
+    CHECK(statistics.misses == misses + 2);
+    CHECK(read_file(cache_directory + "/q24_cached.cpp") != read_file(cache_directory + "/q16_cached.cpp"));
+
+    arm.m_fixed_point_bits = 16;
+    arm.m_sin_table_bits = 12;
+    arm.export_expressions(cache_directory + "/q16_table_cached.cpp", EXPORT_FIXED_POINT);
+    CHECK(statistics.misses == misses + 3);
+}
+
+int main() {
+    std::string cache_directory = compile_cache_directory(check_cache_directory());
+    check_target_errors(cache_directory);
+    check_fixed_point_cache(cache_directory);
+    return check_result("test_target");
+}
@@ -0,0 +1,46 @@
+#include "../RoboticsTools/arm.h"
+#include "check.h"
+using SymbolicConstant::pi;
+
+// Denavit-Hartenberg transform of doubles, as the toolkit's convention
+static std::vector<std::vector<double>> dh(double theta, double d, double a, double alpha) {
+    return { { std::cos(theta), -std::sin(theta)*std::cos(alpha), std::sin(theta)*std::sin(alpha), a*std::cos(theta) },
+             { std::sin(theta), std::cos(theta)*std::cos(alpha), -std::cos(theta)*std::sin(alpha), a*std::sin(theta) },
+             { 0, std::sin(alpha), std::cos(alpha), d },
+             { 0, 0, 0, 1 } };
+}
+
+int main() {
+    // Constant angles that are not multiples of pi/4 or pi/6 fold to doubles
+    Arm arm({Transform(0, 0.4, 0, pi/12, REVOLUTE, 1), Transform(0, 0.1, 0.2, pi/5, REVOLUTE, 2),
+             Transform(pi/12 + 0.1, 0.05, 0.3, -3*pi/7, STATIC), Transform(0, 0, 0.25, pi/2, REVOLUTE, 3)});
+    std::vector<std::vector<double>> expected = dh(0, 0, 0, 0);
+
+    std::vector<double> q { 0.3, -1.1, 0.7 };
+    std::vector<std::vector<std::vector<double>>> frames = arm.get_positions(q);
+    std::vector<std::vector<std::vector<double>>> links { dh(q[0], 0.4, 0, M_PI/12), dh(q[1], 0.1, 0.2, M_PI/5),
+                                                          dh(M_PI/12 + 0.1, 0.05, 0.3, -3*M_PI/7),
+                                                          dh(q[2], 0, 0.25, M_PI/2) };
+    for (int frame = 0; frame < links.size(); frame++) {
+        expected = multiply_transforms(expected, links[frame]);
+        for (int row = 0; row < 4; row++) {
+            for (int column = 0; column < 4; column++) {
+                CHECK_NEAR(frames[frame][row][column], expected[row][column], 1e-12);
+            }
+        }
+    }
+
+    // The exported code compiles & agrees with the runtime transforms
+    CompiledKinematics compiled = arm.compile(EXPORT_DEFAULT, check_cache_directory());
+    double pose[12];
+    compiled.forward_kinematics(q.data(), pose);
+    for (int entry = 0; entry < 12; entry++) {
+        CHECK_NEAR(pose[entry], expected[entry/4][entry % 4], 1e-12);
+    }
+
+    // Multiples of pi/4 & pi/6 stay exact
+    Transform right_angle (0, 0, 0, pi/2, STATIC);
+    CHECK(right_angle.m_transform(2, 2) == 0);
+    CHECK(right_angle.m_transform(2, 1) == 1);
+    return check_result("test_transform");
+}